@@ -10,6 +10,17 @@
 Softuart *_Softuart_GPIO_Instances[SOFTUART_GPIO_COUNT];
 uint8_t _Softuart_Instances_Count = 0;
 
+//instance driven by the FRC1 tx timer
+Softuart *_Softuart_Tx_Instance = NULL;
+
+//FRC1 control bits (local to the SDK's hw_timer.c), edge interrupt mode
+#define SOFTUART_FRC1_ENABLE	BIT7
+#define SOFTUART_FRC1_AUTO_LOAD	BIT6
+#define SOFTUART_FRC1_DIV_16	4
+#define SOFTUART_FRC1_CLK	(80000000 / 16)
+
+static void Softuart_Tx_Intr_Handler(void *arg);
+
 //intialize list of gpio names and functions
 softuart_reg_t softuart_reg[] =
 {
@@ -103,6 +114,13 @@ void ICACHE_FLASH_ATTR Softuart_Init(Softuart *s, uint32_t baudrate)
 	//disable rs485
 	s->is_rs485 = 0;
 
+	//line is idle (high)
+	s->edges.head = s->edges.tail = 0;
+	s->edges.overflow = 0;
+	s->rx_level = 1;
+	s->rx_busy = 0;
+	s->rx_errors = 0;
+
 	if(! _Softuart_Instances_Count) {
 		os_printf("SOFTUART initialize gpio\r\n");
 		//Initilaize gpio subsystem
@@ -115,6 +133,7 @@ void ICACHE_FLASH_ATTR Softuart_Init(Softuart *s, uint32_t baudrate)
         } else {
             s->bit_time = (1000000 / baudrate);
             if ( ((100000000 / baudrate) - (100*s->bit_time)) > 50 ) s->bit_time++;
+            s->tx_ticks = (SOFTUART_FRC1_CLK + baudrate / 2) / baudrate;
             os_printf("SOFTUART bit_time is %d\r\n",s->bit_time);
         }
 
@@ -132,6 +151,16 @@ void ICACHE_FLASH_ATTR Softuart_Init(Softuart *s, uint32_t baudrate)
 		//set high for tx idle
 		GPIO_OUTPUT_SET(GPIO_ID_PIN(s->pin_tx.gpio_id), 1);
 		os_delay_us(0xffff);
+
+		//bit clock: FRC1 in auto reload mode, started by Softuart_Putchar()
+		s->tx.head = s->tx.tail = 0;
+		s->tx.running = 0;
+		s->tx.dropped = 0;
+		RTC_REG_WRITE(FRC1_CTRL_ADDRESS, 0);
+		_Softuart_Tx_Instance = s;
+		ETS_FRC_TIMER1_INTR_ATTACH(Softuart_Tx_Intr_Handler, NULL);
+		TM1_EDGE_INT_ENABLE();
+		ETS_FRC1_INTR_ENABLE();
 		
 		os_printf("SOFTUART TX INIT DONE\r\n");
 	}
@@ -193,94 +222,131 @@ void ICACHE_FLASH_ATTR Softuart_Init(Softuart *s, uint32_t baudrate)
 	os_printf("SOFTUART INIT DONE\r\n");
 }
 
+//Only timestamps the edge, the bits are decoded in task context
 void Softuart_Intr_Handler(Softuart *s)
 {
-	uint8_t level, gpio_id;
+	uint8_t level, gpio_id, head;
+	uint32_t now = system_get_time();
 // clear gpio status. Say ESP8266EX SDK Programming Guide in  5.1.6. GPIO interrupt handler
 
-    uint32_t gpio_status = GPIO_REG_READ(GPIO_STATUS_ADDRESS);
+	uint32_t gpio_status = GPIO_REG_READ(GPIO_STATUS_ADDRESS);
 	gpio_id = Softuart_Bitcount(gpio_status);
 
 	//if interrupt was by an attached rx pin
-    if (gpio_id != 0xFF)
-    {
-		//load instance which has rx pin on interrupt pin attached
-		s = _Softuart_GPIO_Instances[gpio_id];
+	if (gpio_id != 0xFF && (s = _Softuart_GPIO_Instances[gpio_id]) != NULL)
+	{
+		level = GPIO_INPUT_GET(GPIO_ID_PIN(s->pin_rx.gpio_id));
 
-// disable interrupt for GPIO0
-        gpio_pin_intr_state_set(GPIO_ID_PIN(s->pin_rx.gpio_id), GPIO_PIN_INTR_DISABLE);
+		head = s->edges.head;
+		if ((uint8_t)(head - s->edges.tail) < SOFTUART_MAX_EDGES) {
+			s->edges.edge[head & (SOFTUART_MAX_EDGES - 1)] =
+				(now & SOFTUART_TIME_MASK) | (level ? SOFTUART_EDGE_LEVEL : 0);
+			s->edges.head = head + 1;
+		} else {
+			s->edges.overflow = 1;
+		}
+	}
 
-// Do something, for example, increment whatyouwant indirectly
-		//check level
-		level = GPIO_INPUT_GET(GPIO_ID_PIN(s->pin_rx.gpio_id));
-		if(!level) {
-			//pin is low
-			//therefore we have a start bit
-
-			//wait till start bit is half over so we can sample the next one in the center
-			os_delay_us(s->bit_time/2);	
-
-			//now sample bits
-			unsigned i;
-			unsigned d = 0;
-			unsigned start_time = 0x7FFFFFFF & system_get_time();
-
-			for(i = 0; i < 8; i ++ )
-			{
-				while ((0x7FFFFFFF & system_get_time()) < (start_time + (s->bit_time*(i+1))))
-				{
-					//If system timer overflow, escape from while loop
-					if ((0x7FFFFFFF & system_get_time()) < start_time){break;}
-				}
-				//shift d to the right
-				d >>= 1;
-
-				//read bit
-				if(GPIO_INPUT_GET(GPIO_ID_PIN(s->pin_rx.gpio_id))) {
-					//if high, set msb of 8bit to 1
-					d |= 0x80;
-				}
-			}
+	//clear interrupt, no matter from which pin
+	//otherwise, this interrupt will be called again forever
+	GPIO_REG_WRITE(GPIO_STATUS_W1TC_ADDRESS, gpio_status);
+}
 
-			//store byte in buffer
-
-			// if buffer full, set the overflow flag and return
-			uint8 next = (s->buffer.receive_buffer_tail + 1) % SOFTUART_MAX_RX_BUFF;
-			if (next != s->buffer.receive_buffer_head)
-			{
-			  // save new data in buffer: tail points to where byte goes
-			  s->buffer.receive_buffer[s->buffer.receive_buffer_tail] = d; // save new byte
-			  s->buffer.receive_buffer_tail = next;
-			} 
-			else 
-			{
-			  s->buffer.buffer_overflow = 1;
-			}
 
-			//wait for stop bit
-			os_delay_us(s->bit_time);	
+//Sampling point of bit k of a frame (0-7: data, 8: stop bit) after the start edge
+#define SOFTUART_SAMPLE(s, k)	((uint32_t)(s)->bit_time * (2 * (k) + 3) / 2)
+
+static void ICACHE_FLASH_ATTR Softuart_Store(Softuart *s, uint8_t d)
+{
+	// if buffer full, set the overflow flag
+	uint8 next = (s->buffer.receive_buffer_tail + 1) % SOFTUART_MAX_RX_BUFF;
+	if (next != s->buffer.receive_buffer_head)
+	{
+	  // save new data in buffer: tail points to where byte goes
+	  s->buffer.receive_buffer[s->buffer.receive_buffer_tail] = d; // save new byte
+	  s->buffer.receive_buffer_tail = next;
+	}
+	else
+	{
+	  s->buffer.buffer_overflow = 1;
+	}
+}
+
+//Samples the bits of the current frame up to time t after the start edge,
+//the line had rx_level all the time since the last edge
+static void ICACHE_FLASH_ATTR Softuart_Sample(Softuart *s, uint32_t t)
+{
+	while (s->rx_busy && SOFTUART_SAMPLE(s, s->rx_bit) < t) {
+		if (s->rx_bit < 8) {
+			//LSB first
+			s->rx_data >>= 1;
+			if (s->rx_level)
+				s->rx_data |= 0x80;
+			s->rx_bit++;
+		} else {
+			if (s->rx_level)
+				Softuart_Store(s, s->rx_data);
+			else
+				s->rx_errors++;
+			s->rx_busy = 0;
+		}
+	}
+}
 
-			//done
+//Decodes the recorded edges into bytes
+static void ICACHE_FLASH_ATTR Softuart_Decode(Softuart *s)
+{
+	//taken before the edges are read, so no edge before now can be missing
+	uint32_t now = system_get_time() & SOFTUART_TIME_MASK;
+	uint32_t e, t;
+	uint8_t level;
+
+	while (s->edges.tail != s->edges.head) {
+		e = s->edges.edge[s->edges.tail & (SOFTUART_MAX_EDGES - 1)];
+		s->edges.tail++;
+
+		t = e & SOFTUART_TIME_MASK;
+		level = (e & SOFTUART_EDGE_LEVEL) ? 1 : 0;
+		if (level == s->rx_level)
+			continue;	//two edges too close for the interrupt
+
+		if (s->rx_busy)
+			Softuart_Sample(s, (t - s->rx_start) & SOFTUART_TIME_MASK);
+		s->rx_level = level;
+
+		if (!s->rx_busy && level == 0) {
+			//start bit
+			s->rx_busy = 1;
+			s->rx_start = t;
+			s->rx_bit = 0;
+			s->rx_data = 0;
 		}
+	}
 
-		//clear interrupt
-        GPIO_REG_WRITE(GPIO_STATUS_W1TC_ADDRESS, gpio_status);
+	if (s->edges.overflow) {
+		//edges after the recorded ones are lost, resync on the next start bit
+		s->edges.overflow = 0;
+		s->rx_busy = 0;
+		s->rx_errors++;
+		s->rx_level = GPIO_INPUT_GET(GPIO_ID_PIN(s->pin_rx.gpio_id));
+		return;
+	}
 
-// Reactivate interrupts for GPIO0
-        gpio_pin_intr_state_set(GPIO_ID_PIN(s->pin_rx.gpio_id), 3);
-	} else {
-		//clear interrupt, no matter from which pin
-		//otherwise, this interrupt will be called again forever
-        GPIO_REG_WRITE(GPIO_STATUS_W1TC_ADDRESS, gpio_status);
+	//no edge since: the line still has rx_level
+	if (s->rx_busy) {
+		t = (now - s->rx_start) & SOFTUART_TIME_MASK;
+		if (t < (SOFTUART_TIME_MASK >> 1))
+			Softuart_Sample(s, t);
 	}
 }
 
 
-
 // Read data from buffer
-uint8_t Softuart_Read(Softuart *s)
+uint8_t ICACHE_FLASH_ATTR Softuart_Read(Softuart *s)
 {
   // Empty buffer?
+  if (s->buffer.receive_buffer_head == s->buffer.receive_buffer_tail)
+    Softuart_Decode(s);
   if (s->buffer.receive_buffer_head == s->buffer.receive_buffer_tail)
     return 0;
 
@@ -291,63 +357,80 @@ uint8_t Softuart_Read(Softuart *s)
 }
 
 // Is data in buffer available?
-BOOL Softuart_Available(Softuart *s)
+BOOL ICACHE_FLASH_ATTR Softuart_Available(Softuart *s)
 {
+	Softuart_Decode(s);
 	return (s->buffer.receive_buffer_tail + SOFTUART_MAX_RX_BUFF - s->buffer.receive_buffer_head) % SOFTUART_MAX_RX_BUFF;
 }
 
-static inline u8 chbit(u8 data, u8 bit)
+//Sends the queued chars, one bit per FRC1 tick
+static void Softuart_Tx_Intr_Handler(void *arg)
 {
-    if ((data & bit) != 0)
-    {
-    	return 1;
-    }
-    else
-    {
-    	return 0;
-    }
+	Softuart *s = _Softuart_Tx_Instance;
+	uint32_t pin;
+
+	RTC_CLR_REG_MASK(FRC1_INT_ADDRESS, FRC1_INT_CLR_MASK);
+	if (s == NULL)
+		return;
+	pin = BIT(s->pin_tx.gpio_id);
+
+	if (s->tx.bit == 0) {
+		if (s->tx.tail == s->tx.head) {
+			//queue empty and the last stop bit is out
+			RTC_REG_WRITE(FRC1_CTRL_ADDRESS, 0);
+			if (s->is_rs485 == 1)
+				GPIO_OUTPUT_SET(GPIO_ID_PIN(s->pin_rs485_tx_enable), 0);
+			s->tx.running = 0;
+			return;
+		}
+		s->tx.data = s->tx.buffer[s->tx.tail & (SOFTUART_MAX_TX_BUFF - 1)];
+		s->tx.tail++;
+		//start bit
+		GPIO_REG_WRITE(GPIO_OUT_W1TC_ADDRESS, pin);
+	} else if (s->tx.bit <= 8) {
+		//LSB first
+		GPIO_REG_WRITE((s->tx.data & 1) ? GPIO_OUT_W1TS_ADDRESS : GPIO_OUT_W1TC_ADDRESS, pin);
+		s->tx.data >>= 1;
+	} else {
+		//stop bit
+		GPIO_REG_WRITE(GPIO_OUT_W1TS_ADDRESS, pin);
+	}
+	s->tx.bit = (s->tx.bit == 9) ? 0 : s->tx.bit + 1;
 }
 
-// Function for printing individual characters
+// Queues a char for the tx interrupt, never waits
 void Softuart_Putchar(Softuart *s, char data)
 {
-	unsigned i;
-	unsigned start_time = 0x7FFFFFFF & system_get_time();
+	uint16_t head;
 
-	//if rs485 set tx enable
-	if(s->is_rs485 == 1)
-	{
-		GPIO_OUTPUT_SET(GPIO_ID_PIN(s->pin_rs485_tx_enable), 1);
+	if (s != _Softuart_Tx_Instance || s->tx_ticks == 0) {
+		s->tx.dropped++;
+		return;
 	}
 
-	//Start Bit
-	GPIO_OUTPUT_SET(GPIO_ID_PIN(s->pin_tx.gpio_id), 0);
-	for(i = 0; i <= 8; i ++ )
-	{
-		while ((0x7FFFFFFF & system_get_time()) < (start_time + (s->bit_time*(i+1))))
-		{
-			//If system timer overflow, escape from while loop
-			if ((0x7FFFFFFF & system_get_time()) < start_time){break;}
-		}
-		GPIO_OUTPUT_SET(GPIO_ID_PIN(s->pin_tx.gpio_id), chbit(data,1<<i));
-	}
+	//os_printf() may be called from interrupt handlers as well
+	ETS_INTR_LOCK();
+	head = s->tx.head;
+	if ((uint16_t)(head - s->tx.tail) < SOFTUART_MAX_TX_BUFF) {
+		s->tx.buffer[head & (SOFTUART_MAX_TX_BUFF - 1)] = data;
+		s->tx.head = head + 1;
 
-	// Stop bit
-	while ((0x7FFFFFFF & system_get_time()) < (start_time + (s->bit_time*9)))
-	{
-		//If system timer overflow, escape from while loop
-		if ((0x7FFFFFFF & system_get_time()) < start_time){break;}
-	}
-	GPIO_OUTPUT_SET(GPIO_ID_PIN(s->pin_tx.gpio_id), 1);
+		if (!s->tx.running) {
+			s->tx.running = 1;
+			s->tx.bit = 0;
 
-	// Delay after byte, for new sync
-	os_delay_us(s->bit_time*6);
+			//if rs485 set tx enable, one bit time before the start bit
+			if (s->is_rs485 == 1)
+				GPIO_OUTPUT_SET(GPIO_ID_PIN(s->pin_rs485_tx_enable), 1);
 
-	//if rs485 set tx disable 
-	if(s->is_rs485 == 1)
-	{
-		GPIO_OUTPUT_SET(GPIO_ID_PIN(s->pin_rs485_tx_enable), 0);
+			RTC_REG_WRITE(FRC1_LOAD_ADDRESS, s->tx_ticks);
+			RTC_REG_WRITE(FRC1_CTRL_ADDRESS,
+				SOFTUART_FRC1_AUTO_LOAD | SOFTUART_FRC1_DIV_16 | SOFTUART_FRC1_ENABLE);
+		}
+	} else {
+		s->tx.dropped++;
 	}
+	ETS_INTR_UNLOCK();
 }
 
 void Softuart_Puts(Softuart *s, const char *c )
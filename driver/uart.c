@@ -29,14 +29,22 @@
 #include "driver/uart_register.h"
 #include "mem.h"
 #include "os_type.h"
+#include "spsc_ring.h"
 
 // UartDev is defined and initialized in rom code.
 extern UartDevice    UartDev;
 
-LOCAL struct UartBuffer* pTxBuffer = NULL;
-LOCAL struct UartBuffer* pRxBuffer = NULL;
+// The interrupt handler is the consumer of the tx ring and the producer of the rx ring
+LOCAL struct spsc_ring tx_ring;
+LOCAL struct spsc_ring rx_ring;
+
+// RX interrupts are masked while the rx ring is full, the FIFO (and RTS) holds back the data
+LOCAL volatile bool rx_throttled;
 
 uart_unload_fn uart0_unload_fn = NULL;
+uart_tx_fill_fn uart0_tx_fill_fn = NULL;
+
+struct uart_stats uart_stats;
 
 #define DBG  
 #define DBG1 uart1_sendStr_no_wait
@@ -63,12 +71,7 @@ uart_config(uint8 uart_no)
         ETS_UART_INTR_ATTACH(uart0_rx_intr_handler,  &(UartDev.rcv_buff));
         PIN_PULLUP_DIS(PERIPHS_IO_MUX_U0TXD_U);
         PIN_FUNC_SELECT(PERIPHS_IO_MUX_U0TXD_U, FUNC_U0TXD);
-	#if UART_HW_RTS
-        PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTDO_U, FUNC_U0RTS);   //HW FLOW CONTROL RTS PIN
-        #endif
-	#if UART_HW_CTS
-        PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTCK_U, FUNC_U0CTS);   //HW FLOW CONTROL CTS PIN
-        #endif
+        //HW flow control pins are selected by UART_SetFlowCtrl()
     }
     uart_div_modify(uart_no, UART_CLK_FREQ / (UartDev.baut_rate));//SET BAUDRATE
     
@@ -85,16 +88,9 @@ uart_config(uint8 uart_no)
         //set rx fifo trigger
         WRITE_PERI_REG(UART_CONF1(uart_no),
         ((100 & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S) |
-        #if UART_HW_RTS
-        ((110 & UART_RX_FLOW_THRHD) << UART_RX_FLOW_THRHD_S) |
-        UART_RX_FLOW_EN |   //enbale rx flow control
-        #endif
         (0x02 & UART_RX_TOUT_THRHD) << UART_RX_TOUT_THRHD_S |
         UART_RX_TOUT_EN|
         ((0x10 & UART_TXFIFO_EMPTY_THRHD)<<UART_TXFIFO_EMPTY_THRHD_S));//wjl 
-        #if UART_HW_CTS
-        SET_PERI_REG_MASK( UART_CONF0(uart_no),UART_TX_FLOW_EN);  //add this sentense to add a tx flow control via MTCK( CTS )
-        #endif
         SET_PERI_REG_MASK(UART_INT_ENA(uart_no), UART_RXFIFO_TOUT_INT_ENA |UART_FRM_ERR_INT_ENA);
     }else{
         WRITE_PERI_REG(UART_CONF1(uart_no),((UartDev.rcv_buff.TrigLvl & UART_RXFIFO_FULL_THRHD) << UART_RXFIFO_FULL_THRHD_S));//TrigLvl default val == 1
@@ -218,6 +214,7 @@ uart0_rx_intr_handler(void *para)
 	/*ALL THE FUNCTIONS CALLED IN INTERRUPT HANDLER MUST BE DECLARED IN RAM */
 	/*IF NOT , POST AN EVENT AND PROCESS IN SYSTEM TASK */
     if(UART_FRM_ERR_INT_ST == (READ_PERI_REG(UART_INT_ST(uart_no)) & UART_FRM_ERR_INT_ST)){
+        uart_stats.frm_err++;
         DBG1("FRM_ERR\r\n");
         WRITE_PERI_REG(UART_INT_CLR(uart_no), UART_FRM_ERR_INT_CLR);
     }else if(UART_RXFIFO_FULL_INT_ST == (READ_PERI_REG(UART_INT_ST(uart_no)) & UART_RXFIFO_FULL_INT_ST)){
@@ -245,6 +242,7 @@ uart0_rx_intr_handler(void *para)
         
     }else if(UART_RXFIFO_OVF_INT_ST  == (READ_PERI_REG(UART_INT_ST(uart_no)) & UART_RXFIFO_OVF_INT_ST)){
         WRITE_PERI_REG(UART_INT_CLR(uart_no), UART_RXFIFO_OVF_INT_CLR);
+        uart_stats.rx_ovf++;
         DBG1("RX OVF!!\r\n");
     }
 
@@ -261,8 +259,11 @@ uart0_rx_intr_handler(void *para)
 void ICACHE_FLASH_ATTR
 uart_init(UartBautRate uart0_br)
 {    
-    pTxBuffer = Uart_Buf_Init(UART_TX_BUFFER_SIZE);
-    pRxBuffer = Uart_Buf_Init(UART_RX_BUFFER_SIZE);
+    // the tx buffer is allocated with the first tx_buff_enq(), it is not needed
+    // if all data is sent via uart0_tx_fill_fn()
+    if (!spsc_ring_init(&rx_ring, UART_RX_BUFFER_SIZE)) {
+        DBG1("no buf for uart\n\r");
+    }
 
     UartDev.baut_rate = uart0_br;
 
@@ -311,120 +312,89 @@ void uart1_sendStr_no_wait(const char *str)
 }
 
 
-/******************************************************************************
- * FunctionName : Uart_Buf_Init
- * Description  : tx buffer enqueue: fill a first linked buffer 
- * Parameters   : char *pdata - data point  to be enqueue
- * Returns      : NONE
-*******************************************************************************/
-struct UartBuffer* ICACHE_FLASH_ATTR
-Uart_Buf_Init(uint32 buf_size)
+//re-enables the rx interrupts once the task has made room in the rx ring
+LOCAL void ICACHE_FLASH_ATTR
+rx_unthrottle(void)
 {
-    uint32 heap_size = system_get_free_heap_size();
-    if(heap_size <=buf_size){
-        DBG1("no buf for uart\n\r");
-        return NULL;
-    }else{
-        DBG("test heap size: %d\n\r",heap_size);
-        struct UartBuffer* pBuff = (struct UartBuffer* )os_malloc(sizeof(struct UartBuffer));
-        pBuff->UartBuffSize = buf_size;
-        pBuff->pUartBuff = (uint8*)os_malloc(pBuff->UartBuffSize);
-        pBuff->pInPos = pBuff->pUartBuff;
-        pBuff->pOutPos = pBuff->pUartBuff;
-        pBuff->Space = pBuff->UartBuffSize;
-        pBuff->BuffState = OK;
-        pBuff->nextBuff = NULL;
-        pBuff->TcpControl = RUN;
-        return pBuff;
+    if (rx_throttled && spsc_ring_room(&rx_ring) >= UART_FIFO_LEN) {
+        ETS_UART_INTR_DISABLE();
+        rx_throttled = false;
+        SET_PERI_REG_MASK(UART_INT_ENA(UART0), UART_RXFIFO_FULL_INT_ENA | UART_RXFIFO_TOUT_INT_ENA);
+        ETS_UART_INTR_ENABLE();
     }
 }
 
 
-//copy uart buffer
-LOCAL void Uart_Buf_Cpy(struct UartBuffer* pCur, char* pdata , uint16 data_len)
+//rx buffer dequeue
+uint16 ICACHE_FLASH_ATTR
+rx_buff_deq(char* pdata, uint16 data_len )
 {
-    if(data_len == 0) return ;
-    
-    uint16 tail_len = pCur->pUartBuff + pCur->UartBuffSize - pCur->pInPos ;
-    if(tail_len >= data_len){  //do not need to loop back  the queue
-        os_memcpy(pCur->pInPos , pdata , data_len );
-        pCur->pInPos += ( data_len );
-        pCur->pInPos = (pCur->pUartBuff +  (pCur->pInPos - pCur->pUartBuff) % pCur->UartBuffSize );
-        pCur->Space -=data_len;
-    }else{
-        os_memcpy(pCur->pInPos, pdata, tail_len);
-        pCur->pInPos += ( tail_len );
-        pCur->pInPos = (pCur->pUartBuff +  (pCur->pInPos - pCur->pUartBuff) % pCur->UartBuffSize );
-        pCur->Space -=tail_len;
-        os_memcpy(pCur->pInPos, pdata+tail_len , data_len-tail_len);
-        pCur->pInPos += ( data_len-tail_len );
-        pCur->pInPos = (pCur->pUartBuff +  (pCur->pInPos - pCur->pUartBuff) % pCur->UartBuffSize );
-        pCur->Space -=( data_len-tail_len);
-    }
-    
-}
+    uint16 len = spsc_ring_read(&rx_ring, pdata, data_len);
 
-/******************************************************************************
- * FunctionName : uart_buf_free
- * Description  : deinit of the tx buffer
- * Parameters   : struct UartBuffer* pTxBuff - tx buffer struct pointer
- * Returns      : NONE
-*******************************************************************************/
-void ICACHE_FLASH_ATTR
-uart_buf_free(struct UartBuffer* pBuff)
-{
-    os_free(pBuff->pUartBuff);
-    os_free(pBuff);
+    rx_unthrottle();
+    return len;
 }
 
 
-//rx buffer dequeue
+/******************************************************************************
+ * FunctionName : uart0_rx_unload
+ * Description  : hands the data in the rx ring over to fn in place, to be called
+ *                in task context on UART0_SIGNAL
+ * Parameters   : uart_unload_bulk_fn fn - consumer of the data, called once per
+ *                contiguous chunk
+ * Returns      : number of bytes handed over
+*******************************************************************************/
 uint16 ICACHE_FLASH_ATTR
-rx_buff_deq(char* pdata, uint16 data_len )
+uart0_rx_unload(uart_unload_bulk_fn fn)
 {
-    uint16 buf_len =  (pRxBuffer->UartBuffSize- pRxBuffer->Space);
-    uint16 tail_len = pRxBuffer->pUartBuff + pRxBuffer->UartBuffSize - pRxBuffer->pOutPos ;
-    uint16 len_tmp = 0;
-    len_tmp = ((data_len > buf_len)?buf_len:data_len);
-    if(pRxBuffer->pOutPos <= pRxBuffer->pInPos){
-        os_memcpy(pdata, pRxBuffer->pOutPos,len_tmp);
-        pRxBuffer->pOutPos+= len_tmp;
-        pRxBuffer->Space += len_tmp;
-    }else{
-        if(len_tmp>tail_len){
-            os_memcpy(pdata, pRxBuffer->pOutPos, tail_len);
-            pRxBuffer->pOutPos += tail_len;
-            pRxBuffer->pOutPos = (pRxBuffer->pUartBuff +  (pRxBuffer->pOutPos- pRxBuffer->pUartBuff) % pRxBuffer->UartBuffSize );
-            pRxBuffer->Space += tail_len;
-            
-            os_memcpy(pdata+tail_len , pRxBuffer->pOutPos, len_tmp-tail_len);
-            pRxBuffer->pOutPos+= ( len_tmp-tail_len );
-            pRxBuffer->pOutPos= (pRxBuffer->pUartBuff +  (pRxBuffer->pOutPos- pRxBuffer->pUartBuff) % pRxBuffer->UartBuffSize );
-            pRxBuffer->Space +=( len_tmp-tail_len);                
-        }else{
-            //os_printf("case 3 in rx deq\n\r");
-            os_memcpy(pdata, pRxBuffer->pOutPos, len_tmp);
-            pRxBuffer->pOutPos += len_tmp;
-            pRxBuffer->pOutPos = (pRxBuffer->pUartBuff +  (pRxBuffer->pOutPos- pRxBuffer->pUartBuff) % pRxBuffer->UartBuffSize );
-            pRxBuffer->Space += len_tmp;
-        }
-    }
-    if(pRxBuffer->Space >= UART_FIFO_LEN){
-        uart_rx_intr_enable(UART0);
+    uint8 *p;
+    uint16 len, total = 0;
+
+    while ((len = spsc_ring_peek(&rx_ring, &p, UART_RX_BUFFER_SIZE)) > 0) {
+        fn(p, len);
+        spsc_ring_consume(&rx_ring, len);
+        total += len;
     }
-    return len_tmp; 
+    rx_unthrottle();
+    return total;
 }
 
-//move data from uart fifo to some buffer via the callback uart0_unload_fn()
+
+//move data from the uart fifo straight into the rx ring, or, if set, byte by
+//byte to the callback uart0_unload_fn()
 void external_unload()
 {
     uint8 fifo_len;
     uint8 fifo_data;
+    uint16 room, i;
+    uint8 *p;
 
     fifo_len = (READ_PERI_REG(UART_STATUS(UART0))>>UART_RXFIFO_CNT_S)&UART_RXFIFO_CNT;
-    while (fifo_len-- > 0) {
-      fifo_data = READ_PERI_REG(UART_FIFO(UART0)) & 0xFF;
-      if (uart0_unload_fn != NULL) uart0_unload_fn(fifo_data);
+
+    if (uart0_unload_fn != NULL) {
+      while (fifo_len-- > 0) {
+        fifo_data = READ_PERI_REG(UART_FIFO(UART0)) & 0xFF;
+        uart0_unload_fn(fifo_data);
+      }
+    } else {
+      // drain until the FIFO is empty (new bytes may arrive meanwhile at high bitrates)
+      while (fifo_len > 0) {
+        room = spsc_ring_reserve(&rx_ring, &p, fifo_len);
+        if (room == 0) {
+          // ring full: leave the rest in the FIFO until the task has caught up
+          rx_throttled = true;
+          uart_stats.rx_throttled++;
+          CLEAR_PERI_REG_MASK(UART_INT_ENA(UART0), UART_RXFIFO_FULL_INT_ENA | UART_RXFIFO_TOUT_INT_ENA);
+          break;
+        }
+        for (i = 0; i < room; i++) {
+          p[i] = READ_PERI_REG(UART_FIFO(UART0)) & 0xFF;
+        }
+        spsc_ring_commit(&rx_ring, room);
+        fifo_len -= room;
+        if (fifo_len == 0)
+          fifo_len = (READ_PERI_REG(UART_STATUS(UART0))>>UART_RXFIFO_CNT_S)&UART_RXFIFO_CNT;
+      }
     }
 
     uart_rx_intr_enable(UART0);
@@ -433,74 +403,36 @@ void external_unload()
 }
 
 
-//move data from uart fifo to rx buffer
-void Uart_rx_buff_enq()
-{
-    uint8 fifo_len,buf_idx;
-    uint8 fifo_data;
-
-    fifo_len = (READ_PERI_REG(UART_STATUS(UART0))>>UART_RXFIFO_CNT_S)&UART_RXFIFO_CNT;
-    if(fifo_len >= pRxBuffer->Space){
-        os_printf("buf full!!!\n\r");            
-    }else{
-        buf_idx=0;
-        while(buf_idx < fifo_len){
-            buf_idx++;
-            fifo_data = READ_PERI_REG(UART_FIFO(UART0)) & 0xFF;
-            *(pRxBuffer->pInPos++) = fifo_data;
-            if(pRxBuffer->pInPos == (pRxBuffer->pUartBuff + pRxBuffer->UartBuffSize)){
-                pRxBuffer->pInPos = pRxBuffer->pUartBuff;
-            }            
-        }
-        pRxBuffer->Space -= fifo_len ;
-        if(pRxBuffer->Space >= UART_FIFO_LEN){
-            //os_printf("after rx enq buf enough\n\r");
-            uart_rx_intr_enable(UART0);
-        }
-    }
-}
-
-
 //fill the uart tx buffer
 void ICACHE_FLASH_ATTR
 tx_buff_enq(char* pdata, uint16 data_len )
 {
-    CLEAR_PERI_REG_MASK(UART_INT_ENA(UART0), UART_TXFIFO_EMPTY_INT_ENA);
-
-    if(pTxBuffer == NULL){
+    if(tx_ring.buf == NULL){
         DBG1("\n\rnull, create buffer struct\n\r");
-        pTxBuffer = Uart_Buf_Init(UART_TX_BUFFER_SIZE);
-        if(pTxBuffer!= NULL){
-            Uart_Buf_Cpy(pTxBuffer ,  pdata,  data_len );
-        }else{
+        if (!spsc_ring_init(&tx_ring, UART_TX_BUFFER_SIZE)) {
             DBG1("uart tx MALLOC no buf \n\r");
+            return;
         }
+    }
+
+    if(data_len <= spsc_ring_room(&tx_ring)){
+        spsc_ring_write(&tx_ring, pdata, data_len);
     }else{
-        if(data_len <= pTxBuffer->Space){
-        Uart_Buf_Cpy(pTxBuffer ,  pdata,  data_len);
-        }else{
-            DBG1("UART TX BUF FULL!!!!\n\r");
-        }
+        uart_stats.tx_drops++;
+        DBG1("UART TX BUF FULL!!!!\n\r");
     }
 
-    SET_PERI_REG_MASK(UART_CONF1(UART0), (UART_TX_EMPTY_THRESH_VAL & UART_TXFIFO_EMPTY_THRHD)<<UART_TXFIFO_EMPTY_THRHD_S);
-    SET_PERI_REG_MASK(UART_INT_ENA(UART0), UART_TXFIFO_EMPTY_INT_ENA);
+    uart0_tx_start();
 }
 
 
-
-//--------------------------------
-LOCAL void tx_fifo_insert(struct UartBuffer* pTxBuff, uint8 data_len,  uint8 uart_no)
+//(re)start sending: the tx empty interrupt fetches the data from the tx buffer
+//and then from uart0_tx_fill_fn()
+void ICACHE_FLASH_ATTR
+uart0_tx_start(void)
 {
-    uint8 i;
-    for(i = 0; i<data_len;i++){
-        WRITE_PERI_REG(UART_FIFO(uart_no) , *(pTxBuff->pOutPos++));
-        if(pTxBuff->pOutPos == (pTxBuff->pUartBuff + pTxBuff->UartBuffSize)){
-            pTxBuff->pOutPos = pTxBuff->pUartBuff;
-        }
-    }
-    pTxBuff->pOutPos = (pTxBuff->pUartBuff +  (pTxBuff->pOutPos - pTxBuff->pUartBuff) % pTxBuff->UartBuffSize );
-    pTxBuff->Space += data_len;
+    SET_PERI_REG_MASK(UART_CONF1(UART0), (UART_TX_EMPTY_THRESH_VAL & UART_TXFIFO_EMPTY_THRHD)<<UART_TXFIFO_EMPTY_THRHD_S);
+    SET_PERI_REG_MASK(UART_INT_ENA(UART0), UART_TXFIFO_EMPTY_INT_ENA);
 }
 
 
@@ -514,22 +446,26 @@ void tx_start_uart_buffer(uint8 uart_no)
 {
     uint8 tx_fifo_len = (READ_PERI_REG(UART_STATUS(uart_no))>>UART_TXFIFO_CNT_S)&UART_TXFIFO_CNT;
     uint8 fifo_remain = UART_FIFO_LEN - tx_fifo_len ;
-    uint8 len_tmp;
-    uint16 tail_ptx_len,head_ptx_len,data_len;
-    //struct UartBuffer* pTxBuff = *get_buff_prt();
-    
-    if(pTxBuffer){      
-        data_len = (pTxBuffer->UartBuffSize - pTxBuffer->Space);
-        if(data_len > fifo_remain){
-            len_tmp = fifo_remain;
-            tx_fifo_insert( pTxBuffer,len_tmp,uart_no);
+    uint16 len, i;
+    uint8 *p;
+
+    while(fifo_remain > 0 && (len = spsc_ring_peek(&tx_ring, &p, fifo_remain)) > 0){
+        for(i = 0; i < len; i++){
+            WRITE_PERI_REG(UART_FIFO(uart_no), p[i]);
+        }
+        spsc_ring_consume(&tx_ring, len);
+        fifo_remain -= len;
+    }
+    if(spsc_ring_used(&tx_ring) > 0){
+        SET_PERI_REG_MASK(UART_INT_ENA(UART0), UART_TXFIFO_EMPTY_INT_ENA);
+        return;
+    }
+
+    //fill the rest of the fifo directly from the data source of the callback
+    if(uart0_tx_fill_fn != NULL && fifo_remain > 0){
+        if(uart0_tx_fill_fn(fifo_remain) == fifo_remain){
             SET_PERI_REG_MASK(UART_INT_ENA(UART0), UART_TXFIFO_EMPTY_INT_ENA);
-        }else{
-            len_tmp = data_len;
-            tx_fifo_insert( pTxBuffer,len_tmp,uart_no);
         }
-    }else{
-        DBG1("pTxBuff null \n\r");
     }
 }
 
@@ -602,12 +538,14 @@ UART_SetFlowCtrl(uint8 uart_no,UART_HwFlowCtrl flow_ctrl,uint8 rx_thresh)
         SET_PERI_REG_MASK(UART_CONF1(uart_no), UART_RX_FLOW_EN);
     }else{
         CLEAR_PERI_REG_MASK(UART_CONF1(uart_no), UART_RX_FLOW_EN);
+        PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTDO_U, FUNC_GPIO15);
     }
     if(flow_ctrl&USART_HardwareFlowControl_CTS){
         PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTCK_U, FUNC_UART0_CTS);
         SET_PERI_REG_MASK(UART_CONF0(uart_no), UART_TX_FLOW_EN);
     }else{
         CLEAR_PERI_REG_MASK(UART_CONF0(uart_no), UART_TX_FLOW_EN);
+        PIN_FUNC_SELECT(PERIPHS_IO_MUX_MTCK_U, FUNC_GPIO13);
     }
 }
 
@@ -634,11 +572,7 @@ UART_CheckOutputFinished(uint8 uart_no, uint32 time_out_us)
     uint32 tx_buff_len;
     while(1){
         tx_fifo_len =( (READ_PERI_REG(UART_STATUS(uart_no))>>UART_TXFIFO_CNT_S)&UART_TXFIFO_CNT);
-        if(pTxBuffer){
-            tx_buff_len = ((pTxBuffer->UartBuffSize)-(pTxBuffer->Space));
-        }else{
-            tx_buff_len = 0;
-        }
+        tx_buff_len = spsc_ring_used(&tx_ring);
 		
         if( tx_fifo_len==0 && tx_buff_len==0){
             return TRUE;
@@ -0,0 +1,178 @@
+/*
+ * Benchmark of the byte rings on the host: a producer moves chunks of 1..128
+ * bytes (a UART FIFO worth) into the ring byte by byte, as the RX interrupt
+ * does, a consumer takes chunks of 1..512 bytes out and checks them.
+ * - spsc_ring: reserve()/commit() and peek()/consume(), in place
+ * - ringbuf: ringbuf_memcpy_into()/ringbuf_memcpy_from() via staging buffers
+ * - UartBuffer: the ring driver/uart.c used before spsc_ring (pointer
+ *   compares on every byte, modulo on dequeue), kept here for comparison
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c_types.h"
+#include "osapi.h"
+#include "host_sdk.h"
+
+#include "ringbuf.h"
+#include "spsc_ring.h"
+
+#define RING_SIZE	2048
+#define SRC_SIZE	(1 << 20)
+#define TOTAL_BYTES	(64u << 20)
+
+static uint8_t src[SRC_SIZE];
+static uint8_t stage[512];
+
+struct legacy_buf {
+    uint32_t	size;
+    uint8_t	*buf;
+    uint8_t	*in;
+    uint8_t	*out;
+    uint16_t	space;
+};
+
+static void legacy_enq(struct legacy_buf *b, const uint8_t *data, uint16_t len)
+{
+    uint16_t i;
+
+    for (i = 0; i < len; i++) {
+	*(b->in++) = data[i];
+	if (b->in == b->buf + b->size)
+	    b->in = b->buf;
+    }
+    b->space -= len;
+}
+
+static uint16_t legacy_deq(struct legacy_buf *b, uint8_t *data, uint16_t len)
+{
+    uint16_t used = b->size - b->space;
+    uint16_t tail_len = b->buf + b->size - b->out;
+
+    if (len > used)
+	len = used;
+    if (b->out <= b->in || len <= tail_len) {
+	memcpy(data, b->out, len);
+	b->out = b->buf + (b->out + len - b->buf) % b->size;
+    } else {
+	memcpy(data, b->out, tail_len);
+	memcpy(data + tail_len, b->buf, len - tail_len);
+	b->out = b->buf + (len - tail_len) % b->size;
+    }
+    b->space += len;
+    return len;
+}
+
+enum ring_kind { RING_SPSC, RING_RINGBUF, RING_LEGACY };
+
+static const char *ring_names[] = { "spsc_ring", "ringbuf", "UartBuffer" };
+
+// Returns ns per byte, *ok is cleared if the data got mixed up
+static double run(enum ring_kind kind, bool *ok)
+{
+    struct spsc_ring sr;
+    ringbuf_t rb = NULL;
+    struct legacy_buf lb;
+    uint32_t in = 0, out = 0;
+    uint16_t n, i, want, room;
+    uint8_t *p;
+    uint64_t t;
+
+    spsc_ring_init(&sr, RING_SIZE);
+    rb = ringbuf_new(RING_SIZE);
+    lb.size = lb.space = RING_SIZE;
+    lb.buf = lb.in = lb.out = malloc(RING_SIZE);
+
+    srand(2);
+    *ok = true;
+    t = host_time_ns();
+    while (out < TOTAL_BYTES) {
+	// producer
+	want = 1 + rand() % 128;
+	switch (kind) {
+	case RING_SPSC:
+	    while (want > 0 && (room = spsc_ring_reserve(&sr, &p, want)) > 0) {
+		for (i = 0; i < room; i++)
+		    p[i] = src[(in + i) % SRC_SIZE];
+		spsc_ring_commit(&sr, room);
+		in += room;
+		want -= room;
+	    }
+	    break;
+	case RING_RINGBUF:
+	    if (want > ringbuf_bytes_free(rb))
+		want = ringbuf_bytes_free(rb);
+	    for (i = 0; i < want; i++)
+		stage[i] = src[(in + i) % SRC_SIZE];
+	    ringbuf_memcpy_into(rb, stage, want);
+	    in += want;
+	    break;
+	case RING_LEGACY:
+	    if (want > lb.space)
+		want = lb.space;
+	    for (i = 0; i < want; i++)
+		stage[i] = src[(in + i) % SRC_SIZE];
+	    legacy_enq(&lb, stage, want);
+	    in += want;
+	    break;
+	}
+
+	// consumer, a bit slower on average, so the ring runs full at times
+	want = 1 + rand() % 250;
+	switch (kind) {
+	case RING_SPSC:
+	    while (want > 0 && (n = spsc_ring_peek(&sr, &p, want)) > 0) {
+		for (i = 0; i < n; i++)
+		    if (p[i] != src[(out + i) % SRC_SIZE])
+			*ok = false;
+		spsc_ring_consume(&sr, n);
+		out += n;
+		want -= n;
+	    }
+	    break;
+	case RING_RINGBUF:
+	    if (want > ringbuf_bytes_used(rb))
+		want = ringbuf_bytes_used(rb);
+	    ringbuf_memcpy_from(stage, rb, want);
+	    for (i = 0; i < want; i++)
+		if (stage[i] != src[(out + i) % SRC_SIZE])
+		    *ok = false;
+	    out += want;
+	    break;
+	case RING_LEGACY:
+	    n = legacy_deq(&lb, stage, want);
+	    for (i = 0; i < n; i++)
+		if (stage[i] != src[(out + i) % SRC_SIZE])
+		    *ok = false;
+	    out += n;
+	    break;
+	}
+    }
+    t = host_time_ns() - t;
+
+    spsc_ring_free(&sr);
+    ringbuf_free(&rb);
+    free(lb.buf);
+    return (double)t / out;
+}
+
+int main(int argc, char **argv)
+{
+    enum ring_kind k;
+    bool ok, failed = false;
+    double ns;
+    uint32_t i;
+
+    for (i = 0; i < SRC_SIZE; i++)
+	src[i] = rand();
+
+    printf("%u bytes through a %d byte ring\n", TOTAL_BYTES, RING_SIZE);
+    for (k = RING_SPSC; k <= RING_LEGACY; k++) {
+	ns = run(k, &ok);
+	failed |= !ok;
+	printf("%-22s %s  %6.2f ns/byte  %8.1f MB/s\n", ring_names[k], ok ? "ok  " : "FAIL",
+	       ns, 1000.0 / ns);
+    }
+    return failed ? 1 : 0;
+}
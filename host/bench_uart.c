@@ -0,0 +1,244 @@
+/*
+ * Benchmark of the UART driver hot paths on the host, against the simulated
+ * registers of the stub SDK:
+ * - RX: SLIP frames arriving on the wire are taken out of the FIFO by
+ *   external_unload(), into the rx ring (emptied with uart0_rx_unload() as
+ *   the task does, with random delays) and with the per byte callback
+ * - TX: SLIP frames are moved into the FIFO by tx_start_uart_buffer(), from
+ *   the tx buffer (tx_buff_enq()) and from uart0_tx_fill_fn
+ * Reports the throughput of the interrupt handler, the time spent in it
+ * and the number of register accesses per byte. Host timings are only good
+ * for comparisons, the register accesses are what costs on the ESP.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ets_sys.h"
+#include "osapi.h"
+#include "driver/uart.h"
+
+#define SLIP_END	0xC0
+#define SLIP_ESC	0xDB
+#define SLIP_ESC_END	0xDC
+#define SLIP_ESC_ESC	0xDD
+
+#define WIRE_SIZE	(4 * 1024 * 1024)
+
+struct bench_result {
+    uint64_t	bytes;
+    uint64_t	isr_ns;
+    uint64_t	regs;
+};
+
+static uint8_t *wire, *wire_out;
+static uint32_t wire_len, wire_frames;
+
+// SLIP decoder in place of slipif
+static uint32_t rx_frames, rx_len;
+static bool rx_esc;
+
+// Source of the TX fill callback
+static uint32_t fill_pos;
+
+static void slip_decode(uint8 c)
+{
+    if (c == SLIP_END) {
+	if (rx_len > 0)
+	    rx_frames++;
+	rx_len = 0;
+	return;
+    }
+    if (rx_esc) {
+	rx_esc = false;
+	rx_len++;
+	return;
+    }
+    if (c == SLIP_ESC)
+	rx_esc = true;
+    else
+	rx_len++;
+}
+
+static void unload_bulk(uint8 *buf, uint16 len)
+{
+    uint16 i;
+
+    for (i = 0; i < len; i++)
+	slip_decode(buf[i]);
+}
+
+static void unload_byte(char c)
+{
+    slip_decode(c);
+}
+
+static uint8 tx_fill(uint8 room)
+{
+    uint8 n = 0;
+
+    while (n < room && fill_pos < wire_len) {
+	UART0_TX_FIFO_PUT(wire[fill_pos++]);
+	n++;
+    }
+    return n;
+}
+
+// Random frames of 40..1500 bytes, SLIP encoded
+static void make_wire(void)
+{
+    uint32_t len, i;
+    uint8_t c;
+
+    wire = malloc(WIRE_SIZE);
+    wire_out = malloc(WIRE_SIZE);
+    srand(1);
+    wire_len = wire_frames = 0;
+    while (wire_len + 2 * 1500 + 2 < WIRE_SIZE) {
+	len = 40 + rand() % 1461;
+	wire[wire_len++] = SLIP_END;
+	for (i = 0; i < len; i++) {
+	    c = rand();
+	    if (c == SLIP_END) {
+		wire[wire_len++] = SLIP_ESC;
+		wire[wire_len++] = SLIP_ESC_END;
+	    } else if (c == SLIP_ESC) {
+		wire[wire_len++] = SLIP_ESC;
+		wire[wire_len++] = SLIP_ESC_ESC;
+	    } else {
+		wire[wire_len++] = c;
+	    }
+	}
+	wire[wire_len++] = SLIP_END;
+	wire_frames++;
+    }
+}
+
+static uint64_t timed_irq(void)
+{
+    uint64_t t = host_time_ns();
+
+    host_uart_irq();
+    return host_time_ns() - t;
+}
+
+static void bench_rx(struct bench_result *r, bool ring)
+{
+    uint32_t pos = 0, len;
+    uint64_t regs = host_reg_accesses;
+
+    rx_frames = rx_len = 0;
+    rx_esc = false;
+    memset(r, 0, sizeof(*r));
+
+    while (pos < wire_len) {
+	// the wire delivers 1..128 bytes until the interrupt is served
+	len = 1 + rand() % UART_FIFO_LEN;
+	if (len > wire_len - pos)
+	    len = wire_len - pos;
+	pos += host_uart_rx_push(wire + pos, len);
+	if (rand() % 4 == 0)
+	    host_uart_rx_idle();
+	r->isr_ns += timed_irq();
+	host_run_tasks();
+	// the task is sometimes late, the ring fills up and the RX interrupt is throttled
+	if (ring && rand() % 8 != 0)
+	    uart0_rx_unload(unload_bulk);
+    }
+    do {
+	host_uart_rx_idle();
+	r->isr_ns += timed_irq();
+    } while (ring && uart0_rx_unload(unload_bulk) > 0);
+
+    r->bytes = wire_len;
+    r->regs = host_reg_accesses - regs;
+}
+
+static void bench_tx_buff(struct bench_result *r)
+{
+    uint32_t pos = 0, out = 0, enq = 0, len;
+    uint64_t regs = host_reg_accesses;
+
+    memset(r, 0, sizeof(*r));
+
+    while (out < wire_len) {
+	// queue whole frames while they fit into the tx buffer
+	while (pos < wire_len) {
+	    for (len = 1; pos + len < wire_len && wire[pos + len] != SLIP_END; len++)
+		;
+	    len++;
+	    if (enq - out - host_uart_tx_fifo_cnt() + len > UART_TX_BUFFER_SIZE)
+		break;
+	    tx_buff_enq((char *)wire + pos, len);
+	    pos += len;
+	    enq += len;
+	}
+	out += host_uart_tx_pop(wire_out + out, 1 + rand() % UART_FIFO_LEN);
+	r->isr_ns += timed_irq();
+    }
+
+    r->bytes = out;
+    r->regs = host_reg_accesses - regs;
+}
+
+static void bench_tx_fill(struct bench_result *r)
+{
+    uint32_t out = 0;
+    uint64_t regs = host_reg_accesses;
+
+    memset(r, 0, sizeof(*r));
+    fill_pos = 0;
+    uart0_tx_fill_fn = tx_fill;
+
+    while (out < wire_len) {
+	if (fill_pos < wire_len)
+	    uart0_tx_start();
+	out += host_uart_tx_pop(wire_out + out, 1 + rand() % UART_FIFO_LEN);
+	r->isr_ns += timed_irq();
+    }
+    uart0_tx_fill_fn = NULL;
+
+    r->bytes = out;
+    r->regs = host_reg_accesses - regs;
+}
+
+static void report(const char *name, struct bench_result *r, bool ok)
+{
+    printf("%-22s %9llu bytes  %s  %6.2f ns/byte  %8.1f MB/s  %5.2f reg accesses/byte\n",
+	   name, (unsigned long long)r->bytes, ok ? "ok  " : "FAIL",
+	   (double)r->isr_ns / r->bytes, r->bytes * 1000.0 / r->isr_ns, (double)r->regs / r->bytes);
+}
+
+int main(int argc, char **argv)
+{
+    struct bench_result r;
+    bool failed = false, ok;
+
+    make_wire();
+    uart_init(BIT_RATE_115200);
+    printf("%u SLIP frames, %u bytes on the wire\n", wire_frames, wire_len);
+
+    bench_rx(&r, true);
+    ok = rx_frames == wire_frames;
+    failed |= !ok;
+    report("RX rx ring", &r, ok);
+
+    uart0_unload_fn = unload_byte;
+    bench_rx(&r, false);
+    uart0_unload_fn = NULL;
+    ok = rx_frames == wire_frames;
+    failed |= !ok;
+    report("RX external_unload byte", &r, ok);
+
+    bench_tx_buff(&r);
+    ok = r.bytes == wire_len && memcmp(wire, wire_out, wire_len) == 0;
+    failed |= !ok;
+    report("TX tx_buff_enq", &r, ok);
+
+    bench_tx_fill(&r);
+    ok = r.bytes == wire_len && memcmp(wire, wire_out, wire_len) == 0;
+    failed |= !ok;
+    report("TX uart0_tx_fill_fn", &r, ok);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * Host replacement of esp-open-lwip's arch/cc.h
+ */
+#ifndef __ARCH_CC_H__
+#define __ARCH_CC_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "c_types.h"
+
+#define EFAULT 14
+
+#define LWIP_PROVIDE_ERRNO
+
+#ifndef BYTE_ORDER
+#define BYTE_ORDER LITTLE_ENDIAN
+#endif
+
+typedef unsigned char	u8_t;
+typedef signed char	s8_t;
+typedef unsigned short	u16_t;
+typedef signed short	s16_t;
+typedef unsigned int	u32_t;
+typedef signed int	s32_t;
+typedef char *		mem_ptr_t;
+
+#define S16_F "d"
+#define U16_F "d"
+#define X16_F "x"
+#define S32_F "d"
+#define U32_F "d"
+#define X32_F "x"
+
+#define PACK_STRUCT_FIELD(x) x
+#define PACK_STRUCT_STRUCT __attribute__((packed))
+#define PACK_STRUCT_BEGIN
+#define PACK_STRUCT_END
+
+#define LWIP_PLATFORM_DIAG(x)	do { printf x; } while (0)
+#define LWIP_PLATFORM_ASSERT(x)	do { printf("Assertion \"%s\" failed at line %d in %s\n", x, __LINE__, __FILE__); abort(); } while (0)
+
+#define LWIP_PLATFORM_BYTESWAP	0
+
+#endif
@@ -0,0 +1,10 @@
+/*
+ * Host replacement of esp-open-lwip's arch/perf.h
+ */
+#ifndef __ARCH_PERF_H__
+#define __ARCH_PERF_H__
+
+#define PERF_START
+#define PERF_STOP(x)
+
+#endif
@@ -0,0 +1,59 @@
+/*
+ * Host stub of the SDK's c_types.h
+ */
+#ifndef _C_TYPES_H_
+#define _C_TYPES_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t		uint8;
+typedef uint8_t		u8;
+typedef int8_t		sint8;
+typedef int8_t		int8;
+typedef int8_t		s8;
+typedef uint16_t	uint16;
+typedef uint16_t	u16;
+typedef int16_t		sint16;
+typedef int16_t		s16;
+typedef uint32_t	uint32;
+typedef uint32_t	u_int;
+typedef uint32_t	u32;
+typedef int32_t		sint32;
+typedef int32_t		s32;
+typedef int32_t		int32;
+typedef int64_t		sint64;
+typedef uint64_t	uint64;
+typedef uint64_t	u64;
+typedef float		real32;
+typedef double		real64;
+
+#define __le16		u16
+
+typedef enum {
+    OK = 0,
+    FAIL,
+    PENDING,
+    BUSY,
+    CANCEL,
+} STATUS;
+
+#define BIT(nr)			(1UL << (nr))
+
+#define REG_SET_BIT(_r, _b)	WRITE_PERI_REG((_r), READ_PERI_REG(_r) | (_b))
+#define REG_CLR_BIT(_r, _b)	WRITE_PERI_REG((_r), READ_PERI_REG(_r) & ~(_b))
+
+#define DMEM_ATTR
+#define SHMEM_ATTR
+#define ICACHE_FLASH_ATTR
+#define ICACHE_RODATA_ATTR
+#define STORE_ATTR
+#define LOCAL			static
+
+#ifndef __cplusplus
+#define TRUE			true
+#define FALSE			false
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Host stub of the SDK's eagle_soc.h: peripheral registers are accessed
+ * through the simulated register file in host_sdk.c
+ */
+#ifndef _EAGLE_SOC_H_
+#define _EAGLE_SOC_H_
+
+#include "c_types.h"
+#include "host_sdk.h"
+
+#define ETS_UNCACHED_ADDR(addr)		(addr)
+
+#define READ_PERI_REG(addr)		host_reg_read((uint32)(addr))
+#define WRITE_PERI_REG(addr, val)	host_reg_write((uint32)(addr), (uint32)(val))
+#define CLEAR_PERI_REG_MASK(reg, mask)	WRITE_PERI_REG((reg), (READ_PERI_REG(reg) & (~(mask))))
+#define SET_PERI_REG_MASK(reg, mask)	WRITE_PERI_REG((reg), (READ_PERI_REG(reg) | (mask)))
+#define GET_PERI_REG_BITS(reg, hipos, lowpos)	((READ_PERI_REG(reg) >> (lowpos)) & ((1 << ((hipos) - (lowpos) + 1)) - 1))
+#define SET_PERI_REG_BITS(reg, bit_map, value, shift)	\
+	(WRITE_PERI_REG((reg), (READ_PERI_REG(reg) & (~((bit_map) << (shift)))) | (((value) & (bit_map)) << (shift))))
+
+#define UART_CLK_FREQ			(80 * 1000000)
+
+#define PERIPHS_IO_MUX			0x60000800
+#define PERIPHS_IO_MUX_MTDI_U		(PERIPHS_IO_MUX + 0x04)
+#define PERIPHS_IO_MUX_MTCK_U		(PERIPHS_IO_MUX + 0x08)
+#define PERIPHS_IO_MUX_MTMS_U		(PERIPHS_IO_MUX + 0x0C)
+#define PERIPHS_IO_MUX_MTDO_U		(PERIPHS_IO_MUX + 0x10)
+#define PERIPHS_IO_MUX_U0RXD_U		(PERIPHS_IO_MUX + 0x14)
+#define PERIPHS_IO_MUX_U0TXD_U		(PERIPHS_IO_MUX + 0x18)
+#define PERIPHS_IO_MUX_GPIO0_U		(PERIPHS_IO_MUX + 0x34)
+#define PERIPHS_IO_MUX_GPIO2_U		(PERIPHS_IO_MUX + 0x38)
+
+#define PERIPHS_IO_MUX_FUNC		0x13
+#define PERIPHS_IO_MUX_FUNC_S		4
+#define PERIPHS_IO_MUX_PULLUP		BIT7
+
+#define FUNC_U0TXD			0
+#define FUNC_U0RTS			4
+#define FUNC_U0CTS			4
+#define FUNC_UART0_CTS			4
+#define FUNC_U1TXD_BK			2
+#define FUNC_GPIO0			0
+#define FUNC_GPIO2			0
+#define FUNC_GPIO13			3
+#define FUNC_GPIO15			3
+
+#define BIT7				0x00000080
+
+#define PIN_PULLUP_DIS(PIN_NAME)	CLEAR_PERI_REG_MASK(PIN_NAME, PERIPHS_IO_MUX_PULLUP)
+#define PIN_PULLUP_EN(PIN_NAME)		SET_PERI_REG_MASK(PIN_NAME, PERIPHS_IO_MUX_PULLUP)
+#define PIN_FUNC_SELECT(PIN_NAME, FUNC)	\
+	SET_PERI_REG_BITS(PIN_NAME, PERIPHS_IO_MUX_FUNC, (FUNC), PERIPHS_IO_MUX_FUNC_S)
+
+#endif
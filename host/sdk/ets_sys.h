@@ -0,0 +1,35 @@
+/*
+ * Host stub of the SDK's ets_sys.h
+ */
+#ifndef _ETS_SYS_H_
+#define _ETS_SYS_H_
+
+#include "c_types.h"
+#include "eagle_soc.h"
+#include "host_sdk.h"
+
+typedef uint32_t ETSSignal;
+typedef uintptr_t ETSParam;
+
+typedef struct ETSEventTag ETSEvent;
+
+struct ETSEventTag {
+    ETSSignal sig;
+    ETSParam  par;
+};
+
+typedef void (*ETSTask)(ETSEvent *e);
+typedef void (*int_handler_t)(void *);
+
+#define ETS_UART_INUM			5
+
+#define ETS_UART_INTR_ATTACH(func, arg)	host_uart_intr_attach((int_handler_t)(func), (void *)(arg))
+#define ETS_UART_INTR_ENABLE()		host_uart_intr_enable(true)
+#define ETS_UART_INTR_DISABLE()		host_uart_intr_enable(false)
+#define ETS_INTR_LOCK()
+#define ETS_INTR_UNLOCK()
+
+// ROM functions
+void uart_div_modify(uint8 uart_no, uint32 DivLatchValue);
+
+#endif
@@ -0,0 +1,13 @@
+/*
+ * Host stub of the SDK's gpio.h
+ */
+#ifndef _GPIO_H_
+#define _GPIO_H_
+
+#include "c_types.h"
+
+#define GPIO_OUTPUT_SET(gpio_no, bit_value)
+#define GPIO_DIS_OUTPUT(gpio_no)
+#define GPIO_INPUT_GET(gpio_no)		0
+
+#endif
@@ -0,0 +1,259 @@
+/*
+ * Host stub SDK: simulated peripheral registers, ROM and system functions
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ets_sys.h"
+#include "osapi.h"
+#include "user_interface.h"
+#include "driver/uart.h"
+
+#define REG_BASE		0x60000000
+#define REG_FILE_SIZE		0x1000
+
+#define HOST_UART_FIFO_LEN	128
+#define HOST_EVENTS		64
+#define HOST_TASKS		3
+
+// ROM data
+UartDevice UartDev;
+
+uint64_t host_reg_accesses;
+uint32_t host_posted_events;
+
+static uint32_t reg_file[REG_FILE_SIZE / 4];
+
+static uint8_t rx_fifo[HOST_UART_FIFO_LEN], tx_fifo[HOST_UART_FIFO_LEN];
+static uint16_t rx_head, rx_cnt, tx_head, tx_cnt;
+static uint32_t int_latched;	// interrupt bits set until cleared via UART_INT_CLR
+
+static void (*uart_handler)(void *);
+static void *uart_handler_arg;
+static bool uart_intr_enabled;
+
+static struct {
+    os_task_t	task;
+    os_event_t	*queue;
+    uint8	qlen;
+} tasks[HOST_TASKS];
+static os_event_t events[HOST_EVENTS];
+static uint8 event_prio[HOST_EVENTS];
+static uint16_t ev_head, ev_cnt;
+
+static uint32_t *reg_ptr(uint32_t addr)
+{
+    if (addr < REG_BASE || addr >= REG_BASE + REG_FILE_SIZE)
+	return NULL;
+    return &reg_file[(addr - REG_BASE) / 4];
+}
+
+static uint32_t uart0_int_raw(void)
+{
+    uint32_t conf1 = reg_file[(UART_CONF1(UART0) - REG_BASE) / 4];
+    uint32_t raw = int_latched;
+
+    if (rx_cnt > 0 && rx_cnt >= ((conf1 >> UART_RXFIFO_FULL_THRHD_S) & UART_RXFIFO_FULL_THRHD))
+	raw |= UART_RXFIFO_FULL_INT_ST;
+    if (tx_cnt < ((conf1 >> UART_TXFIFO_EMPTY_THRHD_S) & UART_TXFIFO_EMPTY_THRHD))
+	raw |= UART_TXFIFO_EMPTY_INT_ST;
+    return raw;
+}
+
+uint32_t host_reg_read(uint32_t addr)
+{
+    uint32_t *reg = reg_ptr(addr);
+    uint8_t c;
+
+    host_reg_accesses++;
+
+    if (addr == UART_FIFO(UART0)) {
+	if (rx_cnt == 0)
+	    return 0;
+	c = rx_fifo[rx_head];
+	rx_head = (rx_head + 1) % HOST_UART_FIFO_LEN;
+	rx_cnt--;
+	return c;
+    }
+    if (addr == UART_STATUS(UART0))
+	return ((uint32_t)tx_cnt << UART_TXFIFO_CNT_S) | ((uint32_t)rx_cnt << UART_RXFIFO_CNT_S);
+    if (addr == UART_INT_RAW(UART0))
+	return uart0_int_raw();
+    if (addr == UART_INT_ST(UART0))
+	return uart0_int_raw() & reg_file[(UART_INT_ENA(UART0) - REG_BASE) / 4];
+    // UART1 is only used for debug output, its FIFO is always empty
+    if (addr == UART_STATUS(UART1))
+	return 0;
+
+    return reg != NULL ? *reg : 0;
+}
+
+void host_reg_write(uint32_t addr, uint32_t val)
+{
+    uint32_t *reg = reg_ptr(addr);
+
+    host_reg_accesses++;
+
+    if (addr == UART_FIFO(UART0)) {
+	if (tx_cnt < HOST_UART_FIFO_LEN) {
+	    tx_fifo[(tx_head + tx_cnt) % HOST_UART_FIFO_LEN] = val;
+	    tx_cnt++;
+	}
+	return;
+    }
+    if (addr == UART_FIFO(UART1))
+	return;
+    if (addr == UART_INT_CLR(UART0)) {
+	int_latched &= ~val;
+	return;
+    }
+    if (addr == UART_CONF0(UART0)) {
+	if (val & UART_RXFIFO_RST)
+	    rx_cnt = 0;
+	if (val & UART_TXFIFO_RST)
+	    tx_cnt = 0;
+    }
+
+    if (reg != NULL)
+	*reg = val;
+}
+
+void host_uart_intr_attach(void (*handler)(void *), void *arg)
+{
+    uart_handler = handler;
+    uart_handler_arg = arg;
+}
+
+void host_uart_intr_enable(bool enable)
+{
+    uart_intr_enabled = enable;
+}
+
+uint16_t host_uart_rx_push(const uint8_t *buf, uint16_t len)
+{
+    uint16_t i;
+
+    for (i = 0; i < len; i++) {
+	if (rx_cnt == HOST_UART_FIFO_LEN) {
+	    int_latched |= UART_RXFIFO_OVF_INT_ST;
+	    break;
+	}
+	rx_fifo[(rx_head + rx_cnt) % HOST_UART_FIFO_LEN] = buf[i];
+	rx_cnt++;
+    }
+    return i;
+}
+
+uint16_t host_uart_tx_pop(uint8_t *buf, uint16_t len)
+{
+    uint16_t i;
+
+    for (i = 0; i < len && tx_cnt > 0; i++) {
+	if (buf != NULL)
+	    buf[i] = tx_fifo[tx_head];
+	tx_head = (tx_head + 1) % HOST_UART_FIFO_LEN;
+	tx_cnt--;
+    }
+    return i;
+}
+
+uint16_t host_uart_tx_fifo_cnt(void)
+{
+    return tx_cnt;
+}
+
+void host_uart_rx_idle(void)
+{
+    uint32_t conf1 = reg_file[(UART_CONF1(UART0) - REG_BASE) / 4];
+
+    if (rx_cnt > 0 && (conf1 & UART_RX_TOUT_EN))
+	int_latched |= UART_RXFIFO_TOUT_INT_ST;
+}
+
+int host_uart_irq(void)
+{
+    int calls = 0;
+
+    while (uart_handler != NULL && uart_intr_enabled && calls < 64 &&
+	   (uart0_int_raw() & reg_file[(UART_INT_ENA(UART0) - REG_BASE) / 4]) != 0) {
+	uart_handler(uart_handler_arg);
+	calls++;
+    }
+    return calls;
+}
+
+int host_run_tasks(void)
+{
+    int n = 0;
+    uint8 prio;
+    os_event_t e;
+
+    while (ev_cnt > 0) {
+	e = events[ev_head];
+	prio = event_prio[ev_head];
+	ev_head = (ev_head + 1) % HOST_EVENTS;
+	ev_cnt--;
+	if (tasks[prio].task != NULL)
+	    tasks[prio].task(&e);
+	n++;
+    }
+    return n;
+}
+
+uint64_t host_time_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+bool system_os_task(os_task_t task, uint8 prio, os_event_t *queue, uint8 qlen)
+{
+    if (prio >= HOST_TASKS)
+	return false;
+    tasks[prio].task = task;
+    tasks[prio].queue = queue;
+    tasks[prio].qlen = qlen;
+    return true;
+}
+
+bool system_os_post(uint8 prio, os_signal_t sig, os_param_t par)
+{
+    uint16_t i;
+
+    host_posted_events++;
+    if (prio >= HOST_TASKS || ev_cnt == HOST_EVENTS)
+	return false;
+    i = (ev_head + ev_cnt) % HOST_EVENTS;
+    events[i].sig = sig;
+    events[i].par = par;
+    event_prio[i] = prio;
+    ev_cnt++;
+    return true;
+}
+
+uint32 system_get_time(void)
+{
+    return (uint32)(host_time_ns() / 1000);
+}
+
+uint32 system_get_free_heap_size(void)
+{
+    return 40 * 1024;
+}
+
+void system_soft_wdt_feed(void)
+{
+}
+
+void os_install_putc1(void (*p)(char c))
+{
+}
+
+// ROM function
+void uart_div_modify(uint8 uart_no, uint32 div)
+{
+    host_reg_write(UART_CLKDIV(uart_no), div);
+}
@@ -0,0 +1,47 @@
+/*
+ * Simulation side of the host stub SDK: register file with a model of the
+ * UART0 FIFOs and interrupts, task queue and timing.
+ */
+#ifndef _HOST_SDK_H_
+#define _HOST_SDK_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Register file, backs READ_PERI_REG() and WRITE_PERI_REG()
+uint32_t host_reg_read(uint32_t addr);
+void host_reg_write(uint32_t addr, uint32_t val);
+
+// Number of register accesses so far
+extern uint64_t host_reg_accesses;
+
+// Interrupt controller
+void host_uart_intr_attach(void (*handler)(void *), void *arg);
+void host_uart_intr_enable(bool enable);
+
+/*
+ * UART0 line side: bytes received from the wire go into the RX FIFO,
+ * bytes written to the TX FIFO go out to the wire. Return the number of
+ * bytes moved. Pushing more than the FIFO holds raises the overflow interrupt.
+ */
+uint16_t host_uart_rx_push(const uint8_t *buf, uint16_t len);
+uint16_t host_uart_tx_pop(uint8_t *buf, uint16_t len);
+uint16_t host_uart_tx_fifo_cnt(void);
+
+// The RX line has been idle long enough to raise the RX timeout interrupt
+void host_uart_rx_idle(void);
+
+// Calls the UART interrupt handler while an enabled interrupt is pending,
+// returns the number of calls
+int host_uart_irq(void);
+
+// Runs the tasks for all events posted with system_os_post(), returns their number
+int host_run_tasks(void);
+
+// Number of events posted with system_os_post() so far
+extern uint32_t host_posted_events;
+
+// Monotonic time in ns
+uint64_t host_time_ns(void);
+
+#endif
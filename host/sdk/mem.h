@@ -0,0 +1,15 @@
+/*
+ * Host stub of the SDK's mem.h
+ */
+#ifndef _MEM_H_
+#define _MEM_H_
+
+#include <stdlib.h>
+
+#define os_malloc(s)		malloc(s)
+#define os_zalloc(s)		calloc(1, (s))
+#define os_calloc(n, s)		calloc((n), (s))
+#define os_realloc(p, s)	realloc((p), (s))
+#define os_free(p)		free(p)
+
+#endif
@@ -0,0 +1,24 @@
+/*
+ * Host stub of the SDK's os_type.h
+ */
+#ifndef _OS_TYPE_H_
+#define _OS_TYPE_H_
+
+#include "ets_sys.h"
+
+#define os_signal_t ETSSignal
+#define os_param_t  ETSParam
+#define os_event_t  ETSEvent
+#define os_task_t   ETSTask
+
+typedef void os_timer_func_t(void *timer_arg);
+
+typedef struct _os_timer_t {
+    struct _os_timer_t	*timer_next;
+    uint32_t		timer_expire;
+    uint32_t		timer_period;
+    os_timer_func_t	*timer_func;
+    void		*timer_arg;
+} os_timer_t;
+
+#endif
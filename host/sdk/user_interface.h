@@ -0,0 +1,16 @@
+/*
+ * Host stub of the SDK's user_interface.h
+ */
+#ifndef _USER_INTERFACE_H_
+#define _USER_INTERFACE_H_
+
+#include "c_types.h"
+#include "os_type.h"
+
+bool system_os_task(os_task_t task, uint8 prio, os_event_t *queue, uint8 qlen);
+bool system_os_post(uint8 prio, os_signal_t sig, os_param_t par);
+uint32 system_get_time(void);
+uint32 system_get_free_heap_size(void);
+void system_soft_wdt_feed(void);
+
+#endif
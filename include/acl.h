@@ -0,0 +1,55 @@
+#ifndef _ACL_H_
+#define _ACL_H_
+
+#include "c_types.h"
+#include "lwip/pbuf.h"
+
+/*
+ * Stateless ACL for the traffic towards the SLIP host, evaluated in the
+ * output function of the SLIP interface (after NAPT, so the destination
+ * port is the one on the host). A rule matches the IP protocol, a source
+ * prefix and, for TCP and UDP, a destination port range. The first
+ * matching rule decides, packets no rule matches are allowed.
+ * The rules are saved in blob 1.
+ */
+
+#define ACL_RULES_MAX	16
+
+enum acl_action { ACL_NONE, ACL_ALLOW, ACL_DROP };
+
+struct acl_rule {
+    uint32_t	src;		// source prefix, masked
+    uint32_t	mask;
+    uint16_t	port_lo;	// destination port range, 0-65535: any
+    uint16_t	port_hi;
+    uint8_t	proto;		// IP protocol, 0: any
+    uint8_t	action;		// enum acl_action, ACL_NONE: unused
+    uint8_t	pad[2];
+};
+
+// The rules in order, the used ones first, as saved in blob 1
+extern struct acl_rule acl_rules[ACL_RULES_MAX];
+
+// Packets that matched each rule
+extern uint32_t acl_hits[ACL_RULES_MAX];
+
+// Called after the rules have been loaded or changed
+void acl_init(void);
+
+// Appends a rule, false if the table is full
+bool acl_add(enum acl_action action, uint8_t proto, uint32_t src, uint8_t prefix_len,
+	     uint16_t port_lo, uint16_t port_hi);
+
+// Number of rules in use
+uint8_t acl_count(void);
+
+// Deletes rule n (from 1), the following ones move up
+bool acl_del(uint8_t n);
+
+// True if p is to be dropped
+bool acl_drop(struct pbuf *p);
+
+// Console stream function for the rules and their counters
+bool acl_show_line(uint16_t idx);
+
+#endif
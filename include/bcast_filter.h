@@ -0,0 +1,47 @@
+#ifndef _BCAST_FILTER_H_
+#define _BCAST_FILTER_H_
+
+#include "c_types.h"
+#include "lwip/pbuf.h"
+#include "lwip/netif.h"
+
+/*
+ * Filter for broadcast and multicast chatter from the WiFi side (SSDP, mDNS,
+ * NetBIOS...) in front of the SLIP output. A rule matches broadcasts
+ * (255.255.255.255 or the broadcast address of the SLIP subnet), multicasts
+ * or both, to a UDP port or of any kind, and lets through at most rate
+ * packets per second. The first matching rule applies, packets no rule
+ * matches and unicasts pass. The rules are part of the config.
+ */
+
+#define BCAST_RULES_MAX		8
+
+enum bcast_dst { BCAST_DST_NONE, BCAST_DST_BCAST, BCAST_DST_MCAST, BCAST_DST_ALL };
+
+struct bcast_rule {
+    uint8_t	dst;		// enum bcast_dst, BCAST_DST_NONE: unused
+    uint8_t	rate;		// packets per second let through, 0: drop all
+    uint16_t	port;		// UDP destination port, 0: any packet
+};
+
+struct bcast_rule_stats {
+    uint32_t	hits;		// packets that matched
+    uint32_t	drops;
+};
+
+extern struct bcast_rule_stats bcast_rule_stats[BCAST_RULES_MAX];
+
+// Rules for SSDP, mDNS, LLMNR and NetBIOS, all dropped
+void bcast_filter_default(struct bcast_rule *rules);
+
+// Filters with the BCAST_RULES_MAX rules (kept by the caller), the counters
+// start from 0. Called again after a change.
+void bcast_filter_init(struct bcast_rule *rules);
+
+// True if p, sent on netif, is to be dropped
+bool bcast_filter_drop(struct pbuf *p, struct netif *netif);
+
+// Console stream function for the rules and their counters
+bool bcast_filter_show_line(uint16_t idx);
+
+#endif
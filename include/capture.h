@@ -0,0 +1,54 @@
+#ifndef _CAPTURE_H_
+#define _CAPTURE_H_
+
+#include "c_types.h"
+#include "lwip/pbuf.h"
+
+/*
+ * Packet capture on the SLIP interface: the first snaplen bytes of each IP
+ * packet received from or sent to the serial line are copied with a
+ * microsecond timestamp into a RAM ring of CAPTURE_RING_SIZE bytes, the
+ * oldest records are overwritten. The ring is allocated by capture_start()
+ * and freed by capture_stop(), while stopped the hooks are a single test.
+ * capture_dump() opens CAPTURE_PORT, each connection to it gets the ring as
+ * a pcap file (Linux cooked capture, so the direction shows). Timestamps
+ * count from boot. Recording pauses while a dump is sent.
+ */
+
+#define CAPTURE_RING_SIZE	8192
+#define CAPTURE_SNAPLEN_MIN	20	// IP header
+#define CAPTURE_SNAPLEN_DEFAULT	96	// IP and TCP header with options
+#define CAPTURE_SNAPLEN_MAX	1400	// a record must fit into one TCP segment of the dump
+
+enum capture_dir { CAPTURE_IN, CAPTURE_OUT };
+
+struct capture_stats {
+    uint32_t	pkts;		// recorded since capture_start()
+    uint32_t	overwritten;	// records lost to newer ones
+    uint32_t	paused;		// packets missed while a dump was sent
+};
+
+extern struct capture_stats capture_stats;
+extern bool capture_running;
+
+void capture_record(struct pbuf *p, enum capture_dir dir);
+
+// Called at the input and output points of the SLIP interface
+static inline void capture_packet(struct pbuf *p, enum capture_dir dir)
+{
+    if (capture_running)
+	capture_record(p, dir);
+}
+
+// Allocates the ring and starts recording (restarts it with an empty ring,
+// if running), false if snaplen is invalid or out of memory
+bool capture_start(uint16_t snaplen);
+void capture_stop(void);
+
+// Listens on CAPTURE_PORT for dump connections until capture_stop()
+bool capture_dump(void);
+
+// Console stream function for the capture state and counters
+bool capture_show_line(uint16_t idx);
+
+#endif
@@ -8,11 +8,25 @@
 #include "gpio.h"
 #include "os_type.h"
 #include "spi_flash.h"
+#include "bcast_filter.h"
 
-#define FLASH_BLOCK_NO 0x68
+// Sectors of the config log (see config_flash.c)
+#define FLASH_LOG_START		0x68
+#define FLASH_LOG_SECTORS	4
 
 #define MAGIC_NUMBER    0x01200583
 
+// Last good STA connection, for a fast reconnect
+typedef struct
+{
+    uint8_t	bssid[6];	// AP the lease was obtained from
+    uint8_t	channel;	// its channel, 0: nothing cached
+    ip_addr_t	ip;		// DHCP lease
+    ip_addr_t	netmask;
+    ip_addr_t	gw;
+    ip_addr_t	dns;
+} sta_cache_t;
+
 typedef struct
 {
     // To check if the structure is initialized, matching or not in flash
@@ -41,12 +55,24 @@ typedef struct
 
     uint16_t	clock_speed;	// Freq of the CPU
     uint32_t    bit_rate;       // Bit rate of serial link
+    uint8_t     slip_mode;      // Plain SLIP or CSLIP (VJ header compression)
+    uint16_t    mss_clamp;      // Max TCP MSS in SYNs crossing the SLIP link, 0: no clamping
+    uint16_t    slip_mtu;       // MTU of the SLIP link, larger packets are dropped
+    uint8_t     flow_ctrl;      // HW flow control of the serial link (UART_HwFlowCtrl)
+    uint8_t     dns_cache;      // Entries of the DNS proxy's cache, 0: no DNS proxy
+    uint16_t    nat_size;       // Entries of the NAPT table, allocated at boot
+    uint8_t     portmap_size;   // Entries of the portmap table, saved in blob 0
+    struct bcast_rule bcast_rules[BCAST_RULES_MAX];	// Broadcast/multicast filter of the SLIP output
+
+    sta_cache_t sta_cache;      // Updated in the background, independent of "save"
 } sysconfig_t, *sysconfig_p;
 
 int config_load(sysconfig_p config);
 void config_load_default(sysconfig_p config);
 void config_save(sysconfig_p config);
 
+// Blobs 0 and 1, up to 1 KB each
+#define BLOB_MAX_LEN	1024
 void blob_save(uint8_t blob_no, uint32_t *data, uint16_t len);
 void blob_load(uint8_t blob_no, uint32_t *data, uint16_t len);
 void blob_zero(uint8_t blob_no, uint16_t len);
@@ -0,0 +1,76 @@
+#ifndef _CONSOLE_H_
+#define _CONSOLE_H_
+
+#include "c_types.h"
+
+struct espconn;
+
+/*
+ * Command console on a TCP connection. Commands are looked up in a table,
+ * their output goes through a ring that is flushed with the sent callback of
+ * the connection. Long outputs are produced line by line by a stream function
+ * whenever there is room in the ring, so they can have any size.
+ */
+
+// Size of the command line buffer
+#define CONSOLE_RX_SIZE		80
+
+// Max number of tokens of a command line
+#define CONSOLE_MAX_TOKENS	8
+
+// Max size of a chunk handed to espconn_sent()
+#define CONSOLE_SEND_CHUNK	256
+
+// Max length of the output of one stream function call
+#define CONSOLE_LINE_MAX	128
+
+// Handles a command, tokens[0] is the command name. A handler writes a few
+// lines with console_puts() and hands longer outputs over to console_stream().
+typedef void (*console_cmd_fn)(char **tokens, int nTokens);
+
+// Writes the next part (at most CONSOLE_LINE_MAX bytes) of a long output,
+// idx counts the calls. Returns false when the output is complete.
+typedef bool (*console_stream_fn)(uint16_t idx);
+
+struct console_cmd {
+    const char		*name;
+    console_cmd_fn	handler;
+    uint8_t		min_tokens;	// including the command name
+    uint8_t		flags;
+    const char		*usage;		// arguments for "help", NULL: not listed
+    const struct console_cmd *sub;	// subcommands (handler unused), e.g. "set ssid"
+    uint8_t		n_sub;
+};
+
+// Refused while the config is locked
+#define CONSOLE_CMD_LOCKED	0x01
+
+#define CONSOLE_CMD_COUNT(t)	(sizeof(t)/sizeof((t)[0]))
+
+extern char INVALID_LOCKED[], INVALID_NUMARGS[], INVALID_ARG[];
+
+void console_init(const struct console_cmd *cmds, uint8_t n_cmds, bool (*is_locked)(void));
+
+// Callbacks of the console server
+void console_connected_cb(void *arg);
+
+// Called in task context on SIG_CONSOLE_RX and SIG_CONSOLE_TX
+void console_handle_command(struct espconn *pespconn);
+void console_send(void);
+
+// Output of the current command
+void console_puts(const char *str);
+void console_stream(console_stream_fn fn);
+
+// For commands that complete in a callback (e.g. scan): the prompt is held
+// back until console_async_end(), which may be called from any callback
+void console_async_begin(void);
+void console_async_end(void);
+
+// Closes the connection once the output is sent
+void console_quit(void);
+
+// Handler of "help", lists the commands and their usage
+void console_cmd_help(char **tokens, int nTokens);
+
+#endif
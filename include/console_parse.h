@@ -0,0 +1,11 @@
+#ifndef _CONSOLE_PARSE_H_
+#define _CONSOLE_PARSE_H_
+
+/*
+ * Splits a console command line in place into at most max_tokens tokens.
+ * Whitespace separates tokens, "%xx" is a hex quoted char, "\" quotes the
+ * next char and backspace deletes the previous one. Returns the number of tokens.
+ */
+int parse_str_into_tokens(char *str, char **tokens, int max_tokens);
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef _DNS_CACHE_H_
+#define _DNS_CACHE_H_
+
+#include "c_types.h"
+#include "lwip/ip_addr.h"
+#include "lwip/netif.h"
+
+/*
+ * DNS proxy on port 53 of the ESP: queries are answered from a cache of
+ * recent responses as long as their TTL lasts, misses are forwarded to the
+ * upstream server with a new ID and the response is relayed back. Cached
+ * responses are served with the remaining TTL in all records.
+ * Only responses of at most DNS_CACHE_MAX_MSG bytes with answers are cached,
+ * others are just relayed.
+ */
+
+#define DNS_CACHE_MAX		64	// entries
+#define DNS_CACHE_DEFAULT	16
+#define DNS_CACHE_MAX_MSG	512	// bytes of a cached response
+#define DNS_CACHE_MAX_TTL	3600	// s, longer TTLs are cut down to this
+
+// Queries forwarded at a time and how long to wait for the answer
+#define DNS_FWD_MAX		8
+#define DNS_FWD_TIMEOUT_S	5
+
+struct dns_cache_stats {
+    uint32_t	queries;
+    uint32_t	hits;
+    uint32_t	forwarded;
+    uint32_t	timeouts;	// forwarded queries without response
+    uint32_t	dropped;	// malformed, no server known or too many pending
+};
+
+extern struct dns_cache_stats dns_cache_stats;
+
+// Starts the proxy with a cache of entries responses (restarts it with an
+// empty cache, if running). Only clients in the subnet of the netif only
+// are served, any client if NULL. entries 0 stops it.
+bool dns_cache_start(uint8_t entries, struct netif *only);
+void dns_cache_stop(void);
+
+// Upstream server queries are forwarded to
+void dns_cache_set_server(ip_addr_t *server);
+
+// Console stream function for the cache state and counters
+bool dns_cache_show_line(uint16_t idx);
+
+#endif
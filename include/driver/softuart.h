@@ -5,8 +5,15 @@
 
 #define SOFTUART_MAX_RX_BUFF 64 
 
+//edges recorded by the rx interrupt until the decoder runs (up to 10 per char),
+//power of two <= 128
+#define SOFTUART_MAX_EDGES 64
+
 #define SOFTUART_GPIO_COUNT 16
 
+//chars queued for the tx timer interrupt, power of two
+#define SOFTUART_MAX_TX_BUFF 512
+
 typedef struct softuart_pin_t {
 	uint8_t gpio_id;
 	uint32_t gpio_mux_name;
@@ -20,6 +27,27 @@ typedef struct softuart_buffer_t {
 	uint8_t buffer_overflow; 
 } softuart_buffer_t;
 
+//bit 31: line level after the edge, bits 0-30: system_get_time()
+#define SOFTUART_EDGE_LEVEL	0x80000000
+#define SOFTUART_TIME_MASK	0x7FFFFFFF
+
+typedef struct softuart_edges_t {
+	uint32_t edge[SOFTUART_MAX_EDGES];
+	uint8_t head;	//written by the interrupt handler only
+	uint8_t tail;	//written by the decoder only
+	uint8_t overflow;
+} softuart_edges_t;
+
+typedef struct softuart_tx_t {
+	uint8_t buffer[SOFTUART_MAX_TX_BUFF];
+	uint16_t head;	//written by Softuart_Putchar() only
+	uint16_t tail;	//written by the timer interrupt only
+	uint8_t bit;	//next bit to send, 0: start bit, 9: stop bit
+	uint8_t data;
+	uint8_t running;
+	uint32_t dropped;	//chars dropped, queue was full
+} softuart_tx_t;
+
 typedef struct {
 	softuart_pin_t pin_rx;
 	softuart_pin_t pin_tx;
@@ -29,15 +57,32 @@ typedef struct {
 	uint8_t is_rs485;
 	volatile softuart_buffer_t buffer;
 	uint16_t bit_time;
+	uint32_t tx_ticks;	//FRC1 ticks per bit
+	volatile softuart_tx_t tx;
+	volatile softuart_edges_t edges;
+	//decoder state
+	uint32_t rx_start;	//time of the start bit edge
+	uint8_t rx_level;	//line level since the last edge
+	uint8_t rx_busy;	//inside a frame
+	uint8_t rx_bit;		//next bit to sample, 8: stop bit
+	uint8_t rx_data;
+	uint16_t rx_errors;	//frames without stop bit
 } Softuart;
 
 
+//The rx interrupt only records edges, they are decoded in Softuart_Available()
+//and Softuart_Read(). Call them often enough that the edges of no more than
+//SOFTUART_MAX_EDGES/10 chars pile up.
 BOOL Softuart_Available(Softuart *s);
 void Softuart_Intr_Handler(Softuart *s);
 void Softuart_SetPinRx(Softuart *s, uint8_t gpio_id);
 void Softuart_SetPinTx(Softuart *s, uint8_t gpio_id);
 void Softuart_EnableRs485(Softuart *s, uint8_t gpio_id);
 void Softuart_Init(Softuart *s, uint32_t baudrate);
+//Chars are queued and sent by the FRC1 timer interrupt, one bit per tick, so
+//only one instance can transmit (the last one initialized with a tx pin) and
+//FRC1 is not available for PWM or hw_timer. If the queue is full, the char is
+//dropped and counted in tx.dropped.
 void Softuart_Putchar(Softuart *s, char data);
 void Softuart_Puts(Softuart *s, const char *c );
 uint8_t Softuart_Read(Softuart *s);
@@ -22,15 +22,26 @@
 #include "c_types.h"
 
 #define UART_TX_BUFFER_SIZE 4096 //Ring buffer length of tx buffer
-#define UART_RX_BUFFER_SIZE 0 //Ring buffer length of rx buffer
+#define UART_RX_BUFFER_SIZE 2048 //Ring buffer length of rx buffer, filled by the rx interrupt
+// (both sizes must be powers of two)
 
-#define UART_HW_RTS   0   //set 1: enable uart hw flow control RTS, PIN MTDO, FOR UART0
-#define UART_HW_CTS  0    //set1: enable uart hw flow contrl CTS , PIN MTCK, FOR UART0
+// HW flow control of UART0 is set at runtime with UART_SetFlowCtrl(): RTS on MTDO
+// (GPIO15), CTS on MTCK (GPIO13). RTS is deasserted at this RX FIFO fill level,
+// above the RX FIFO full interrupt threshold (100), so it only happens while the
+// RX interrupt is masked because the rx ring is full
+#define UART_RX_FLOW_THRESH 110
 
 #define UART0   0
 #define UART1   1
 
+// Called in the RX interrupt for every byte, if set. Otherwise the RX interrupt
+// fills the rx ring, which is emptied in task context with uart0_rx_unload()
 typedef void (*uart_unload_fn)(char c);
+// Gets the data of the rx ring in place, in chunks of up to UART_RX_BUFFER_SIZE bytes
+typedef void (*uart_unload_bulk_fn)(uint8 *buf, uint16 len);
+// Called in the TX empty interrupt, writes up to room bytes into the tx fifo with
+// UART0_TX_FIFO_PUT(), returns the number of bytes written
+typedef uint8 (*uart_tx_fill_fn)(uint8 room);
 
 typedef enum {
     FIVE_BITS = 0x0,
@@ -140,6 +151,17 @@ typedef struct {
 } UartDevice;
 
 extern uart_unload_fn	uart0_unload_fn;
+extern uart_tx_fill_fn	uart0_tx_fill_fn;
+
+// Error counters of UART0, updated by the interrupt handler and tx_buff_enq()
+struct uart_stats {
+    uint32	frm_err;	// framing errors
+    uint32	rx_ovf;		// RX FIFO overflows
+    uint32	rx_throttled;	// RX ring full, RX interrupts masked until it drains
+    uint32	tx_drops;	// tx_buff_enq() calls that didn't fit into the TX ring
+};
+
+extern struct uart_stats uart_stats;
 
 void uart_init(UartBautRate uart0_br);
 void uart0_sendStr(const char *str);
@@ -149,47 +171,21 @@ void uart0_sendStr(const char *str);
 #define UART_FIFO_LEN  128  //define the tx fifo length
 #define UART_TX_EMPTY_THRESH_VAL 0x10
 
+#define UART0_TX_FIFO_PUT(c) WRITE_PERI_REG(UART_FIFO(UART0), (c))
 
- struct UartBuffer{
-    uint32     UartBuffSize;
-    uint8     *pUartBuff;
-    uint8     *pInPos;
-    uint8     *pOutPos;
-    STATUS  BuffState;
-    uint16    Space;  //remanent space of the buffer
-    uint8  TcpControl;
-    struct  UartBuffer     *  nextBuff;
-};
-
-struct UartRxBuff{
-    uint32     UartRxBuffSize;
-    uint8     *pUartRxBuff;
-    uint8     *pWritePos;
-    uint8     *pReadPos;
-    STATUS RxBuffState;
-    uint32    Space;  //remanent space of the buffer
-} ;
-
-typedef enum {
-    RUN = 0,
-    BLOCK = 1,
-} TCPState;
 
 //void ICACHE_FLASH_ATTR uart_test_rx();
 STATUS uart_tx_one_char(uint8 uart, uint8 TxChar);
 STATUS uart_tx_one_char_no_wait(uint8 uart, uint8 TxChar);
 void  uart1_sendStr_no_wait(const char *str);
-struct UartBuffer*  Uart_Buf_Init();
 
 void external_unload();
 
-LOCAL void  Uart_Buf_Cpy(struct UartBuffer* pCur, char* pdata , uint16 data_len);
-void  uart_buf_free(struct UartBuffer* pBuff);
 void  tx_buff_enq(char* pdata, uint16 data_len );
-LOCAL void  tx_fifo_insert(struct UartBuffer* pTxBuff, uint8 data_len,  uint8 uart_no);
+void  uart0_tx_start(void);
 void  tx_start_uart_buffer(uint8 uart_no);
 uint16  rx_buff_deq(char* pdata, uint16 data_len );
-void  Uart_rx_buff_enq();
+uint16  uart0_rx_unload(uart_unload_bulk_fn fn);
 
 void  uart_rx_intr_enable(uint8 uart_no);
 void  uart_rx_intr_disable(uint8 uart_no);
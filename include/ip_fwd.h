@@ -0,0 +1,62 @@
+#ifndef _IP_FWD_H_
+#define _IP_FWD_H_
+
+#include "c_types.h"
+#include "lwip/pbuf.h"
+#include "lwip/netif.h"
+
+/*
+ * Packet manipulations applied to forwarded traffic where it
+ * crosses the SLIP link (in the input/output hooks of the SLIP netif).
+ */
+
+// Sizes of the NAPT tables in liblwip_open_napt.a
+extern uint16_t ip_napt_max;
+extern uint8_t ip_portmap_max;
+
+// NAPT entries at least, and heap the tables have to leave free at boot
+#define IP_FWD_NAT_MIN		16
+#define IP_FWD_NAPT_HEAP	16384
+
+// ICMP errors sent per second at most
+#define IP_FWD_ICMP_RATE	10
+
+struct ip_fwd_stats {
+    uint32_t	mss_clamped;	// SYN segments with a lowered MSS option
+    uint32_t	too_big;	// packets dropped for exceeding the MTU of the next hop
+    uint32_t	frag_needed;	// ICMP "fragmentation needed" sent for them
+    uint32_t	icmp_limited;	// ICMP errors suppressed by the rate limit
+};
+
+extern struct ip_fwd_stats ip_fwd_stats;
+
+/*
+ * Lowers the MSS option of a TCP SYN or SYN/ACK in p to mss, if it is larger.
+ * The TCP checksum is updated incrementally. Returns true if p was changed.
+ */
+bool ip_fwd_mss_clamp(struct pbuf *p, uint16_t mss);
+
+/*
+ * Drops p (the caller still frees it), which is larger than the mtu of the
+ * next hop. As IP_FRAG is 0, it can't be fragmented: if DF is set, the sender
+ * gets an ICMP "fragmentation needed" with the next-hop MTU (RFC 1191).
+ * Returns true if it was sent.
+ */
+bool ip_fwd_too_big(struct pbuf *p, uint16_t mtu);
+
+/*
+ * Addresses of the NAPT: packets from outside to the inside netif have their
+ * destination translated already when they turn out to be too big. The IP
+ * header quoted in the ICMP error gets the outside address (and the external
+ * port of a portmap) back, so the sender can match it. outside 0: no NAPT.
+ */
+void ip_fwd_set_napt(struct netif *inside, uint32_t outside);
+
+/*
+ * Allocates the NAPT tables with nat and portmap entries, once at boot (the
+ * call in lwip_init() with the compile time sizes is skipped). While they
+ * don't fit into the heap, nat is halved. Returns the NAPT entries allocated.
+ */
+uint16_t ip_fwd_napt_init(uint16_t nat, uint8_t portmap);
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef _LINK_STATS_H_
+#define _LINK_STATS_H_
+
+#include "c_types.h"
+#include "lwip/netif.h"
+
+/*
+ * Packet counters per interface and error counters of the forwarding path,
+ * all updated once per frame. A 1 s timer takes snapshots of the packet and
+ * byte counters, the rates over the last 1, 10 and 60 s are the differences
+ * to older snapshots. The WiFi counters are taken in hooks on the input and
+ * output functions of the SDK's STA and AP interfaces.
+ */
+
+enum link_if { LINK_IF_SLIP, LINK_IF_WIFI, LINK_IFS };
+
+// in: received on the interface, out: sent on it
+enum link_ctr { LINK_PKTS_IN, LINK_PKTS_OUT, LINK_BYTES_IN, LINK_BYTES_OUT, LINK_CTRS };
+
+enum link_window { LINK_WIN_1S, LINK_WIN_10S, LINK_WIN_60S, LINK_WINS };
+
+struct link_stats {
+    uint32_t	ctr[LINK_IFS][LINK_CTRS];
+    uint32_t	slip_bad_frames;	// frames from the serial line that are no valid IPv4 packet
+    uint32_t	pbuf_alloc_fails;	// failed pbuf_alloc() calls, including the SDK's
+    uint32_t	napt_full;		// packets from the SLIP side that found the NAPT table full
+};
+
+extern struct link_stats link_stats;
+
+static inline void link_stats_in(enum link_if i, uint16_t len)
+{
+    link_stats.ctr[i][LINK_PKTS_IN]++;
+    link_stats.ctr[i][LINK_BYTES_IN] += len;
+}
+
+static inline void link_stats_out(enum link_if i, uint16_t len)
+{
+    link_stats.ctr[i][LINK_PKTS_OUT]++;
+    link_stats.ctr[i][LINK_BYTES_OUT] += len;
+}
+
+// Starts the rate timer and hooks the WiFi interfaces (again every second,
+// the SDK re-creates them when the WiFi mode changes)
+void link_stats_init(void);
+
+// Counter c of interface i per second over window w
+uint32_t link_stats_rate(enum link_if i, enum link_ctr c, enum link_window w);
+
+// Counts the packet if the NAPT table is full, called for packets from the SLIP side
+void link_stats_check_napt(void);
+
+// Console stream function for the counters and rates, LINK_STATS_LINES calls
+#define LINK_STATS_LINES	(LINK_IFS * 2 + 3)
+bool link_stats_show_line(uint16_t idx);
+
+#endif
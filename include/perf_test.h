@@ -0,0 +1,69 @@
+#ifndef _PERF_TEST_H_
+#define _PERF_TEST_H_
+
+#include "c_types.h"
+#include "lwip/ip_addr.h"
+
+/*
+ * Throughput test service on the ESP itself, so the SLIP and the WiFi leg
+ * of the path can be measured separately: a host on each side talks to the
+ * ESP instead of through it.
+ * - TCP discard (PERF_DISCARD_PORT): received data is counted and dropped
+ * - TCP chargen (PERF_CHARGEN_PORT): sends as fast as the connection takes it
+ * - UDP sink (PERF_UDP_PORT): counts datagrams, lost ones are detected by
+ *   the iperf2 sequence number in the first 4 bytes (so "iperf -u" works)
+ * - UDP blaster: sends datagrams of a given size and rate to a host,
+ *   numbered the same way
+ * Traffic is accounted to the SLIP leg if the peer is in the subnet of the
+ * SLIP interface, to the WiFi leg otherwise. While the service runs, the
+ * idle time of the CPU is measured by a spin loop in the user task.
+ */
+
+// Largest UDP payload that fits into a 1500 byte packet
+#define PERF_UDP_MAX_SIZE	1472
+
+// Longest UDP run, the elapsed time is kept in us in 32 bits
+#define PERF_UDP_MAX_SECS	3600
+
+// TCP test connections at a time (both servers)
+#define PERF_MAX_CONN		4
+
+enum perf_leg { PERF_LEG_SLIP, PERF_LEG_WIFI, PERF_LEGS };
+
+struct perf_leg_stats {
+    uint32_t	rx_bytes;	// totals since perf_test_start()
+    uint32_t	rx_pkts;	// TCP: receive callbacks
+    uint32_t	tx_bytes;
+    uint32_t	tx_pkts;	// TCP: sent chunks
+    uint32_t	rx_lost;	// UDP datagrams missing in the sequence
+    uint32_t	tx_dropped;	// UDP datagrams the stack refused to send
+    uint32_t	rx_bps;		// rates of the last full second
+    uint32_t	rx_pps;
+    uint32_t	tx_bps;
+    uint32_t	tx_pps;
+};
+
+struct perf_stats {
+    struct perf_leg_stats leg[PERF_LEGS];
+    uint8_t	cpu_load;	// percent, last full second
+};
+
+extern struct perf_stats perf_stats;
+
+// Starts/stops the servers, the blaster and the CPU load measurement
+bool perf_test_start(void);
+void perf_test_stop(void);
+bool perf_test_running(void);
+
+// Sends size byte datagrams to addr:port at pps packets/s for secs seconds,
+// starts the service if it isn't running. False if the arguments are invalid
+// or memory is short, the service state is unchanged then.
+bool perf_test_udp(ip_addr_t *addr, uint16_t port, uint16_t size, uint16_t pps, uint16_t secs);
+
+// One CPU idle slice, called for SIG_PERF_IDLE in the user task
+void perf_test_idle(void);
+
+// Console stream function for the test state and results
+bool perf_test_show_line(uint16_t idx);
+
+#endif
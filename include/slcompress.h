@@ -0,0 +1,64 @@
+#ifndef _SLCOMPRESS_H_
+#define _SLCOMPRESS_H_
+
+/*
+ * Van Jacobson TCP/IP header compression (RFC 1144) for the SLIP link.
+ * Follows the reference implementation in appendix A of the RFC, but works
+ * on a plain byte buffer holding the (contiguous) IP and TCP header.
+ */
+
+#include "c_types.h"
+
+#define SLIP_MODE_SLIP		0
+#define SLIP_MODE_CSLIP		1
+
+#define SLC_MAX_STATES		16	// must be > 2 and < 256
+#define SLC_MAX_HDR		128	// max TCP+IP hdr length (by protocol def)
+#define SLC_MAX_CHDR		32	// bytes to provide for a compressed hdr
+
+// packet types, encoded in the upper bits of the first byte of a packet
+#define TYPE_IP			0x40
+#define TYPE_UNCOMPRESSED_TCP	0x70
+#define TYPE_COMPRESSED_TCP	0x80
+#define TYPE_ERROR		0x00
+
+struct slc_cstate {
+    struct slc_cstate *next;	// next most recently used cstate (xmit only)
+    uint16_t	hlen;		// size of hdr (receive only)
+    uint8_t	id;		// connection # associated with this state
+    uint8_t	hdr[SLC_MAX_HDR];
+};
+
+struct slcompress {
+    struct slc_cstate *last_cs;	// most recently used tstate
+    uint8_t	last_recv;	// last rcvd conn. id
+    uint8_t	last_xmit;	// last sent conn. id
+    uint8_t	flags;
+    struct slc_cstate tstate[SLC_MAX_STATES];	// xmit connection states
+    struct slc_cstate rstate[SLC_MAX_STATES];	// receive connection states
+};
+
+void sl_compress_init(struct slcompress *comp);
+
+/*
+ * Compresses the header of an outgoing packet in place. ip holds at least
+ * the full IP+TCP header (len valid bytes). Returns the packet type, *hlen
+ * is set to the length of the original header. For TYPE_COMPRESSED_TCP the
+ * new header are the last *clen bytes of the original header area, for
+ * TYPE_UNCOMPRESSED_TCP the header has been tagged with the conn. id.
+ */
+uint8_t sl_compress_tcp(struct slcompress *comp, uint8_t *ip, uint16_t len,
+			uint16_t *hlen, uint16_t *clen);
+
+/*
+ * Processes the header of an incoming CSLIP packet of the given type.
+ * TYPE_UNCOMPRESSED_TCP: the header in buf is restored in place, returns 0.
+ * TYPE_COMPRESSED_TCP: buf holds the compressed header (at least
+ * SLC_MAX_CHDR bytes readable), pkt_len is the length of the received packet.
+ * Returns the number of bytes consumed, hdr and hlen return the rebuilt header.
+ * Returns -1 if the packet has to be dropped.
+ */
+int sl_uncompress_tcp(struct slcompress *comp, uint8_t type, uint8_t *buf,
+		      uint16_t len, uint16_t pkt_len, uint8_t **hdr, uint16_t *hlen);
+
+#endif
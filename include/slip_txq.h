@@ -0,0 +1,88 @@
+#ifndef _SLIP_TXQ_H_
+#define _SLIP_TXQ_H_
+
+#include "c_types.h"
+#include "lwip/err.h"
+#include "lwip/pbuf.h"
+#include "slcompress.h"
+
+/*
+ * Packet queue in front of the UART. Only a couple of frames at a time are
+ * handed over to the TX interrupt, which SLIP encodes them straight from the
+ * pbufs into the FIFO. So the standing queue is kept here, where whole
+ * frames can be dropped (CoDel, RFC 8289).
+ * Packets are queued per source address (the stations of the SoftAP, or the
+ * servers in STA mode) and the flows take turns by deficit round robin, with
+ * a CoDel instance each (FQ-CoDel, RFC 8290). A flow that just became
+ * active goes first, so a bulk transfer doesn't delay interactive traffic of
+ * other stations. When the queue is full, the flow with the largest backlog
+ * loses its oldest packet.
+ * A pure TCP ACK replaces an older one of the same flow that is still
+ * queued, if nothing else of the flow is queued after it. Dup ACKs, ACKs
+ * with SACK blocks, ECN signals or a shrinking window are left alone.
+ * In CSLIP mode the headers are VJ compressed when a frame is handed over
+ * to the UART: a compressed header is a delta to the previous packet of
+ * the connection, so the compressor must only see the packets that are
+ * actually sent, not the ones dropped or replaced in the queue.
+ */
+
+// Max number of queued packets and bytes (tail drop above)
+#define SLIP_TXQ_MAX_PKTS	32
+#define SLIP_TXQ_MAX_BYTES	8192
+
+// Largest packet on the link, queues below this size are never dropped from
+#define SLIP_TXQ_MAXPACKET	1500
+
+// Flow queues: the stations of the SoftAP (MAX_CLIENTS), the ESP itself and
+// a spare one. Bytes a flow may send per round.
+#define SLIP_TXQ_FLOWS		10
+#define SLIP_TXQ_QUANTUM	300
+
+// CoDel parameters, target is raised to the time it takes to send a full frame
+#define CODEL_TARGET_MS		5
+#define CODEL_INTERVAL_MS	100
+
+struct slip_txq_stats {
+    uint16_t	pkts;		// packets currently queued
+    uint16_t	bytes;		// bytes currently queued
+    uint32_t	codel_drops;	// packets dropped by CoDel
+    uint32_t	tail_drops;	// packets dropped because the queue was full
+    uint32_t	acks_thinned;	// queued ACKs replaced by newer ones
+    uint32_t	target_us;	// current CoDel target
+    uint32_t	interval_us;	// current CoDel interval
+};
+
+// Counters per flow, reset when the flow is taken over by another source
+struct slip_txq_client {
+    uint32_t	addr;		// source address, 0: unused
+    uint32_t	bytes;		// handed over to the UART
+    uint32_t	drops;		// CoDel and queue full drops
+};
+
+extern struct slip_txq_stats slip_txq_stats;
+extern struct slip_txq_client slip_txq_clients[SLIP_TXQ_FLOWS];
+
+void slip_txq_init(uint32_t bit_rate);
+
+// Queues the IP packet p (in one pbuf) for sending in the flow of the source
+// address src, takes over the reference to p (p must not be modified afterwards)
+err_t slip_txq_enqueue(struct pbuf *p, uint32_t src);
+
+// VJ compresses the TCP headers of the frames handed over from now on with
+// comp, NULL: plain SLIP
+void slip_txq_set_compress(struct slcompress *comp);
+
+// Frees sent frames and hands over queued ones to the UART TX interrupt, called in task context
+void slip_txq_pump(void);
+
+// Holds back frames queued from now on (e.g. while the bitrate changes), the
+// ones already queued still go out
+void slip_txq_hold(bool on);
+
+// True when the interrupt has written all frames it may send into the FIFO
+bool slip_txq_idle(void);
+
+// Console stream function for the per flow counters, SLIP_TXQ_FLOWS calls
+bool slip_txq_show_line(uint16_t idx);
+
+#endif
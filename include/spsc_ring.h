@@ -0,0 +1,98 @@
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+
+#include "c_types.h"
+
+/*
+ * Lock-free ring buffer for a single producer and a single consumer, e.g. an
+ * interrupt handler and a task. The size is a power of two and head and tail
+ * are free running counters, so fill levels are plain differences and
+ * positions are masked, no modulo and no "one slot free" rule. head is only
+ * written by the producer, tail only by the consumer.
+ *
+ * Data is accessed in place: spsc_ring_reserve()/spsc_ring_commit() on the
+ * producer side, spsc_ring_peek()/spsc_ring_consume() on the consumer side.
+ * Both hand out contiguous chunks, at the wrap around a second call returns
+ * the rest.
+ */
+
+// Largest ring, the fill level must fit into the 16 bit counters
+#define SPSC_RING_MAX_SIZE	0x8000
+
+struct spsc_ring {
+    uint8_t		*buf;
+    uint16_t		mask;		// size - 1
+    volatile uint16_t	head;		// total bytes committed
+    volatile uint16_t	tail;		// total bytes consumed
+};
+
+// The other side must not see a counter update before the data (single core,
+// so it is enough to keep the compiler from reordering)
+#define SPSC_RING_BARRIER()	__asm__ __volatile__("" ::: "memory")
+
+// Allocates a ring of size bytes (power of two), returns false without memory
+bool spsc_ring_init(struct spsc_ring *r, uint16_t size);
+void spsc_ring_free(struct spsc_ring *r);
+
+// Copying access for callers that don't care about in place access
+uint16_t spsc_ring_write(struct spsc_ring *r, const void *data, uint16_t len);
+uint16_t spsc_ring_read(struct spsc_ring *r, void *data, uint16_t len);
+
+static inline uint16_t spsc_ring_used(const struct spsc_ring *r)
+{
+    return (uint16_t)(r->head - r->tail);
+}
+
+static inline uint16_t spsc_ring_room(const struct spsc_ring *r)
+{
+    return r->buf == NULL ? 0 : r->mask + 1 - spsc_ring_used(r);
+}
+
+// Producer: *p is set to the next free bytes, returns how many of them
+// (at most n) are contiguous
+static inline uint16_t spsc_ring_reserve(struct spsc_ring *r, uint8_t **p, uint16_t n)
+{
+    uint16_t head = r->head;
+    uint16_t room = spsc_ring_room(r);
+    uint16_t contig = r->mask + 1 - (head & r->mask);
+
+    if (room > contig)
+	room = contig;
+    if (room > n)
+	room = n;
+    *p = r->buf + (head & r->mask);
+    return room;
+}
+
+// Producer: publishes n bytes written to the reserved space
+static inline void spsc_ring_commit(struct spsc_ring *r, uint16_t n)
+{
+    SPSC_RING_BARRIER();
+    r->head += n;
+}
+
+// Consumer: *p is set to the oldest bytes, returns how many of them
+// (at most n) are contiguous
+static inline uint16_t spsc_ring_peek(struct spsc_ring *r, uint8_t **p, uint16_t n)
+{
+    uint16_t tail = r->tail;
+    uint16_t avail = spsc_ring_used(r);
+    uint16_t contig = r->mask + 1 - (tail & r->mask);
+
+    if (avail > contig)
+	avail = contig;
+    if (avail > n)
+	avail = n;
+    *p = r->buf + (tail & r->mask);
+    SPSC_RING_BARRIER();
+    return avail;
+}
+
+// Consumer: releases n bytes returned by spsc_ring_peek()
+static inline void spsc_ring_consume(struct spsc_ring *r, uint16_t n)
+{
+    SPSC_RING_BARRIER();
+    r->tail += n;
+}
+
+#endif
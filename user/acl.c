@@ -0,0 +1,156 @@
+#include "c_types.h"
+#include "osapi.h"
+#include "lwip/def.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+
+#include "console.h"
+#include "acl.h"
+
+#define IP_PROTO_ICMP	1
+#define IP_PROTO_TCP	6
+#define IP_PROTO_UDP	17
+
+struct acl_rule acl_rules[ACL_RULES_MAX];
+uint32_t acl_hits[ACL_RULES_MAX];
+
+static uint8_t n_rules;
+
+
+static uint32_t ICACHE_FLASH_ATTR acl_mask(uint8_t prefix_len)
+{
+    return prefix_len == 0 ? 0 : PP_HTONL(0xffffffffUL << (32 - prefix_len));
+}
+
+static uint8_t ICACHE_FLASH_ATTR acl_prefix_len(uint32_t mask)
+{
+    uint8_t n = 0;
+
+    for (mask = PP_NTOHL(mask); mask & 0x80000000UL; mask <<= 1)
+	n++;
+    return n;
+}
+
+void ICACHE_FLASH_ATTR acl_init(void)
+{
+    // the table ends at the first unused or invalid rule (e.g. of an empty blob)
+    for (n_rules = 0; n_rules < ACL_RULES_MAX; n_rules++) {
+	if ((acl_rules[n_rules].action != ACL_ALLOW && acl_rules[n_rules].action != ACL_DROP) ||
+	    acl_rules[n_rules].port_lo > acl_rules[n_rules].port_hi)
+	    break;
+    }
+    os_memset(&acl_rules[n_rules], 0, (ACL_RULES_MAX - n_rules) * sizeof(struct acl_rule));
+    os_memset(acl_hits, 0, sizeof(acl_hits));
+}
+
+bool ICACHE_FLASH_ATTR acl_add(enum acl_action action, uint8_t proto, uint32_t src, uint8_t prefix_len,
+			       uint16_t port_lo, uint16_t port_hi)
+{
+    struct acl_rule *r;
+
+    if (n_rules >= ACL_RULES_MAX || prefix_len > 32 || port_lo > port_hi ||
+	(action != ACL_ALLOW && action != ACL_DROP))
+	return false;
+
+    r = &acl_rules[n_rules];
+    os_memset(r, 0, sizeof(*r));
+    r->mask = acl_mask(prefix_len);
+    r->src = src & r->mask;
+    r->port_lo = port_lo;
+    r->port_hi = port_hi;
+    r->proto = proto;
+    r->action = action;
+    acl_hits[n_rules] = 0;
+    n_rules++;
+    return true;
+}
+
+uint8_t ICACHE_FLASH_ATTR acl_count(void)
+{
+    return n_rules;
+}
+
+bool ICACHE_FLASH_ATTR acl_del(uint8_t n)
+{
+    if (n < 1 || n > n_rules)
+	return false;
+    os_memmove(&acl_rules[n - 1], &acl_rules[n], (n_rules - n) * sizeof(struct acl_rule));
+    os_memmove(&acl_hits[n - 1], &acl_hits[n], (n_rules - n) * sizeof(uint32_t));
+    n_rules--;
+    os_memset(&acl_rules[n_rules], 0, sizeof(struct acl_rule));
+    acl_hits[n_rules] = 0;
+    return true;
+}
+
+bool ICACHE_FLASH_ATTR acl_drop(struct pbuf *p)
+{
+    uint8_t *ip = (uint8_t *)p->payload;
+    struct acl_rule *r;
+    uint32_t src;
+    uint16_t ihl;
+    int32_t port = -1;
+    uint8_t ports[4];
+    uint8_t i;
+
+    if (n_rules == 0 || p->len < 20 || (ip[0] >> 4) != 4)
+	return false;
+    os_memcpy(&src, ip + 12, 4);
+
+    // the ports are in the first fragment only
+    ihl = (ip[0] & 0x0f) << 2;
+    if ((ip[9] == IP_PROTO_TCP || ip[9] == IP_PROTO_UDP) && (((ip[6] << 8) | ip[7]) & 0x1fff) == 0 &&
+	pbuf_copy_partial(p, ports, sizeof(ports), ihl) == sizeof(ports))
+	port = (ports[2] << 8) | ports[3];
+
+    for (i = 0, r = acl_rules; i < n_rules; i++, r++) {
+	if ((src & r->mask) != r->src || (r->proto != 0 && r->proto != ip[9]))
+	    continue;
+	// a port range only matches packets with ports
+	if ((r->port_lo != 0 || r->port_hi != 0xffff) &&
+	    (port < r->port_lo || port > r->port_hi))
+	    continue;
+	acl_hits[i]++;
+	return r->action == ACL_DROP;
+    }
+    return false;
+}
+
+bool ICACHE_FLASH_ATTR acl_show_line(uint16_t idx)
+{
+    char response[CONSOLE_LINE_MAX];
+    char *pos = response;
+    struct acl_rule *r;
+
+    if (idx == 0 && n_rules == 0) {
+	console_puts("No ACL rules, all allowed\r\n");
+	return false;
+    }
+    if (idx >= n_rules)
+	return false;
+    r = &acl_rules[idx];
+
+    pos += os_sprintf(pos, "%d: %s ", idx + 1, r->action == ACL_DROP ? "drop" : "allow");
+    switch (r->proto) {
+    case 0:
+	pos += os_sprintf(pos, "any");
+	break;
+    case IP_PROTO_ICMP:
+	pos += os_sprintf(pos, "icmp");
+	break;
+    case IP_PROTO_TCP:
+	pos += os_sprintf(pos, "tcp");
+	break;
+    case IP_PROTO_UDP:
+	pos += os_sprintf(pos, "udp");
+	break;
+    default:
+	pos += os_sprintf(pos, "%d", r->proto);
+	break;
+    }
+    pos += os_sprintf(pos, " from " IPSTR "/%d", IP2STR((ip_addr_t *)&r->src), acl_prefix_len(r->mask));
+    if (r->port_lo != 0 || r->port_hi != 0xffff)
+	pos += os_sprintf(pos, " to port %d-%d", r->port_lo, r->port_hi);
+    os_sprintf(pos, ": %d hits\r\n", acl_hits[idx]);
+    console_puts(response);
+    return true;
+}
@@ -0,0 +1,121 @@
+#include "c_types.h"
+#include "osapi.h"
+#include "user_interface.h"
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+#include "lwip/netif.h"
+
+#include "console.h"
+#include "bcast_filter.h"
+
+#define IP_PROTO_UDP	17
+
+struct bcast_rule_stats bcast_rule_stats[BCAST_RULES_MAX];
+
+static struct bcast_rule *rules;
+
+// Rate limit, packets let through in the current second
+static uint32_t win_start[BCAST_RULES_MAX];
+static uint8_t win_pkts[BCAST_RULES_MAX];
+
+
+void ICACHE_FLASH_ATTR bcast_filter_default(struct bcast_rule *r)
+{
+    static const struct bcast_rule defaults[] = {
+	{ BCAST_DST_MCAST, 0, 1900 },	// SSDP
+	{ BCAST_DST_MCAST, 0, 5353 },	// mDNS
+	{ BCAST_DST_MCAST, 0, 5355 },	// LLMNR
+	{ BCAST_DST_BCAST, 0, 137 },	// NetBIOS name service
+	{ BCAST_DST_BCAST, 0, 138 },	// NetBIOS datagrams
+    };
+
+    os_memset(r, 0, BCAST_RULES_MAX * sizeof(struct bcast_rule));
+    os_memcpy(r, defaults, sizeof(defaults));
+}
+
+void ICACHE_FLASH_ATTR bcast_filter_init(struct bcast_rule *r)
+{
+    rules = r;
+    os_memset(bcast_rule_stats, 0, sizeof(bcast_rule_stats));
+    os_memset(win_pkts, 0, sizeof(win_pkts));
+}
+
+static bool ICACHE_FLASH_ATTR bcast_rate_ok(uint8_t i)
+{
+    uint32_t now = system_get_time();
+
+    if (now - win_start[i] >= 1000000) {
+	win_start[i] = now;
+	win_pkts[i] = 0;
+    }
+    if (win_pkts[i] >= rules[i].rate)
+	return false;
+    win_pkts[i]++;
+    return true;
+}
+
+bool ICACHE_FLASH_ATTR bcast_filter_drop(struct pbuf *p, struct netif *netif)
+{
+    uint8_t *ip = (uint8_t *)p->payload;
+    uint32_t mask = netif->netmask.addr;
+    ip_addr_t dst;
+    uint8_t kind, i;
+    uint16_t ihl, port = 0;
+    uint8_t udp[4];
+
+    if (rules == NULL || p->len < 20 || (ip[0] >> 4) != 4)
+	return false;
+    os_memcpy(&dst.addr, ip + 16, 4);
+    if (ip_addr_ismulticast(&dst))
+	kind = BCAST_DST_MCAST;
+    else if (dst.addr == IPADDR_BROADCAST ||
+	     (mask != IPADDR_BROADCAST && (dst.addr | mask) == IPADDR_BROADCAST &&
+	      (dst.addr & mask) == (netif->ip_addr.addr & mask)))
+	kind = BCAST_DST_BCAST;
+    else
+	return false;
+
+    // the ports are in the first fragment only
+    ihl = (ip[0] & 0x0f) << 2;
+    if (ip[9] == IP_PROTO_UDP && (((ip[6] << 8) | ip[7]) & 0x1fff) == 0 &&
+	pbuf_copy_partial(p, udp, sizeof(udp), ihl) == sizeof(udp))
+	port = (udp[2] << 8) | udp[3];
+
+    for (i = 0; i < BCAST_RULES_MAX; i++) {
+	if (!(rules[i].dst & kind) || (rules[i].port != 0 && rules[i].port != port))
+	    continue;
+	bcast_rule_stats[i].hits++;
+	if (rules[i].rate != 0 && bcast_rate_ok(i))
+	    return false;
+	bcast_rule_stats[i].drops++;
+	return true;
+    }
+    return false;
+}
+
+bool ICACHE_FLASH_ATTR bcast_filter_show_line(uint16_t idx)
+{
+    static const char *dst_names[] = { "", "bcast", "mcast", "all" };
+    char response[CONSOLE_LINE_MAX];
+    char *pos = response;
+    struct bcast_rule *r;
+
+    if (idx >= BCAST_RULES_MAX || rules == NULL)
+	return false;
+    r = &rules[idx];
+    if (r->dst == BCAST_DST_NONE)
+	return true;
+
+    pos += os_sprintf(pos, "%d: %s ", idx + 1, dst_names[r->dst]);
+    if (r->port != 0)
+	pos += os_sprintf(pos, "UDP %d", r->port);
+    else
+	pos += os_sprintf(pos, "any");
+    if (r->rate != 0)
+	pos += os_sprintf(pos, " %d pkts/s", r->rate);
+    else
+	pos += os_sprintf(pos, " drop");
+    os_sprintf(pos, ": %d hits, %d dropped\r\n", bcast_rule_stats[idx].hits, bcast_rule_stats[idx].drops);
+    console_puts(response);
+    return true;
+}
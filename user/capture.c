@@ -0,0 +1,373 @@
+#include "c_types.h"
+#include "mem.h"
+#include "ets_sys.h"
+#include "osapi.h"
+#include "os_type.h"
+#include "user_interface.h"
+#include "lwip/pbuf.h"
+#include "lwip/app/espconn.h"
+
+#include "console.h"
+#include "capture.h"
+#include "user_config.h"
+
+// Data of the dump connection is sent in chunks of at most one segment
+#define CAPTURE_CHUNK		1460
+
+// system_get_time() wraps after 71 min, the timer catches the wrap if
+// nothing is recorded for a while
+#define CAPTURE_TIME_TICK_MS	60000
+
+// pcap file format, LINKTYPE_LINUX_SLL carries the direction of the packet
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_LINKTYPE_SLL	113
+#define SLL_HDR_LEN		16
+#define SLL_HOST		0	// sent to us
+#define SLL_OUTGOING		4	// sent by us
+#define SLL_ARPHRD_SLIP		256
+
+// Record in the ring, followed by caplen bytes of the packet
+struct capture_hdr {
+    uint32_t	time_hi;	// us since boot
+    uint32_t	time_lo;
+    uint16_t	len;		// of the packet
+    uint16_t	caplen;
+    uint8_t	dir;
+    uint8_t	pad[3];
+};
+
+struct pcap_file_hdr {
+    uint32_t	magic;
+    uint16_t	version_major;
+    uint16_t	version_minor;
+    int32_t	thiszone;
+    uint32_t	sigfigs;
+    uint32_t	snaplen;
+    uint32_t	linktype;
+};
+
+struct pcap_rec_hdr {
+    uint32_t	ts_sec;
+    uint32_t	ts_usec;
+    uint32_t	incl_len;
+    uint32_t	orig_len;
+};
+
+struct capture_stats capture_stats;
+bool capture_running;
+
+static uint8_t *ring;
+static uint16_t head;		// next record goes here
+static uint16_t tail;		// oldest record
+static uint16_t used;		// bytes
+static uint16_t records;
+static uint16_t snaplen;
+
+static uint32_t time_hi, time_last;
+static os_timer_t time_timer;
+
+// Dump server, one connection at a time
+static struct espconn dump_srv;
+static esp_tcp dump_tcp;
+static bool listening;
+static struct espconn *dump_conn;
+static uint8_t dump_remote_ip[4];
+static int dump_remote_port;
+static uint8_t *dump_buf;
+static bool dump_hdr_sent;
+static uint16_t dump_pos, dump_left;
+
+
+static void ICACHE_FLASH_ATTR capture_time(uint32_t *hi, uint32_t *lo)
+{
+    uint32_t now = system_get_time();
+
+    if (now < time_last)
+	time_hi++;
+    time_last = now;
+    *hi = time_hi;
+    *lo = now;
+}
+
+static void ICACHE_FLASH_ATTR time_timer_cb(void *arg)
+{
+    uint32_t hi, lo;
+
+    capture_time(&hi, &lo);
+}
+
+static void ICACHE_FLASH_ATTR ring_write(uint16_t pos, const void *data, uint16_t len)
+{
+    uint16_t first = CAPTURE_RING_SIZE - pos;
+
+    if (len <= first) {
+	os_memcpy(ring + pos, data, len);
+    } else {
+	os_memcpy(ring + pos, data, first);
+	os_memcpy(ring, (const uint8_t *)data + first, len - first);
+    }
+}
+
+static void ICACHE_FLASH_ATTR ring_read(uint16_t pos, void *data, uint16_t len)
+{
+    uint16_t first = CAPTURE_RING_SIZE - pos;
+
+    if (len <= first) {
+	os_memcpy(data, ring + pos, len);
+    } else {
+	os_memcpy(data, ring + pos, first);
+	os_memcpy((uint8_t *)data + first, ring, len - first);
+    }
+}
+
+static void ICACHE_FLASH_ATTR ring_drop_oldest(void)
+{
+    struct capture_hdr h;
+    uint16_t size;
+
+    ring_read(tail, &h, sizeof(h));
+    size = sizeof(h) + h.caplen;
+    tail = (tail + size) % CAPTURE_RING_SIZE;
+    used -= size;
+    records--;
+    capture_stats.overwritten++;
+}
+
+void ICACHE_FLASH_ATTR capture_record(struct pbuf *p, enum capture_dir dir)
+{
+    struct capture_hdr h;
+    uint16_t pos, first;
+
+    // the dump reads the ring
+    if (dump_conn != NULL) {
+	capture_stats.paused++;
+	return;
+    }
+
+    os_memset(&h, 0, sizeof(h));
+    capture_time(&h.time_hi, &h.time_lo);
+    h.len = p->tot_len;
+    h.caplen = p->tot_len < snaplen ? p->tot_len : snaplen;
+    h.dir = dir;
+
+    while (CAPTURE_RING_SIZE - used < sizeof(h) + h.caplen)
+	ring_drop_oldest();
+
+    ring_write(head, &h, sizeof(h));
+    pos = (head + sizeof(h)) % CAPTURE_RING_SIZE;
+    first = CAPTURE_RING_SIZE - pos;
+    if (h.caplen <= first) {
+	pbuf_copy_partial(p, ring + pos, h.caplen, 0);
+    } else {
+	pbuf_copy_partial(p, ring + pos, first, 0);
+	pbuf_copy_partial(p, ring, h.caplen - first, first);
+    }
+    head = (pos + h.caplen) % CAPTURE_RING_SIZE;
+    used += sizeof(h) + h.caplen;
+    records++;
+    capture_stats.pkts++;
+}
+
+static void ICACHE_FLASH_ATTR dump_end(void)
+{
+    dump_conn = NULL;
+    os_free(dump_buf);
+    dump_buf = NULL;
+}
+
+// Fills a chunk with as many records as fit, closes the connection when
+// all are sent
+static void ICACHE_FLASH_ATTR dump_send(void)
+{
+    struct pcap_file_hdr fh;
+    struct pcap_rec_hdr rh;
+    struct capture_hdr h;
+    uint8_t sll[SLL_HDR_LEN];
+    uint64_t t;
+    uint16_t fill = 0;
+
+    if (!dump_hdr_sent) {
+	fh.magic = PCAP_MAGIC;
+	fh.version_major = 2;
+	fh.version_minor = 4;
+	fh.thiszone = 0;
+	fh.sigfigs = 0;
+	fh.snaplen = SLL_HDR_LEN + snaplen;
+	fh.linktype = PCAP_LINKTYPE_SLL;
+	os_memcpy(dump_buf, &fh, sizeof(fh));
+	fill = sizeof(fh);
+	dump_hdr_sent = true;
+    }
+
+    os_memset(sll, 0, sizeof(sll));
+    sll[3] = SLL_ARPHRD_SLIP & 0xff;
+    sll[2] = SLL_ARPHRD_SLIP >> 8;
+    sll[14] = 0x08;		// IPv4
+
+    while (dump_left > 0) {
+	ring_read(dump_pos, &h, sizeof(h));
+	if (fill + sizeof(rh) + SLL_HDR_LEN + h.caplen > CAPTURE_CHUNK)
+	    break;
+	t = ((uint64_t)h.time_hi << 32) | h.time_lo;
+	rh.ts_sec = t / 1000000;
+	rh.ts_usec = t % 1000000;
+	rh.incl_len = SLL_HDR_LEN + h.caplen;
+	rh.orig_len = SLL_HDR_LEN + h.len;
+	os_memcpy(dump_buf + fill, &rh, sizeof(rh));
+	fill += sizeof(rh);
+	sll[1] = h.dir == CAPTURE_IN ? SLL_HOST : SLL_OUTGOING;
+	os_memcpy(dump_buf + fill, sll, SLL_HDR_LEN);
+	fill += SLL_HDR_LEN;
+	ring_read((dump_pos + sizeof(h)) % CAPTURE_RING_SIZE, dump_buf + fill, h.caplen);
+	fill += h.caplen;
+	dump_pos = (dump_pos + sizeof(h) + h.caplen) % CAPTURE_RING_SIZE;
+	dump_left--;
+    }
+
+    if (fill == 0 || espconn_sent(dump_conn, dump_buf, fill) != ESPCONN_OK)
+	espconn_disconnect(dump_conn);
+}
+
+static bool ICACHE_FLASH_ATTR dump_conn_match(struct espconn *pespconn)
+{
+    // Match by the remote end, the callbacks are shared with refused connections
+    return dump_conn != NULL && dump_remote_port == pespconn->proto.tcp->remote_port &&
+	   os_memcmp(dump_remote_ip, pespconn->proto.tcp->remote_ip, 4) == 0;
+}
+
+static void ICACHE_FLASH_ATTR dump_sent_cb(void *arg)
+{
+    if (dump_conn_match((struct espconn *)arg))
+	dump_send();
+}
+
+static void ICACHE_FLASH_ATTR dump_discon_cb(void *arg)
+{
+    if (dump_conn_match((struct espconn *)arg))
+	dump_end();
+}
+
+static void ICACHE_FLASH_ATTR dump_recon_cb(void *arg, sint8 err)
+{
+    dump_discon_cb(arg);
+}
+
+static void ICACHE_FLASH_ATTR dump_connected_cb(void *arg)
+{
+    struct espconn *pespconn = (struct espconn *)arg;
+
+    if (dump_conn != NULL || ring == NULL) {
+	espconn_disconnect(pespconn);
+	return;
+    }
+    dump_buf = (uint8_t *)os_malloc(CAPTURE_CHUNK);
+    if (dump_buf == NULL) {
+	espconn_disconnect(pespconn);
+	return;
+    }
+
+    dump_conn = pespconn;
+    os_memcpy(dump_remote_ip, pespconn->proto.tcp->remote_ip, 4);
+    dump_remote_port = pespconn->proto.tcp->remote_port;
+    dump_hdr_sent = false;
+    dump_pos = tail;
+    dump_left = records;
+
+    espconn_regist_sentcb(pespconn, dump_sent_cb);
+    espconn_regist_disconcb(pespconn, dump_discon_cb);
+    espconn_regist_reconcb(pespconn, dump_recon_cb);
+    dump_send();
+}
+
+bool ICACHE_FLASH_ATTR capture_start(uint16_t len)
+{
+    if (len < CAPTURE_SNAPLEN_MIN || len > CAPTURE_SNAPLEN_MAX)
+	return false;
+
+    if (ring == NULL) {
+	ring = (uint8_t *)os_malloc(CAPTURE_RING_SIZE);
+	if (ring == NULL)
+	    return false;
+    }
+    if (dump_conn != NULL) {
+	espconn_disconnect(dump_conn);
+	dump_end();
+    }
+
+    head = tail = used = records = 0;
+    snaplen = len;
+    os_memset(&capture_stats, 0, sizeof(capture_stats));
+
+    os_timer_disarm(&time_timer);
+    os_timer_setfn(&time_timer, time_timer_cb, NULL);
+    os_timer_arm(&time_timer, CAPTURE_TIME_TICK_MS, 1);
+    capture_running = true;
+    return true;
+}
+
+void ICACHE_FLASH_ATTR capture_stop(void)
+{
+    capture_running = false;
+    os_timer_disarm(&time_timer);
+
+    if (dump_conn != NULL) {
+	espconn_disconnect(dump_conn);
+	dump_end();
+    }
+    if (listening) {
+	espconn_delete(&dump_srv);
+	listening = false;
+    }
+    os_free(ring);
+    ring = NULL;
+}
+
+bool ICACHE_FLASH_ATTR capture_dump(void)
+{
+    if (ring == NULL)
+	return false;
+    if (listening)
+	return true;
+
+    os_memset(&dump_srv, 0, sizeof(dump_srv));
+    os_memset(&dump_tcp, 0, sizeof(dump_tcp));
+    dump_srv.type = ESPCONN_TCP;
+    dump_srv.state = ESPCONN_NONE;
+    dump_srv.proto.tcp = &dump_tcp;
+    dump_tcp.local_port = CAPTURE_PORT;
+    espconn_regist_connectcb(&dump_srv, dump_connected_cb);
+    espconn_accept(&dump_srv);
+    espconn_regist_time(&dump_srv, 60, 0);
+    listening = true;
+    return true;
+}
+
+bool ICACHE_FLASH_ATTR capture_show_line(uint16_t idx)
+{
+    char response[CONSOLE_LINE_MAX];
+
+    switch (idx) {
+    case 0:
+	if (ring == NULL) {
+	    console_puts("Capture stopped\r\n");
+	    return false;
+	}
+	os_sprintf(response, "Capture %s, snaplen %d: %d records, %d of %d bytes\r\n",
+	   dump_conn != NULL ? "paused for dump" : "running", snaplen, records, used, CAPTURE_RING_SIZE);
+	break;
+    case 1:
+	os_sprintf(response, "Recorded %d pkts, overwritten %d, missed during dump %d\r\n",
+	   capture_stats.pkts, capture_stats.overwritten, capture_stats.paused);
+	break;
+    case 2:
+	if (!listening)
+	    return false;
+	os_sprintf(response, "Dump: connect to port %d, e.g. \"nc <esp_ip> %d > slip.pcap\"\r\n",
+	   CAPTURE_PORT, CAPTURE_PORT);
+	break;
+    default:
+	return false;
+    }
+    console_puts(response);
+    return true;
+}
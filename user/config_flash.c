@@ -1,5 +1,9 @@
 #include "user_interface.h"
 #include "config_flash.h"
+#include "slcompress.h"
+#include "driver/uart.h"
+#include "dns_cache.h"
+#include "lwip/lwip_napt.h"
 
 
 /*     From the document 99A-SDK-Espressif IOT Flash RW Operation_v0.2      *
@@ -8,6 +12,245 @@
  * time at least. When you want to change some data in flash, you have to
  * erase the whole sector, and then write it back with the new data.
  *--------------------------------------------------------------------------*/
+
+/*
+ * So the config and the blobs are kept in an append-only log of records
+ * over FLASH_LOG_SECTORS sectors, used as a ring. Objects are stored in
+ * chunks of LOG_CHUNK bytes, one record per chunk. A save only appends
+ * the chunks that differ from their latest record. When the active sector
+ * is full, the next one (always kept erased) is opened and the live records
+ * of the oldest sector are copied over before it is erased in turn.
+ * A RAM index holds the location of the latest record of each chunk.
+ */
+
+#define LOG_MAGIC		0x31474f4c	// "LOG1"
+#define LOG_SIZE		(FLASH_LOG_SECTORS * SPI_FLASH_SEC_SIZE)
+#define LOG_CHUNK		64
+#define LOG_MAX_KEYS		3		// config and 2 blobs
+#define LOG_MAX_CHUNKS		16		// max object size: 1 KB
+#define LOG_KEY_CONFIG		0
+#define LOG_KEY_BLOB(n)		(1 + (n))
+#define LOG_NONE		0xffff
+
+struct log_sector_hdr {
+    uint32_t	magic;
+    uint32_t	seq;		// incremented with every newly opened sector
+};
+
+struct log_rec_hdr {
+    uint8_t	key;		// 0xff: free space
+    uint8_t	chunk;
+    uint16_t	len;		// data bytes following the header
+    uint32_t	crc;		// crc32 of key, chunk, len and data
+};
+
+#define LOG_REC_SIZE(len)	(sizeof(struct log_rec_hdr) + (((len) + 3) & ~3))
+
+// Offset of the latest record of each chunk from the log start
+static uint16_t log_index[LOG_MAX_KEYS][LOG_MAX_CHUNKS];
+static uint8_t log_active;
+static uint32_t log_seq;
+static uint16_t log_wr;		// offset of the free space in the active sector
+static bool log_ready;
+
+static uint32_t ICACHE_FLASH_ATTR log_addr(uint16_t off)
+{
+    return FLASH_LOG_START * SPI_FLASH_SEC_SIZE + off;
+}
+
+static uint32_t ICACHE_FLASH_ATTR crc32(uint32_t crc, const uint8_t *data, uint16_t len)
+{
+    uint8_t i;
+
+    crc = ~crc;
+    while (len--) {
+	crc ^= *data++;
+	for (i = 0; i < 8; i++)
+	    crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static uint32_t ICACHE_FLASH_ATTR log_rec_crc(struct log_rec_hdr *hdr, const uint8_t *data)
+{
+    return crc32(crc32(0, (uint8_t *)hdr, 4), data, hdr->len);
+}
+
+// Reads the record at off into buf (hdr + data), returns false at free space or a broken record
+static bool ICACHE_FLASH_ATTR log_read_rec(uint16_t off, uint32_t *buf)
+{
+    struct log_rec_hdr *hdr = (struct log_rec_hdr *)buf;
+
+    if (off % SPI_FLASH_SEC_SIZE + sizeof(struct log_rec_hdr) > SPI_FLASH_SEC_SIZE)
+	return false;
+    spi_flash_read(log_addr(off), buf, sizeof(struct log_rec_hdr));
+    if (hdr->key >= LOG_MAX_KEYS || hdr->chunk >= LOG_MAX_CHUNKS || hdr->len > LOG_CHUNK ||
+	off % SPI_FLASH_SEC_SIZE + LOG_REC_SIZE(hdr->len) > SPI_FLASH_SEC_SIZE)
+	return false;
+    spi_flash_read(log_addr(off) + sizeof(struct log_rec_hdr), buf + sizeof(struct log_rec_hdr) / 4,
+		   (hdr->len + 3) & ~3);
+    return hdr->crc == log_rec_crc(hdr, (uint8_t *)(hdr + 1));
+}
+
+static void ICACHE_FLASH_ATTR log_write_rec(uint8_t key, uint8_t chunk, const uint8_t *data, uint16_t len)
+{
+    uint32_t buf[(sizeof(struct log_rec_hdr) + LOG_CHUNK) / 4];
+    struct log_rec_hdr *hdr = (struct log_rec_hdr *)buf;
+
+    if (log_wr + LOG_REC_SIZE(len) > (log_active + 1) * SPI_FLASH_SEC_SIZE)
+	return;
+    os_memset(buf, 0xff, sizeof(buf));
+    hdr->key = key;
+    hdr->chunk = chunk;
+    hdr->len = len;
+    os_memcpy(hdr + 1, data, len);
+    hdr->crc = log_rec_crc(hdr, data);
+    spi_flash_write(log_addr(log_wr), buf, LOG_REC_SIZE(len));
+    log_index[key][chunk] = log_wr;
+    log_wr += LOG_REC_SIZE(len);
+}
+
+static void ICACHE_FLASH_ATTR log_open_sector(uint8_t sector)
+{
+    struct log_sector_hdr hdr = { LOG_MAGIC, ++log_seq };
+
+    spi_flash_write(log_addr(sector * SPI_FLASH_SEC_SIZE), (uint32_t *)&hdr, sizeof(hdr));
+    log_active = sector;
+    log_wr = sector * SPI_FLASH_SEC_SIZE + sizeof(hdr);
+}
+
+// Copies the live records of the sector following the active one and erases it
+static void ICACHE_FLASH_ATTR log_reclaim_next(void)
+{
+    uint32_t buf[(sizeof(struct log_rec_hdr) + LOG_CHUNK) / 4];
+    struct log_rec_hdr *hdr = (struct log_rec_hdr *)buf;
+    uint8_t victim = (log_active + 1) % FLASH_LOG_SECTORS;
+    uint8_t key, chunk;
+    uint16_t off;
+
+    for (key = 0; key < LOG_MAX_KEYS; key++) {
+	for (chunk = 0; chunk < LOG_MAX_CHUNKS; chunk++) {
+	    off = log_index[key][chunk];
+	    if (off == LOG_NONE || off / SPI_FLASH_SEC_SIZE != victim)
+		continue;
+	    if (log_read_rec(off, buf))
+		log_write_rec(key, chunk, (uint8_t *)(hdr + 1), hdr->len);
+	    else
+		log_index[key][chunk] = LOG_NONE;
+	}
+    }
+    spi_flash_erase_sector(FLASH_LOG_START + victim);
+}
+
+static void ICACHE_FLASH_ATTR log_init(void)
+{
+    struct log_sector_hdr hdr[FLASH_LOG_SECTORS];
+    uint32_t buf[(sizeof(struct log_rec_hdr) + LOG_CHUNK) / 4];
+    struct log_rec_hdr *rec = (struct log_rec_hdr *)buf;
+    uint8_t i, s;
+    bool found = false;
+    uint16_t off;
+
+    if (log_ready)
+	return;
+    log_ready = true;
+    os_memset(log_index, 0xff, sizeof(log_index));
+
+    log_seq = 0;
+    for (s = 0; s < FLASH_LOG_SECTORS; s++) {
+	spi_flash_read(log_addr(s * SPI_FLASH_SEC_SIZE), (uint32_t *)&hdr[s], sizeof(hdr[s]));
+	if (hdr[s].magic != LOG_MAGIC)
+	    continue;
+	if (!found || hdr[s].seq > log_seq) {
+	    log_active = s;
+	    log_seq = hdr[s].seq;
+	}
+	found = true;
+    }
+
+    if (!found) {
+	os_printf("Formatting config log\r\n");
+	for (s = 0; s < FLASH_LOG_SECTORS; s++)
+	    spi_flash_erase_sector(FLASH_LOG_START + s);
+	log_open_sector(0);
+	return;
+    }
+
+    // Replay the sectors from the oldest to the active one, later records win
+    for (i = 1; i <= FLASH_LOG_SECTORS; i++) {
+	s = (log_active + i) % FLASH_LOG_SECTORS;
+	if (hdr[s].magic != LOG_MAGIC)
+	    continue;
+	for (off = s * SPI_FLASH_SEC_SIZE + sizeof(struct log_sector_hdr);
+	     log_read_rec(off, buf); off += LOG_REC_SIZE(rec->len))
+	    log_index[rec->key][rec->chunk] = off;
+	if (s == log_active)
+	    log_wr = off;
+    }
+
+    // A broken record (power loss while writing) ends the active sector
+    spi_flash_read(log_addr(log_wr), buf, sizeof(struct log_rec_hdr));
+    if (buf[0] != 0xffffffff || buf[1] != 0xffffffff)
+	log_wr = (log_active + 1) * SPI_FLASH_SEC_SIZE;
+
+    // The next sector has to be erased, finish an interrupted reclaim
+    s = (log_active + 1) % FLASH_LOG_SECTORS;
+    if (hdr[s].magic == LOG_MAGIC)
+	log_reclaim_next();
+    else if (hdr[s].magic != 0xffffffff)
+	spi_flash_erase_sector(FLASH_LOG_START + s);
+}
+
+static void ICACHE_FLASH_ATTR log_append(uint8_t key, uint8_t chunk, const uint8_t *data, uint16_t len)
+{
+    if (log_wr + LOG_REC_SIZE(len) > (log_active + 1) * SPI_FLASH_SEC_SIZE) {
+	log_open_sector((log_active + 1) % FLASH_LOG_SECTORS);
+	log_reclaim_next();
+    }
+    log_write_rec(key, chunk, data, len);
+}
+
+// Appends the chunks of data that differ from their stored version
+static void ICACHE_FLASH_ATTR log_store(uint8_t key, const uint8_t *data, uint16_t len)
+{
+    uint32_t buf[(sizeof(struct log_rec_hdr) + LOG_CHUNK) / 4];
+    struct log_rec_hdr *hdr = (struct log_rec_hdr *)buf;
+    uint8_t chunk;
+    uint16_t pos, n;
+
+    log_init();
+    for (chunk = 0, pos = 0; pos < len && chunk < LOG_MAX_CHUNKS; chunk++, pos += n) {
+	n = len - pos < LOG_CHUNK ? len - pos : LOG_CHUNK;
+	if (log_index[key][chunk] != LOG_NONE && log_read_rec(log_index[key][chunk], buf) &&
+	    hdr->len == n && os_memcmp(hdr + 1, data + pos, n) == 0)
+	    continue;
+	log_append(key, chunk, data + pos, n);
+    }
+}
+
+// Reads the latest version of an object, missing chunks are zeroed.
+// Returns false if nothing has been stored under key.
+static bool ICACHE_FLASH_ATTR log_fetch(uint8_t key, uint8_t *data, uint16_t len)
+{
+    uint32_t buf[(sizeof(struct log_rec_hdr) + LOG_CHUNK) / 4];
+    struct log_rec_hdr *hdr = (struct log_rec_hdr *)buf;
+    uint8_t chunk;
+    uint16_t pos, n;
+    bool found = false;
+
+    log_init();
+    for (chunk = 0, pos = 0; pos < len; chunk++, pos += n) {
+	n = len - pos < LOG_CHUNK ? len - pos : LOG_CHUNK;
+	os_memset(data + pos, 0, n);
+	if (chunk >= LOG_MAX_CHUNKS || log_index[key][chunk] == LOG_NONE ||
+	    !log_read_rec(log_index[key][chunk], buf))
+	    continue;
+	os_memcpy(data + pos, hdr + 1, hdr->len < n ? hdr->len : n);
+	found = true;
+    }
+    return found;
+}
+
 void config_load_default(sysconfig_p config)
 {
     os_memset(config, 0, sizeof(sysconfig_t));
@@ -33,16 +276,22 @@ void config_load_default(sysconfig_p config)
     IP4_ADDR(&config->ip_addr_peer, 192, 168, 240, 2);
     config->clock_speed			= 160;
     config->bit_rate                    = 115200;
+    config->slip_mode                   = SLIP_MODE_SLIP;
+    config->mss_clamp                   = 1460;
+    config->slip_mtu                    = 1500;
+    config->flow_ctrl                   = USART_HardwareFlowControl_None;
+    config->dns_cache                   = DNS_CACHE_DEFAULT;
+    config->nat_size                    = IP_NAPT_MAX;
+    config->portmap_size                = IP_PORTMAP_MAX;
+    bcast_filter_default(config->bcast_rules);
 }
 
 int config_load(sysconfig_p config)
 {
     if (config == NULL) return -1;
-    uint16_t base_address = FLASH_BLOCK_NO;
-
-    spi_flash_read(base_address* SPI_FLASH_SEC_SIZE, &config->magic_number, 4);
 
-    if((config->magic_number != MAGIC_NUMBER))
+    if (!log_fetch(LOG_KEY_CONFIG, (uint8_t *)config, sizeof(sysconfig_t)) ||
+	config->magic_number != MAGIC_NUMBER)
     {
         os_printf("\r\nNo config found, saving default in flash\r\n");
         config_load_default(config);
@@ -51,7 +300,6 @@ int config_load(sysconfig_p config)
     }
 
     os_printf("\r\nConfig found and loaded\r\n");
-    spi_flash_read(base_address * SPI_FLASH_SEC_SIZE, (uint32 *) config, sizeof(sysconfig_t));
     if (config->length != sizeof(sysconfig_t))
     {
         os_printf("Length Mismatch, probably old version of config, loading defaults\r\n");
@@ -64,33 +312,28 @@ int config_load(sysconfig_p config)
 
 void config_save(sysconfig_p config)
 {
-    uint16_t base_address = FLASH_BLOCK_NO;
     os_printf("Saving configuration\r\n");
-    spi_flash_erase_sector(base_address);
-    spi_flash_write(base_address * SPI_FLASH_SEC_SIZE, (uint32 *)config, sizeof(sysconfig_t));
+    log_store(LOG_KEY_CONFIG, (uint8_t *)config, sizeof(sysconfig_t));
 }
 
 void ICACHE_FLASH_ATTR blob_save(uint8_t blob_no, uint32_t *data, uint16_t len)
 {
-    uint16_t base_address = FLASH_BLOCK_NO + 1 + blob_no;
-    spi_flash_erase_sector(base_address);
-    spi_flash_write(base_address * SPI_FLASH_SEC_SIZE, data, len);
+    log_store(LOG_KEY_BLOB(blob_no), (uint8_t *)data, len);
 }
 
 void ICACHE_FLASH_ATTR blob_load(uint8_t blob_no, uint32_t *data, uint16_t len)
 {
-    uint16_t base_address = FLASH_BLOCK_NO + 1 + blob_no;
-    spi_flash_read(base_address * SPI_FLASH_SEC_SIZE, data, len);
+    log_fetch(LOG_KEY_BLOB(blob_no), (uint8_t *)data, len);
 }
 
 void ICACHE_FLASH_ATTR blob_zero(uint8_t blob_no, uint16_t len)
 {
-int i;
-    uint8_t z[len];
-    os_memset(z, 0,len);
-    uint16_t base_address = FLASH_BLOCK_NO + 1 + blob_no;
-    spi_flash_erase_sector(base_address);
-    spi_flash_write(base_address * SPI_FLASH_SEC_SIZE, (uint32_t *)z, len);
+    uint8_t *z = (uint8_t *)os_zalloc(len);
+
+    if (z == NULL)
+	return;
+    log_store(LOG_KEY_BLOB(blob_no), z, len);
+    os_free(z);
 }
 
 const uint8_t esp_init_data_default[] = {
@@ -0,0 +1,291 @@
+#include "c_types.h"
+#include "mem.h"
+#include "ets_sys.h"
+#include "osapi.h"
+#include "os_type.h"
+#include "lwip/app/espconn.h"
+
+#include "ringbuf.h"
+#include "console.h"
+#include "console_parse.h"
+#include "user_config.h"
+
+char INVALID_LOCKED[] = "Invalid command. Config locked\r\n";
+char INVALID_NUMARGS[] = "Invalid number of arguments\r\n";
+char INVALID_ARG[] = "Invalid argument\r\n";
+
+static ringbuf_t console_rx_buffer, console_tx_buffer;
+
+static const struct console_cmd *console_cmds;
+static uint8_t console_n_cmds;
+static bool (*console_is_locked)(void);
+
+static struct espconn *console_conn;
+static console_stream_fn stream_fn;
+static uint16_t stream_idx;
+static bool cmd_active;		// a command runs, the prompt is not sent yet
+static bool cmd_async;		// waiting for console_async_end()
+static uint8_t rx_lines;	// complete command lines in the RX buffer
+static bool sending;		// espconn_sent() done, waiting for the sent callback
+static bool quit;
+
+// State of the help stream
+static uint8_t help_cmd, help_sub;
+
+
+void ICACHE_FLASH_ATTR console_puts(const char *str)
+{
+    uint16_t len = os_strlen(str);
+
+    // The ring would overwrite unsent output, stream functions are only
+    // called with CONSOLE_LINE_MAX bytes free, so only oversized direct
+    // output of a handler can end up here
+    if (len > ringbuf_bytes_free(console_tx_buffer))
+	return;
+    ringbuf_memcpy_into(console_tx_buffer, str, len);
+}
+
+void ICACHE_FLASH_ATTR console_stream(console_stream_fn fn)
+{
+    // Late callback of an async command of a closed connection
+    if (!cmd_active)
+	return;
+    stream_fn = fn;
+    stream_idx = 0;
+}
+
+void ICACHE_FLASH_ATTR console_async_begin(void)
+{
+    cmd_async = true;
+}
+
+void ICACHE_FLASH_ATTR console_async_end(void)
+{
+    cmd_async = false;
+    system_os_post(0, SIG_CONSOLE_TX, 0);
+}
+
+void ICACHE_FLASH_ATTR console_quit(void)
+{
+    quit = true;
+}
+
+
+// Fills the ring from the stream of the current command and sends the next
+// chunk, if none is in flight. Called again from the sent callback.
+void ICACHE_FLASH_ATTR console_send(void)
+{
+    char payload[CONSOLE_SEND_CHUNK];
+    uint16_t len;
+
+    while (stream_fn != NULL && ringbuf_bytes_free(console_tx_buffer) >= CONSOLE_LINE_MAX) {
+	if (!stream_fn(stream_idx++))
+	    stream_fn = NULL;
+    }
+
+    if (cmd_active && stream_fn == NULL && !cmd_async &&
+	ringbuf_bytes_free(console_tx_buffer) >= 4) {
+	ringbuf_memcpy_into(console_tx_buffer, "CMD>", 4);
+	cmd_active = false;
+	if (rx_lines > 0)
+	    system_os_post(0, SIG_CONSOLE_RX, (ETSParam) console_conn);
+    }
+
+    if (sending || console_conn == NULL)
+	return;
+
+    len = ringbuf_bytes_used(console_tx_buffer);
+    if (len == 0) {
+	if (quit && !cmd_active) {
+	    quit = false;
+	    espconn_disconnect(console_conn);
+	}
+	return;
+    }
+
+    if (len > CONSOLE_SEND_CHUNK)
+	len = CONSOLE_SEND_CHUNK;
+    ringbuf_memcpy_from(payload, console_tx_buffer, len);
+    if (espconn_sent(console_conn, (uint8_t *)payload, len) == ESPCONN_OK)
+	sending = true;
+}
+
+
+static void ICACHE_FLASH_ATTR console_dispatch(const struct console_cmd *cmds, uint8_t n_cmds,
+					      char **tokens, int nTokens, int level)
+{
+    const struct console_cmd *cmd;
+
+    for (cmd = cmds; cmd < cmds + n_cmds; cmd++) {
+	if (strcmp(cmd->name, tokens[level]) != 0)
+	    continue;
+
+	if ((cmd->flags & CONSOLE_CMD_LOCKED) && console_is_locked()) {
+	    console_puts(INVALID_LOCKED);
+	} else if (nTokens < cmd->min_tokens || (cmd->sub != NULL && nTokens <= level + 1)) {
+	    console_puts(INVALID_NUMARGS);
+	} else if (cmd->sub != NULL) {
+	    console_dispatch(cmd->sub, cmd->n_sub, tokens, nTokens, level + 1);
+	} else {
+	    cmd->handler(tokens, nTokens);
+	}
+	return;
+    }
+
+    console_puts("\r\nInvalid Command\r\n");
+}
+
+void ICACHE_FLASH_ATTR console_handle_command(struct espconn *pespconn)
+{
+    char cmd_line[CONSOLE_RX_SIZE+1];
+    char *tokens[CONSOLE_MAX_TOKENS];
+
+    int nTokens, j;
+    char c;
+
+    console_conn = pespconn;
+
+    // One command at a time, the next lines wait in the RX buffer
+    if (cmd_active || rx_lines == 0)
+	return;
+    rx_lines--;
+
+    for (j = 0; !ringbuf_is_empty(console_rx_buffer); ) {
+	ringbuf_memcpy_from(&c, console_rx_buffer, 1);
+	if (c == '\n')
+	    break;
+	if (c != 8) {
+	   cmd_line[j++] = c;
+	} else {
+	   if (j > 0) j--;
+	}
+    }
+    cmd_line[j] = 0;
+    if (ringbuf_is_empty(console_rx_buffer))
+	rx_lines = 0;
+
+    nTokens = parse_str_into_tokens(cmd_line, tokens, CONSOLE_MAX_TOKENS);
+
+    cmd_active = true;
+    if (nTokens == 0)
+	console_puts("\n");
+    else
+	console_dispatch(console_cmds, console_n_cmds, tokens, nTokens, 0);
+
+    console_send();
+}
+
+
+// One line per command, subcommands are listed as "name [sub1|sub2|...] usage"
+// over as many lines as needed
+static bool ICACHE_FLASH_ATTR console_help_line(uint16_t idx)
+{
+    char line[CONSOLE_LINE_MAX];
+    const struct console_cmd *cmd;
+    uint16_t len, first;
+
+    if (idx == 0)
+	help_cmd = help_sub = 0;
+
+    while (help_cmd < console_n_cmds && console_cmds[help_cmd].usage == NULL)
+	help_cmd++;
+    if (help_cmd >= console_n_cmds)
+	return false;
+
+    cmd = &console_cmds[help_cmd];
+    len = os_sprintf(line, "%s", cmd->name);
+    if (cmd->sub != NULL) {
+	len += os_sprintf(line + len, " [");
+	for (first = help_sub; help_sub < cmd->n_sub; help_sub++) {
+	    if (help_sub != first &&
+		len + os_strlen(cmd->sub[help_sub].name) + os_strlen(cmd->usage) > 72)
+		break;
+	    len += os_sprintf(line + len, "%s%s", help_sub != first ? "|" : "",
+			      cmd->sub[help_sub].name);
+	}
+	len += os_sprintf(line + len, "]");
+    }
+    if (cmd->usage[0] != '\0')
+	len += os_sprintf(line + len, " %s", cmd->usage);
+    os_sprintf(line + len, "\r\n");
+    console_puts(line);
+
+    if (cmd->sub == NULL || help_sub >= cmd->n_sub) {
+	help_sub = 0;
+	help_cmd++;
+    }
+    return true;
+}
+
+void ICACHE_FLASH_ATTR console_cmd_help(char **tokens, int nTokens)
+{
+    console_stream(console_help_line);
+}
+
+
+static void ICACHE_FLASH_ATTR console_recv_cb(void *arg, char *data, unsigned short length)
+{
+    int            index;
+    uint8_t         ch;
+
+    for (index=0; index <length; index++)
+    {
+        ch = *(data+index);
+	ringbuf_memcpy_into(console_rx_buffer, &ch, 1);
+
+        // If a complete commandline is received, then signal the main
+        // task that command is available for processing
+        if (ch == '\n') {
+	    rx_lines++;
+            system_os_post(0, SIG_CONSOLE_RX, (ETSParam) arg);
+	}
+    }
+}
+
+static void ICACHE_FLASH_ATTR console_sent_cb(void *arg)
+{
+    sending = false;
+    console_send();
+}
+
+static void ICACHE_FLASH_ATTR console_discon_cb(void *arg)
+{
+    os_printf("console_discon_cb(): client disconnected\n");
+    console_conn = NULL;
+    stream_fn = NULL;
+    cmd_active = cmd_async = sending = quit = false;
+    rx_lines = 0;
+}
+
+/* Called when a client connects to the console server */
+void ICACHE_FLASH_ATTR console_connected_cb(void *arg)
+{
+    struct espconn *pespconn = (struct espconn *)arg;
+
+    os_printf("console_connected_cb(): Client connected\r\n");
+
+    espconn_regist_sentcb(pespconn,     console_sent_cb);
+    espconn_regist_disconcb(pespconn,   console_discon_cb);
+    espconn_regist_recvcb(pespconn,     console_recv_cb);
+    espconn_regist_time(pespconn,  300, 1);  // Specific to console only
+
+    ringbuf_reset(console_rx_buffer);
+    ringbuf_reset(console_tx_buffer);
+    console_conn = pespconn;
+    stream_fn = NULL;
+    cmd_active = cmd_async = sending = quit = false;
+    rx_lines = 0;
+
+    console_puts("CMD>");
+    console_send();
+}
+
+void ICACHE_FLASH_ATTR console_init(const struct console_cmd *cmds, uint8_t n_cmds, bool (*is_locked)(void))
+{
+    console_cmds = cmds;
+    console_n_cmds = n_cmds;
+    console_is_locked = is_locked;
+
+    console_rx_buffer = ringbuf_new(CONSOLE_RX_SIZE);
+    console_tx_buffer = ringbuf_new(MAX_CON_SEND_SIZE);
+}
@@ -0,0 +1,81 @@
+#include "c_types.h"
+#include "osapi.h"
+#include <ctype.h>
+
+#include "console_parse.h"
+
+// Similar to strtok
+int ICACHE_FLASH_ATTR parse_str_into_tokens(char *str, char **tokens, int max_tokens)
+{
+    char *p, *q, *end;
+    int token_count = 0;
+    bool in_token = false;
+
+    // preprocessing
+    for (p = q = str; *p != 0; p++)
+    {
+        if (*(p) == '%' && *(p + 1) != 0 && *(p + 2) != 0)
+        {
+            // quoted hex
+            uint8_t a;
+            p++;
+            if (*p <= '9')
+                a = *p - '0';
+            else
+                a = toupper(*p) - 'A' + 10;
+            a <<= 4;
+            p++;
+            if (*p <= '9')
+                a += *p - '0';
+            else
+                a += toupper(*p) - 'A' + 10;
+            *q++ = a;
+        }
+        else if (*p == '\\' && *(p + 1) != 0)
+        {
+            // next char is quoted - just copy it, skip this one
+            *q++ = *++p;
+        }
+        else if (*p == 8)
+        {
+            // backspace - delete previous char
+            if (q != str)
+                q--;
+        }
+        else if (*p <= ' ')
+        {
+            // mark this as whitespace
+            *q++ = 0;
+        }
+        else
+        {
+            *q++ = *p;
+        }
+    }
+
+    end = q;
+    *q = 0;
+
+    // cut into tokens
+    for (p = str; p != end; p++)
+    {
+        if (*p == 0)
+        {
+            if (in_token)
+            {
+                in_token = false;
+            }
+        }
+        else
+        {
+            if (!in_token)
+            {
+                tokens[token_count++] = p;
+                if (token_count == max_tokens)
+                    return token_count;
+                in_token = true;
+            }
+        }
+    }
+    return token_count;
+}
@@ -0,0 +1,432 @@
+#include "c_types.h"
+#include "mem.h"
+#include "ets_sys.h"
+#include "osapi.h"
+#include "os_type.h"
+#include "user_interface.h"
+#include "lwip/ip_addr.h"
+#include "lwip/netif.h"
+#include "lwip/app/espconn.h"
+
+#include "console.h"
+#include "dns_cache.h"
+
+#define DNS_PORT	53
+#define DNS_HDR_LEN	12
+#define DNS_TYPE_OPT	41
+
+// Flags in the second 16 bit word of the header
+#define DNS_FLAG_QR	0x8000
+#define DNS_FLAG_TC	0x0200
+#define DNS_OPCODE(f)	(((f) >> 11) & 0x0f)
+#define DNS_RCODE(f)	((f) & 0x0f)
+
+// Responses aren't cached if that would leave less heap
+#define DNS_CACHE_MIN_HEAP	8192
+
+struct dns_entry {
+    uint8_t	*msg;		// response, NULL: free
+    uint16_t	len;
+    uint16_t	qlen;		// length of the question behind the header
+    uint32_t	expires;	// dns_now
+    uint32_t	used;		// last hit, the least recently used one is replaced
+};
+
+struct dns_pending {
+    uint16_t	id;		// ID towards the server, 0: free
+    uint16_t	client_id;
+    uint8_t	client_ip[4];
+    int		client_port;
+    uint32_t	qhash;		// of the question, the response has to match it
+    uint8_t	age;		// s
+};
+
+struct dns_cache_stats dns_cache_stats;
+
+static struct espconn dns_srv, dns_up;
+static esp_udp dns_srv_udp, dns_up_udp;
+static os_timer_t dns_timer;
+static bool running;
+static struct netif *dns_only;
+static ip_addr_t dns_server;
+
+static struct dns_entry *cache;
+static uint8_t cache_size;
+static struct dns_pending pending[DNS_FWD_MAX];
+static uint32_t dns_now;	// s since start
+
+
+static inline uint16_t get16(const uint8_t *p)
+{
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static inline void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline uint8_t lower(uint8_t c)
+{
+    return c >= 'A' && c <= 'Z' ? c + 'a' - 'A' : c;
+}
+
+// Length of the question section of a query or response with a single question,
+// 0 if there is none or it is malformed (names in questions aren't compressed)
+static uint16_t ICACHE_FLASH_ATTR dns_question_len(const uint8_t *m, uint16_t len)
+{
+    uint16_t off = DNS_HDR_LEN;
+
+    if (len < DNS_HDR_LEN || get16(m + 4) != 1)
+	return 0;
+    while (off < len && m[off] != 0) {
+	if (m[off] & 0xc0)
+	    return 0;
+	off += m[off] + 1;
+    }
+    // root label, type and class
+    if (off + 5 > len)
+	return 0;
+    return off + 5 - DNS_HDR_LEN;
+}
+
+// Names are case insensitive, label lengths are below 'A'
+static uint32_t ICACHE_FLASH_ATTR dns_question_hash(const uint8_t *q, uint16_t qlen)
+{
+    uint32_t h = 2166136261UL;
+
+    while (qlen-- > 0)
+	h = (h ^ lower(*q++)) * 16777619UL;
+    return h;
+}
+
+static bool ICACHE_FLASH_ATTR dns_question_equal(const uint8_t *a, const uint8_t *b, uint16_t qlen)
+{
+    while (qlen-- > 0) {
+	if (lower(*a++) != lower(*b++))
+	    return false;
+    }
+    return true;
+}
+
+// Offset behind the (possibly compressed) name at off, 0 if malformed
+static uint16_t ICACHE_FLASH_ATTR dns_skip_name(const uint8_t *m, uint16_t len, uint16_t off)
+{
+    while (off < len) {
+	if (m[off] == 0)
+	    return off + 1;
+	if ((m[off] & 0xc0) == 0xc0)
+	    return off + 2 <= len ? off + 2 : 0;
+	if (m[off] & 0xc0)
+	    return 0;
+	off += m[off] + 1;
+    }
+    return 0;
+}
+
+// Walks all resource records (except OPT) of a response: with set, their TTL
+// is set to *ttl, otherwise *ttl gets the smallest one. false if malformed.
+static bool ICACHE_FLASH_ATTR dns_ttls(uint8_t *m, uint16_t len, uint16_t qlen, uint32_t *ttl, bool set)
+{
+    uint16_t off = DNS_HDR_LEN + qlen;
+    uint32_t n, t;
+
+    n = (uint32_t)get16(m + 6) + get16(m + 8) + get16(m + 10);
+    if (!set)
+	*ttl = DNS_CACHE_MAX_TTL;
+    while (n-- > 0) {
+	off = dns_skip_name(m, len, off);
+	if (off == 0 || off + 10 > len)
+	    return false;
+	if (get16(m + off) != DNS_TYPE_OPT) {
+	    if (set) {
+		put16(m + off + 4, *ttl >> 16);
+		put16(m + off + 6, *ttl);
+	    } else {
+		t = ((uint32_t)get16(m + off + 4) << 16) | get16(m + off + 6);
+		if (t < *ttl)
+		    *ttl = t;
+	    }
+	}
+	off += 10 + get16(m + off + 8);
+	if (off > len)
+	    return false;
+    }
+    return true;
+}
+
+static void ICACHE_FLASH_ATTR dns_entry_free(struct dns_entry *e)
+{
+    os_free(e->msg);
+    e->msg = NULL;
+}
+
+static struct dns_entry * ICACHE_FLASH_ATTR dns_cache_find(const uint8_t *q, uint16_t qlen)
+{
+    uint8_t i;
+
+    for (i = 0; i < cache_size; i++) {
+	if (cache[i].msg != NULL && cache[i].qlen == qlen && dns_now < cache[i].expires &&
+	    dns_question_equal(cache[i].msg + DNS_HDR_LEN, q, qlen))
+	    return &cache[i];
+    }
+    return NULL;
+}
+
+static void ICACHE_FLASH_ATTR dns_cache_add(uint8_t *m, uint16_t len, uint16_t qlen)
+{
+    struct dns_entry *e, *victim = NULL;
+    uint16_t flags = get16(m + 2);
+    uint32_t ttl;
+    uint8_t i;
+
+    if (cache_size == 0 || len > DNS_CACHE_MAX_MSG || (flags & DNS_FLAG_TC) ||
+	DNS_RCODE(flags) != 0 || get16(m + 6) == 0)
+	return;
+    if (!dns_ttls(m, len, qlen, &ttl, false) || ttl == 0)
+	return;
+
+    // an old response to the same question, a free or the least recently used entry
+    for (i = 0; i < cache_size; i++) {
+	e = &cache[i];
+	if (e->msg != NULL && e->qlen == qlen && dns_question_equal(e->msg + DNS_HDR_LEN, m + DNS_HDR_LEN, qlen)) {
+	    victim = e;
+	    break;
+	}
+	if (victim == NULL || (victim->msg != NULL && (e->msg == NULL || e->used < victim->used)))
+	    victim = e;
+    }
+    if (victim->msg != NULL)
+	dns_entry_free(victim);
+    if (system_get_free_heap_size() < DNS_CACHE_MIN_HEAP + len)
+	return;
+    victim->msg = (uint8_t *)os_malloc(len);
+    if (victim->msg == NULL)
+	return;
+    os_memcpy(victim->msg, m, len);
+    victim->len = len;
+    victim->qlen = qlen;
+    victim->expires = dns_now + ttl;
+    victim->used = dns_now;
+}
+
+static bool ICACHE_FLASH_ATTR dns_client_ok(uint8_t *ip)
+{
+    ip_addr_t addr;
+
+    if (dns_only == NULL)
+	return true;
+    os_memcpy(&addr.addr, ip, 4);
+    return ip_addr_netcmp(&addr, &dns_only->ip_addr, &dns_only->netmask);
+}
+
+static void ICACHE_FLASH_ATTR dns_reply(uint8_t *ip, int port, uint8_t *m, uint16_t len)
+{
+    os_memcpy(dns_srv_udp.remote_ip, ip, 4);
+    dns_srv_udp.remote_port = port;
+    espconn_sent(&dns_srv, m, len);
+}
+
+static struct dns_pending * ICACHE_FLASH_ATTR dns_pending_find(uint16_t id)
+{
+    uint8_t i;
+
+    for (i = 0; i < DNS_FWD_MAX; i++) {
+	if (pending[i].id != 0 && pending[i].id == id)
+	    return &pending[i];
+    }
+    return NULL;
+}
+
+// Query from a client
+static void ICACHE_FLASH_ATTR dns_srv_recv_cb(void *arg, char *data, unsigned short length)
+{
+    uint8_t *m = (uint8_t *)data;
+    remot_info *premot = NULL;
+    struct dns_entry *e;
+    struct dns_pending *p = NULL;
+    uint16_t qlen, id;
+    uint32_t ttl;
+    uint8_t i;
+
+    if (espconn_get_connection_info(&dns_srv, &premot, 0) != ESPCONN_OK ||
+	!dns_client_ok(premot->remote_ip))
+	return;
+    dns_cache_stats.queries++;
+
+    qlen = dns_question_len(m, length);
+    if (qlen == 0 || (get16(m + 2) & DNS_FLAG_QR) || DNS_OPCODE(get16(m + 2)) != 0) {
+	dns_cache_stats.dropped++;
+	return;
+    }
+
+    e = dns_cache_find(m + DNS_HDR_LEN, qlen);
+    if (e != NULL) {
+	dns_cache_stats.hits++;
+	e->used = dns_now;
+	ttl = e->expires - dns_now;
+	dns_ttls(e->msg, e->len, e->qlen, &ttl, true);
+	// the question as asked, the case of its letters may differ
+	os_memcpy(e->msg, m, 2);
+	os_memcpy(e->msg + DNS_HDR_LEN, m + DNS_HDR_LEN, qlen);
+	dns_reply(premot->remote_ip, premot->remote_port, e->msg, e->len);
+	return;
+    }
+
+    for (i = 0; i < DNS_FWD_MAX && p == NULL; i++) {
+	if (pending[i].id == 0)
+	    p = &pending[i];
+    }
+    if (p == NULL || dns_server.addr == 0) {
+	dns_cache_stats.dropped++;
+	return;
+    }
+
+    do {
+	id = os_random();
+    } while (id == 0 || dns_pending_find(id) != NULL);
+    p->id = id;
+    p->client_id = get16(m);
+    os_memcpy(p->client_ip, premot->remote_ip, 4);
+    p->client_port = premot->remote_port;
+    p->qhash = dns_question_hash(m + DNS_HDR_LEN, qlen);
+    p->age = 0;
+
+    put16(m, id);
+    if (espconn_sent(&dns_up, m, length) == ESPCONN_OK) {
+	dns_cache_stats.forwarded++;
+    } else {
+	p->id = 0;
+	dns_cache_stats.dropped++;
+    }
+}
+
+// Response from the upstream server
+static void ICACHE_FLASH_ATTR dns_up_recv_cb(void *arg, char *data, unsigned short length)
+{
+    uint8_t *m = (uint8_t *)data;
+    remot_info *premot = NULL;
+    struct dns_pending *p;
+    uint16_t qlen;
+
+    if (espconn_get_connection_info(&dns_up, &premot, 0) != ESPCONN_OK ||
+	os_memcmp(premot->remote_ip, &dns_server.addr, 4) != 0 || premot->remote_port != DNS_PORT)
+	return;
+    if (length < DNS_HDR_LEN || !(get16(m + 2) & DNS_FLAG_QR))
+	return;
+    p = dns_pending_find(get16(m));
+    if (p == NULL)
+	return;
+    qlen = dns_question_len(m, length);
+    if (qlen == 0 || dns_question_hash(m + DNS_HDR_LEN, qlen) != p->qhash)
+	return;
+
+    put16(m, p->client_id);
+    dns_reply(p->client_ip, p->client_port, m, length);
+    p->id = 0;
+    dns_cache_add(m, length, qlen);
+}
+
+static void ICACHE_FLASH_ATTR dns_timer_cb(void *arg)
+{
+    uint8_t i;
+
+    dns_now++;
+    for (i = 0; i < DNS_FWD_MAX; i++) {
+	if (pending[i].id != 0 && ++pending[i].age >= DNS_FWD_TIMEOUT_S) {
+	    pending[i].id = 0;
+	    dns_cache_stats.timeouts++;
+	}
+    }
+    for (i = 0; i < cache_size; i++) {
+	if (cache[i].msg != NULL && dns_now >= cache[i].expires)
+	    dns_entry_free(&cache[i]);
+    }
+}
+
+bool ICACHE_FLASH_ATTR dns_cache_start(uint8_t entries, struct netif *only)
+{
+    dns_cache_stop();
+    if (entries == 0)
+	return true;
+    if (entries > DNS_CACHE_MAX)
+	entries = DNS_CACHE_MAX;
+
+    cache = (struct dns_entry *)os_zalloc(entries * sizeof(struct dns_entry));
+    if (cache == NULL)
+	return false;
+    cache_size = entries;
+    dns_only = only;
+    os_memset(pending, 0, sizeof(pending));
+
+    os_memset(&dns_srv, 0, sizeof(dns_srv));
+    os_memset(&dns_srv_udp, 0, sizeof(dns_srv_udp));
+    dns_srv.type = ESPCONN_UDP;
+    dns_srv.proto.udp = &dns_srv_udp;
+    dns_srv_udp.local_port = DNS_PORT;
+    espconn_regist_recvcb(&dns_srv, dns_srv_recv_cb);
+    espconn_create(&dns_srv);
+
+    os_memset(&dns_up, 0, sizeof(dns_up));
+    os_memset(&dns_up_udp, 0, sizeof(dns_up_udp));
+    dns_up.type = ESPCONN_UDP;
+    dns_up.proto.udp = &dns_up_udp;
+    dns_up_udp.local_port = espconn_port();
+    dns_up_udp.remote_port = DNS_PORT;
+    os_memcpy(dns_up_udp.remote_ip, &dns_server.addr, 4);
+    espconn_regist_recvcb(&dns_up, dns_up_recv_cb);
+    espconn_create(&dns_up);
+
+    running = true;
+    os_timer_disarm(&dns_timer);
+    os_timer_setfn(&dns_timer, dns_timer_cb, NULL);
+    os_timer_arm(&dns_timer, 1000, 1);
+    return true;
+}
+
+void ICACHE_FLASH_ATTR dns_cache_stop(void)
+{
+    uint8_t i;
+
+    if (!running)
+	return;
+    running = false;
+
+    os_timer_disarm(&dns_timer);
+    espconn_delete(&dns_srv);
+    espconn_delete(&dns_up);
+    for (i = 0; i < cache_size; i++)
+	os_free(cache[i].msg);
+    os_free(cache);
+    cache = NULL;
+    cache_size = 0;
+}
+
+void ICACHE_FLASH_ATTR dns_cache_set_server(ip_addr_t *server)
+{
+    dns_server = *server;
+    os_memcpy(dns_up_udp.remote_ip, &dns_server.addr, 4);
+}
+
+bool ICACHE_FLASH_ATTR dns_cache_show_line(uint16_t idx)
+{
+    char response[CONSOLE_LINE_MAX];
+    uint8_t i, used = 0;
+
+    if (idx > 0)
+	return false;
+    if (!running) {
+	console_puts("DNS proxy off\r\n");
+	return false;
+    }
+    for (i = 0; i < cache_size; i++) {
+	if (cache[i].msg != NULL)
+	    used++;
+    }
+    os_sprintf(response, "DNS cache: %d/%d entries, %d queries, %d hits, %d fwd, %d timeouts, %d dropped\r\n",
+       used, cache_size, dns_cache_stats.queries, dns_cache_stats.hits, dns_cache_stats.forwarded,
+       dns_cache_stats.timeouts, dns_cache_stats.dropped);
+    console_puts(response);
+    return true;
+}
@@ -0,0 +1,263 @@
+#include "c_types.h"
+#include "osapi.h"
+#include "user_interface.h"
+
+#include "lwip/pbuf.h"
+#include "lwip/netif.h"
+#include "lwip/ip.h"
+#include "lwip/icmp.h"
+#include "lwip/inet_chksum.h"
+#include "lwip/lwip_napt.h"
+
+#include "ip_fwd.h"
+
+#define IPPROTO_ICMP_	1
+#define IPPROTO_TCP_	6
+#define IPPROTO_UDP_	17
+#define IP_DF_		0x4000
+#define IP_OFFMASK_	0x1fff
+#define TH_SYN		0x02
+#define TCPOPT_EOL	0
+#define TCPOPT_NOP	1
+#define TCPOPT_MSS	2
+
+struct ip_fwd_stats ip_fwd_stats;
+
+static struct netif *napt_inside;
+static uint32_t napt_outside;
+static uint32_t icmp_window_start;
+static uint8_t icmp_in_window;
+
+extern void __real_icmp_dest_unreach(struct pbuf *p, enum icmp_dur_type t);
+extern void __real_ip_napt_init(uint16_t max_nat, uint8_t max_portmap);
+
+static inline uint16_t get16(const uint8_t *p)
+{
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static inline void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+// Incremental update of a ones-complement checksum when a 16 bit word changes (RFC 1624)
+static uint16_t ICACHE_FLASH_ATTR chksum_adjust(uint16_t sum, uint16_t old_val, uint16_t new_val)
+{
+    uint32_t s = (uint16_t)~sum + (uint16_t)~old_val + new_val;
+
+    s = (s & 0xffff) + (s >> 16);
+    s = (s & 0xffff) + (s >> 16);
+    return ~s;
+}
+
+bool ICACHE_FLASH_ATTR ip_fwd_mss_clamp(struct pbuf *p, uint16_t mss)
+{
+    uint8_t *ip = (uint8_t *)p->payload;
+    uint8_t *th, *opt;
+    uint16_t ihl, thl, i, old_mss, old_w, new_w;
+
+    // Only first fragments of TCP packets with the headers in the first pbuf
+    if (p->len < 40 || (ip[0] >> 4) != 4 || ip[9] != IPPROTO_TCP_ || (get16(ip + 6) & 0x1fff))
+	return false;
+    ihl = (ip[0] & 0x0f) << 2;
+    if (ihl < 20 || p->len < ihl + 20)
+	return false;
+    th = ip + ihl;
+    if (!(th[13] & TH_SYN))
+	return false;
+    thl = (th[12] >> 4) << 2;
+    if (thl <= 20 || p->len < ihl + thl)
+	return false;
+
+    opt = th + 20;
+    for (i = 0; i < thl - 20; ) {
+	if (opt[i] == TCPOPT_EOL)
+	    break;
+	if (opt[i] == TCPOPT_NOP) {
+	    i++;
+	    continue;
+	}
+	if (i + 1 >= thl - 20 || opt[i + 1] < 2 || i + opt[i + 1] > thl - 20)
+	    break;
+	if (opt[i] == TCPOPT_MSS && opt[i + 1] == 4) {
+	    old_mss = get16(&opt[i + 2]);
+	    if (old_mss <= mss)
+		return false;
+	    put16(&opt[i + 2], mss);
+
+	    // The value is at an odd offset in the segment if i is odd, then its bytes
+	    // are summed up swapped
+	    old_w = (i & 1) ? (old_mss >> 8) | (old_mss << 8) : old_mss;
+	    new_w = (i & 1) ? (mss >> 8) | (mss << 8) : mss;
+	    put16(th + 16, chksum_adjust(get16(th + 16), old_w, new_w));
+
+	    ip_fwd_stats.mss_clamped++;
+	    return true;
+	}
+	i += opt[i + 1];
+    }
+    return false;
+}
+
+static bool ICACHE_FLASH_ATTR icmp_rate_ok(void)
+{
+    uint32_t now = system_get_time();
+
+    if (now - icmp_window_start >= 1000000) {
+	icmp_window_start = now;
+	icmp_in_window = 0;
+    }
+    if (icmp_in_window >= IP_FWD_ICMP_RATE) {
+	ip_fwd_stats.icmp_limited++;
+	return false;
+    }
+    icmp_in_window++;
+    return true;
+}
+
+static bool ICACHE_FLASH_ATTR is_local_addr(ip_addr_t *addr)
+{
+    struct netif *nif;
+
+    for (nif = netif_list; nif != NULL; nif = nif->next) {
+	if (ip_addr_cmp(addr, &nif->ip_addr))
+	    return true;
+    }
+    return false;
+}
+
+// Undoes the NAPT translation of the destination in the quoted IP header
+static void ICACHE_FLASH_ATTR quote_unnat(uint8_t *ip, uint16_t ihl)
+{
+    ip_addr_t src, dst;
+    struct portmap_table *pm;
+    uint16_t dport, csum;
+    uint8_t i;
+
+    os_memcpy(&src.addr, ip + 12, 4);
+    os_memcpy(&dst.addr, ip + 16, 4);
+    if (napt_inside == NULL || napt_outside == 0 ||
+	!ip_addr_netcmp(&dst, &napt_inside->ip_addr, &napt_inside->netmask) ||
+	ip_addr_netcmp(&src, &napt_inside->ip_addr, &napt_inside->netmask))
+	return;
+
+    // a portmap tells the external port, the NAPT keeps the port of the
+    // inside host where it can
+    if (ip[9] == IPPROTO_TCP_ || ip[9] == IPPROTO_UDP_) {
+	dport = get16(ip + ihl + 2);
+	for (i = 0; i < ip_portmap_max; i++) {
+	    pm = &ip_portmap_table[i];
+	    if (pm->valid && pm->proto == ip[9] && pm->daddr == dst.addr && ntohs(pm->dport) == dport) {
+		put16(ip + ihl + 2, ntohs(pm->mport));
+		break;
+	    }
+	}
+    }
+    os_memcpy(ip + 16, &napt_outside, 4);
+    put16(ip + 10, 0);
+    csum = inet_chksum(ip, ihl);
+    os_memcpy(ip + 10, &csum, 2);
+}
+
+static bool ICACHE_FLASH_ATTR send_frag_needed(struct pbuf *p, uint16_t mtu)
+{
+    uint8_t *ip = (uint8_t *)p->payload;
+    uint8_t *icmp, type;
+    uint16_t ihl, csum;
+    ip_addr_t src, dst;
+    struct pbuf *q;
+
+    ihl = (ip[0] & 0x0f) << 2;
+    os_memcpy(&src.addr, ip + 12, 4);
+    os_memcpy(&dst.addr, ip + 16, 4);
+
+    // No errors about non-first fragments, ICMP errors, own or non-unicast packets (RFC 1122)
+    if (p->len < ihl + 8 || (get16(ip + 6) & IP_OFFMASK_) ||
+	ip_addr_isany(&src) || ip_addr_ismulticast(&src) || ip_addr_ismulticast(&dst) ||
+	is_local_addr(&src))
+	return false;
+    if (ip[9] == IPPROTO_ICMP_) {
+	type = ip[ihl];
+	if (type != ICMP_ECHO && type != ICMP_ER)
+	    return false;
+    }
+    if (!icmp_rate_ok())
+	return false;
+
+    q = pbuf_alloc(PBUF_IP, 8 + ihl + 8, PBUF_RAM);
+    if (q == NULL)
+	return false;
+    icmp = (uint8_t *)q->payload;
+    icmp[0] = ICMP_DUR;
+    icmp[1] = ICMP_DUR_FRAG;
+    put16(icmp + 2, 0);
+    put16(icmp + 4, 0);
+    put16(icmp + 6, mtu);
+    // the IP header and the first 8 bytes of data, as the sender sent them
+    os_memcpy(icmp + 8, ip, ihl + 8);
+    quote_unnat(icmp + 8, ihl);
+    csum = inet_chksum(icmp, q->len);
+    os_memcpy(icmp + 2, &csum, 2);
+
+    ip_output(q, NULL, &src, ICMP_TTL, 0, IP_PROTO_ICMP);
+    pbuf_free(q);
+    ip_fwd_stats.frag_needed++;
+    return true;
+}
+
+bool ICACHE_FLASH_ATTR ip_fwd_too_big(struct pbuf *p, uint16_t mtu)
+{
+    uint8_t *ip = (uint8_t *)p->payload;
+
+    ip_fwd_stats.too_big++;
+    if (p->len < 20 || (ip[0] >> 4) != 4 || !(get16(ip + 6) & IP_DF_))
+	return false;
+    return send_frag_needed(p, mtu);
+}
+
+void ICACHE_FLASH_ATTR ip_fwd_set_napt(struct netif *inside, uint32_t outside)
+{
+    napt_inside = inside;
+    napt_outside = outside;
+}
+
+// Linked with --wrap=icmp_dest_unreach: the "fragmentation needed" of lwIP's
+// ip_forward() has no next-hop MTU in it, it is replaced by ours
+void ICACHE_FLASH_ATTR __wrap_icmp_dest_unreach(struct pbuf *p, enum icmp_dur_type t)
+{
+    struct netif *nif;
+    ip_addr_t dst;
+
+    if (t != ICMP_DUR_FRAG || p->len < 20) {
+	__real_icmp_dest_unreach(p, t);
+	return;
+    }
+    os_memcpy(&dst.addr, (uint8_t *)p->payload + 16, 4);
+    nif = ip_route(&dst);
+    if (nif != NULL)
+	ip_fwd_too_big(p, nif->mtu);
+}
+
+// Linked with --wrap=ip_napt_init: lwip_init() runs before the config is
+// loaded, the tables are allocated by ip_fwd_napt_init() instead
+void ICACHE_FLASH_ATTR __wrap_ip_napt_init(uint16_t max_nat, uint8_t max_portmap)
+{
+}
+
+uint16_t ICACHE_FLASH_ATTR ip_fwd_napt_init(uint16_t nat, uint8_t portmap)
+{
+    uint32_t heap = system_get_free_heap_size();
+    uint32_t pm_size = (uint32_t)portmap * sizeof(struct portmap_table);
+
+    if (ip_napt_max != 0)
+	return ip_napt_max;
+    while (nat > IP_FWD_NAT_MIN &&
+	   (uint32_t)nat * sizeof(struct napt_table) + pm_size + IP_FWD_NAPT_HEAP > heap)
+	nat /= 2;
+    if (nat < IP_FWD_NAT_MIN)
+	nat = IP_FWD_NAT_MIN;
+    __real_ip_napt_init(nat, portmap);
+    return nat;
+}
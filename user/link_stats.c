@@ -0,0 +1,209 @@
+#include "c_types.h"
+#include "osapi.h"
+#include "os_type.h"
+#include "lwip/pbuf.h"
+#include "lwip/netif.h"
+#include "driver/uart.h"
+
+#include "console.h"
+#include "link_stats.h"
+#include "ip_fwd.h"
+
+// Snapshots 1 s apart covering 10 s, and 10 s apart covering 60 s
+#define LINK_HIST_1S	11
+#define LINK_HIST_10S	7
+
+// WiFi interfaces of the SDK: 0 STA, 1 AP
+#define LINK_WIFI_IFS	2
+
+struct link_hist {
+    uint32_t	(*snap)[LINK_IFS][LINK_CTRS];
+    uint8_t	size;
+    uint8_t	n;	// valid snapshots
+    uint8_t	pos;	// next one to write
+};
+
+struct link_hook {
+    struct netif	*nif;
+    netif_input_fn	input;
+    netif_output_fn	output;
+};
+
+// NAPT state in liblwip_open_napt.a
+extern int nr_active_napt_tcp, nr_active_napt_udp, nr_active_napt_icmp;
+
+extern struct netif *eagle_lwip_getif(uint8_t index);
+extern struct pbuf *__real_pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type);
+
+struct link_stats link_stats;
+
+static uint32_t snap_1s[LINK_HIST_1S][LINK_IFS][LINK_CTRS];
+static uint32_t snap_10s[LINK_HIST_10S][LINK_IFS][LINK_CTRS];
+static struct link_hist hist_1s = { snap_1s, LINK_HIST_1S };
+static struct link_hist hist_10s = { snap_10s, LINK_HIST_10S };
+static uint8_t ticks;
+static os_timer_t link_timer;
+
+static struct link_hook hooks[LINK_WIFI_IFS];
+
+
+// Linked with --wrap=pbuf_alloc, all callers end up here
+struct pbuf *__wrap_pbuf_alloc(pbuf_layer layer, u16_t length, pbuf_type type)
+{
+    struct pbuf *p = __real_pbuf_alloc(layer, length, type);
+
+    if (p == NULL)
+	link_stats.pbuf_alloc_fails++;
+    return p;
+}
+
+static struct link_hook * ICACHE_FLASH_ATTR link_hook_find(struct netif *nif)
+{
+    uint8_t i;
+
+    for (i = 0; i < LINK_WIFI_IFS; i++) {
+	if (hooks[i].nif == nif)
+	    return &hooks[i];
+    }
+    return NULL;
+}
+
+static err_t ICACHE_FLASH_ATTR link_wifi_input(struct pbuf *p, struct netif *inp)
+{
+    struct link_hook *h = link_hook_find(inp);
+
+    if (h == NULL) {
+	pbuf_free(p);
+	return ERR_IF;
+    }
+    link_stats_in(LINK_IF_WIFI, p->tot_len);
+    return h->input(p, inp);
+}
+
+static err_t ICACHE_FLASH_ATTR link_wifi_output(struct netif *netif, struct pbuf *p, ip_addr_t *ipaddr)
+{
+    struct link_hook *h = link_hook_find(netif);
+
+    if (h == NULL)
+	return ERR_IF;
+    link_stats_out(LINK_IF_WIFI, p->tot_len);
+    return h->output(netif, p, ipaddr);
+}
+
+static void ICACHE_FLASH_ATTR link_hook_wifi(void)
+{
+    struct netif *nif;
+    uint8_t i;
+
+    for (i = 0; i < LINK_WIFI_IFS; i++) {
+	nif = eagle_lwip_getif(i);
+	if (nif == NULL || (nif == hooks[i].nif && nif->input == link_wifi_input))
+	    continue;
+	// new or re-initialized interface
+	hooks[i].nif = nif;
+	hooks[i].input = nif->input;
+	hooks[i].output = nif->output;
+	nif->input = link_wifi_input;
+	nif->output = link_wifi_output;
+    }
+}
+
+static void ICACHE_FLASH_ATTR link_hist_add(struct link_hist *h)
+{
+    os_memcpy(h->snap[h->pos], link_stats.ctr, sizeof(link_stats.ctr));
+    h->pos = (h->pos + 1) % h->size;
+    if (h->n < h->size)
+	h->n++;
+}
+
+// Per second difference between the newest snapshot and the one back steps
+// before it (or the oldest one), snapshots are step_s apart
+static uint32_t ICACHE_FLASH_ATTR link_hist_rate(struct link_hist *h, uint8_t back, uint8_t step_s,
+						 enum link_if i, enum link_ctr c)
+{
+    uint8_t newest, old;
+
+    if (h->n == 0)
+	return 0;
+    if (back > h->n - 1)
+	back = h->n - 1;
+    if (back == 0)
+	return 0;
+    newest = (h->pos + h->size - 1) % h->size;
+    old = (newest + h->size - back) % h->size;
+    return (h->snap[newest][i][c] - h->snap[old][i][c]) / ((uint32_t)back * step_s);
+}
+
+static void ICACHE_FLASH_ATTR link_timer_cb(void *arg)
+{
+    link_hist_add(&hist_1s);
+    if (ticks == 0)
+	link_hist_add(&hist_10s);
+    if (++ticks == 10)
+	ticks = 0;
+    link_hook_wifi();
+}
+
+void ICACHE_FLASH_ATTR link_stats_init(void)
+{
+    link_hook_wifi();
+    link_timer_cb(NULL);
+    os_timer_disarm(&link_timer);
+    os_timer_setfn(&link_timer, link_timer_cb, NULL);
+    os_timer_arm(&link_timer, 1000, 1);
+}
+
+uint32_t ICACHE_FLASH_ATTR link_stats_rate(enum link_if i, enum link_ctr c, enum link_window w)
+{
+    switch (w) {
+    case LINK_WIN_1S:
+	return link_hist_rate(&hist_1s, 1, 1, i, c);
+    case LINK_WIN_10S:
+	return link_hist_rate(&hist_1s, 10, 1, i, c);
+    default:
+	return link_hist_rate(&hist_10s, 6, 10, i, c);
+    }
+}
+
+void ICACHE_FLASH_ATTR link_stats_check_napt(void)
+{
+    if (ip_napt_max != 0 &&
+	nr_active_napt_tcp + nr_active_napt_udp + nr_active_napt_icmp >= ip_napt_max)
+	link_stats.napt_full++;
+}
+
+bool ICACHE_FLASH_ATTR link_stats_show_line(uint16_t idx)
+{
+    static const char *if_names[LINK_IFS] = { "SLIP", "WiFi" };
+    char response[CONSOLE_LINE_MAX];
+    enum link_if i;
+    bool out;
+
+    if (idx == 0) {
+	console_puts("Rates 1 s/10 s/60 s:\r\n");
+	return true;
+    }
+    if (idx <= LINK_IFS * 2) {
+	i = (idx - 1) / 2;
+	out = (idx - 1) % 2;
+	os_sprintf(response, "%s %s: %d/%d/%d pkt/s, %d/%d/%d B/s, total %d pkts\r\n",
+	   if_names[i], out ? "out" : "in",
+	   link_stats_rate(i, out ? LINK_PKTS_OUT : LINK_PKTS_IN, LINK_WIN_1S),
+	   link_stats_rate(i, out ? LINK_PKTS_OUT : LINK_PKTS_IN, LINK_WIN_10S),
+	   link_stats_rate(i, out ? LINK_PKTS_OUT : LINK_PKTS_IN, LINK_WIN_60S),
+	   link_stats_rate(i, out ? LINK_BYTES_OUT : LINK_BYTES_IN, LINK_WIN_1S),
+	   link_stats_rate(i, out ? LINK_BYTES_OUT : LINK_BYTES_IN, LINK_WIN_10S),
+	   link_stats_rate(i, out ? LINK_BYTES_OUT : LINK_BYTES_IN, LINK_WIN_60S),
+	   link_stats.ctr[i][out ? LINK_PKTS_OUT : LINK_PKTS_IN]);
+    } else if (idx == LINK_IFS * 2 + 1) {
+	os_sprintf(response, "UART: framing errors %d, RX FIFO overflows %d, RX ring full %d, TX ring full %d\r\n",
+	   uart_stats.frm_err, uart_stats.rx_ovf, uart_stats.rx_throttled, uart_stats.tx_drops);
+    } else if (idx == LINK_IFS * 2 + 2) {
+	os_sprintf(response, "Drops: bad SLIP frames %d, pbuf alloc failed %d, NAPT table full %d\r\n",
+	   link_stats.slip_bad_frames, link_stats.pbuf_alloc_fails, link_stats.napt_full);
+    } else {
+	return false;
+    }
+    console_puts(response);
+    return true;
+}
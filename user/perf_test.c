@@ -0,0 +1,446 @@
+#include "c_types.h"
+#include "mem.h"
+#include "ets_sys.h"
+#include "osapi.h"
+#include "os_type.h"
+#include "user_interface.h"
+#include "lwip/ip_addr.h"
+#include "lwip/netif.h"
+#include "lwip/app/espconn.h"
+
+#include "console.h"
+#include "perf_test.h"
+#include "user_config.h"
+
+#ifdef ALLOW_PERF_TEST
+
+// Chunk written to a chargen connection at a time
+#define PERF_CHARGEN_CHUNK	1460
+
+// Blaster timer, packets due are sent in bursts of at most PERF_UDP_BURST
+#define PERF_UDP_TICK_MS	10
+#define PERF_UDP_BURST		32
+
+// CPU idle slice, gaps in the spin loop longer than PERF_IDLE_GAP_US were
+// spent in interrupts
+#define PERF_IDLE_SLICE_US	100
+#define PERF_IDLE_GAP_US	5
+
+extern struct netif sl_netif;
+
+struct perf_stats perf_stats;
+
+struct perf_conn {
+    struct espconn	*conn;
+    uint8_t		remote_ip[4];
+    int			remote_port;
+    uint8_t		leg;
+    bool		chargen;
+    bool		sending;	// chunk handed to espconn, waiting for the sent callback
+};
+
+static bool running;
+static struct perf_conn conns[PERF_MAX_CONN];
+static uint8_t *chargen_buf;
+
+static struct espconn discard_srv, chargen_srv, udp_sink;
+static esp_tcp discard_tcp, chargen_tcp;
+static esp_udp udp_sink_udp;
+static int32_t udp_expect[PERF_LEGS];	// next iperf sequence number per leg
+
+// UDP blaster
+static struct espconn udp_tx;
+static esp_udp udp_tx_udp;
+static os_timer_t udp_timer;
+static uint8_t *udp_buf;
+static uint16_t udp_size, udp_pps;
+static uint8_t udp_leg;
+static uint32_t udp_start, udp_secs, udp_seq, udp_done;
+
+// Per second rates and CPU load
+static os_timer_t stats_timer;
+static struct perf_leg_stats last[PERF_LEGS];
+static uint32_t stats_time, idle_us;
+static bool idle_posted;
+
+
+static uint8_t ICACHE_FLASH_ATTR perf_leg(uint8_t *ip)
+{
+    ip_addr_t addr;
+
+    IP4_ADDR(&addr, ip[0], ip[1], ip[2], ip[3]);
+    return ip_addr_netcmp(&addr, &sl_netif.ip_addr, &sl_netif.netmask) ? PERF_LEG_SLIP : PERF_LEG_WIFI;
+}
+
+static struct perf_conn * ICACHE_FLASH_ATTR perf_conn_find(struct espconn *pespconn)
+{
+    uint8_t i;
+
+    // Match by the remote end, the disconnect callback doesn't always get
+    // the espconn of the connection
+    for (i = 0; i < PERF_MAX_CONN; i++) {
+	if (conns[i].conn != NULL && conns[i].remote_port == pespconn->proto.tcp->remote_port &&
+	    os_memcmp(conns[i].remote_ip, pespconn->proto.tcp->remote_ip, 4) == 0)
+	    return &conns[i];
+    }
+    return NULL;
+}
+
+static void ICACHE_FLASH_ATTR chargen_send(struct perf_conn *pc)
+{
+    if (pc->sending)
+	return;
+    if (espconn_sent(pc->conn, chargen_buf, PERF_CHARGEN_CHUNK) == ESPCONN_OK)
+	pc->sending = true;
+}
+
+static void ICACHE_FLASH_ATTR perf_recv_cb(void *arg, char *data, unsigned short length)
+{
+    struct perf_conn *pc = perf_conn_find((struct espconn *)arg);
+
+    if (pc == NULL)
+	return;
+    perf_stats.leg[pc->leg].rx_bytes += length;
+    perf_stats.leg[pc->leg].rx_pkts++;
+}
+
+static void ICACHE_FLASH_ATTR perf_sent_cb(void *arg)
+{
+    struct perf_conn *pc = perf_conn_find((struct espconn *)arg);
+
+    if (pc == NULL || !pc->chargen)
+	return;
+    pc->sending = false;
+    perf_stats.leg[pc->leg].tx_bytes += PERF_CHARGEN_CHUNK;
+    perf_stats.leg[pc->leg].tx_pkts++;
+    if (running)
+	chargen_send(pc);
+}
+
+static void ICACHE_FLASH_ATTR perf_discon_cb(void *arg)
+{
+    struct perf_conn *pc = perf_conn_find((struct espconn *)arg);
+
+    if (pc != NULL)
+	pc->conn = NULL;
+}
+
+static void ICACHE_FLASH_ATTR perf_recon_cb(void *arg, sint8 err)
+{
+    perf_discon_cb(arg);
+}
+
+static void ICACHE_FLASH_ATTR perf_connected_cb(void *arg)
+{
+    struct espconn *pespconn = (struct espconn *)arg;
+    struct perf_conn *pc = NULL;
+    uint8_t i;
+
+    for (i = 0; i < PERF_MAX_CONN; i++) {
+	if (conns[i].conn == NULL) {
+	    pc = &conns[i];
+	    break;
+	}
+    }
+    if (pc == NULL) {
+	espconn_disconnect(pespconn);
+	return;
+    }
+
+    pc->conn = pespconn;
+    os_memcpy(pc->remote_ip, pespconn->proto.tcp->remote_ip, 4);
+    pc->remote_port = pespconn->proto.tcp->remote_port;
+    pc->leg = perf_leg(pc->remote_ip);
+    pc->chargen = pespconn->proto.tcp->local_port == PERF_CHARGEN_PORT;
+    pc->sending = false;
+
+    espconn_regist_recvcb(pespconn, perf_recv_cb);
+    espconn_regist_sentcb(pespconn, perf_sent_cb);
+    espconn_regist_disconcb(pespconn, perf_discon_cb);
+    espconn_regist_reconcb(pespconn, perf_recon_cb);
+    espconn_set_opt(pespconn, ESPCONN_NODELAY);
+
+    if (pc->chargen)
+	chargen_send(pc);
+}
+
+static void ICACHE_FLASH_ATTR udp_sink_recv_cb(void *arg, char *data, unsigned short length)
+{
+    struct espconn *pespconn = (struct espconn *)arg;
+    remot_info *premot = NULL;
+    struct perf_leg_stats *ls;
+    uint8_t leg;
+    int32_t seq;
+
+    if (espconn_get_connection_info(pespconn, &premot, 0) != ESPCONN_OK)
+	return;
+    leg = perf_leg(premot->remote_ip);
+    ls = &perf_stats.leg[leg];
+    ls->rx_bytes += length;
+    ls->rx_pkts++;
+
+    if (length < 4)
+	return;
+    seq = (int32_t)(((uint32_t)(uint8_t)data[0] << 24) | ((uint32_t)(uint8_t)data[1] << 16) |
+		    ((uint32_t)(uint8_t)data[2] << 8) | (uint8_t)data[3]);
+    // iperf marks the last datagram with a negative number
+    if (seq < 0)
+	seq = -seq;
+    if (seq > udp_expect[leg])
+	ls->rx_lost += seq - udp_expect[leg];
+    // a new run starts from 0, late ones don't move the expected number back
+    if (seq >= udp_expect[leg] || seq == 0)
+	udp_expect[leg] = seq + 1;
+}
+
+static void ICACHE_FLASH_ATTR udp_timer_cb(void *arg)
+{
+    struct perf_leg_stats *ls = &perf_stats.leg[udp_leg];
+    uint32_t elapsed = system_get_time() - udp_start;
+    uint32_t due;
+    uint8_t n;
+
+    if (elapsed >= (uint64_t)udp_secs * 1000000) {
+	os_timer_disarm(&udp_timer);
+	espconn_delete(&udp_tx);
+	os_free(udp_buf);
+	udp_buf = NULL;
+	return;
+    }
+
+    due = (uint32_t)((uint64_t)elapsed * udp_pps / 1000000) + 1;
+    for (n = 0; udp_done < due && n < PERF_UDP_BURST; n++, udp_done++) {
+	udp_buf[0] = udp_seq >> 24;
+	udp_buf[1] = udp_seq >> 16;
+	udp_buf[2] = udp_seq >> 8;
+	udp_buf[3] = udp_seq;
+	if (espconn_sent(&udp_tx, udp_buf, udp_size) == ESPCONN_OK) {
+	    udp_seq++;
+	    ls->tx_bytes += udp_size;
+	    ls->tx_pkts++;
+	} else {
+	    ls->tx_dropped++;
+	}
+    }
+    // can't keep up, don't try to catch up later
+    if (udp_done < due) {
+	ls->tx_dropped += due - udp_done;
+	udp_done = due;
+    }
+}
+
+static void ICACHE_FLASH_ATTR stats_timer_cb(void *arg)
+{
+    uint32_t now = system_get_time();
+    uint32_t elapsed = now - stats_time;
+    struct perf_leg_stats *ls;
+    uint8_t i;
+
+    for (i = 0; i < PERF_LEGS; i++) {
+	ls = &perf_stats.leg[i];
+	ls->rx_bps = (uint64_t)(ls->rx_bytes - last[i].rx_bytes) * 1000000 / elapsed;
+	ls->rx_pps = (uint64_t)(ls->rx_pkts - last[i].rx_pkts) * 1000000 / elapsed;
+	ls->tx_bps = (uint64_t)(ls->tx_bytes - last[i].tx_bytes) * 1000000 / elapsed;
+	ls->tx_pps = (uint64_t)(ls->tx_pkts - last[i].tx_pkts) * 1000000 / elapsed;
+	last[i] = *ls;
+    }
+    perf_stats.cpu_load = idle_us >= elapsed ? 0 : 100 - (uint64_t)idle_us * 100 / elapsed;
+    idle_us = 0;
+    stats_time = now;
+
+    // restart chargen connections whose last write was refused
+    for (i = 0; i < PERF_MAX_CONN; i++) {
+	if (conns[i].conn != NULL && conns[i].chargen)
+	    chargen_send(&conns[i]);
+    }
+}
+
+void ICACHE_FLASH_ATTR perf_test_idle(void)
+{
+    uint32_t start, t, prev, idle = 0;
+
+    idle_posted = false;
+    if (!running)
+	return;
+
+    start = prev = system_get_time();
+    while ((t = system_get_time()) - start < PERF_IDLE_SLICE_US) {
+	if (t - prev <= PERF_IDLE_GAP_US)
+	    idle += t - prev;
+	prev = t;
+    }
+    idle_us += idle;
+
+    // everything else queued for the user task and the SDK runs in between
+    idle_posted = system_os_post(0, SIG_PERF_IDLE, 0);
+}
+
+static void ICACHE_FLASH_ATTR tcp_server_start(struct espconn *srv, esp_tcp *tcp, uint16_t port)
+{
+    os_memset(srv, 0, sizeof(struct espconn));
+    os_memset(tcp, 0, sizeof(esp_tcp));
+    srv->type = ESPCONN_TCP;
+    srv->state = ESPCONN_NONE;
+    srv->proto.tcp = tcp;
+    tcp->local_port = port;
+    espconn_regist_connectcb(srv, perf_connected_cb);
+    espconn_accept(srv);
+    espconn_regist_time(srv, 60, 0);
+}
+
+bool ICACHE_FLASH_ATTR perf_test_start(void)
+{
+    uint16_t i;
+
+    if (running)
+	return true;
+
+    chargen_buf = (uint8_t *)os_malloc(PERF_CHARGEN_CHUNK);
+    if (chargen_buf == NULL)
+	return false;
+    // RFC 864 pattern: lines of 72 printable chars, rotated by one per line
+    for (i = 0; i < PERF_CHARGEN_CHUNK; i++) {
+	if (i % 74 == 72)
+	    chargen_buf[i] = '\r';
+	else if (i % 74 == 73)
+	    chargen_buf[i] = '\n';
+	else
+	    chargen_buf[i] = ' ' + (i / 74 + i % 74) % 95;
+    }
+
+    os_memset(&perf_stats, 0, sizeof(perf_stats));
+    os_memset(last, 0, sizeof(last));
+    os_memset(conns, 0, sizeof(conns));
+    os_memset(udp_expect, 0, sizeof(udp_expect));
+
+    tcp_server_start(&discard_srv, &discard_tcp, PERF_DISCARD_PORT);
+    tcp_server_start(&chargen_srv, &chargen_tcp, PERF_CHARGEN_PORT);
+
+    os_memset(&udp_sink, 0, sizeof(udp_sink));
+    os_memset(&udp_sink_udp, 0, sizeof(udp_sink_udp));
+    udp_sink.type = ESPCONN_UDP;
+    udp_sink.proto.udp = &udp_sink_udp;
+    udp_sink_udp.local_port = PERF_UDP_PORT;
+    espconn_regist_recvcb(&udp_sink, udp_sink_recv_cb);
+    espconn_create(&udp_sink);
+
+    running = true;
+    idle_us = 0;
+    stats_time = system_get_time();
+    os_timer_disarm(&stats_timer);
+    os_timer_setfn(&stats_timer, stats_timer_cb, NULL);
+    os_timer_arm(&stats_timer, 1000, 1);
+    if (!idle_posted)
+	idle_posted = system_os_post(0, SIG_PERF_IDLE, 0);
+    return true;
+}
+
+void ICACHE_FLASH_ATTR perf_test_stop(void)
+{
+    uint8_t i;
+
+    if (!running)
+	return;
+    running = false;
+
+    os_timer_disarm(&stats_timer);
+    if (udp_buf != NULL) {
+	os_timer_disarm(&udp_timer);
+	espconn_delete(&udp_tx);
+	os_free(udp_buf);
+	udp_buf = NULL;
+    }
+
+    for (i = 0; i < PERF_MAX_CONN; i++) {
+	if (conns[i].conn != NULL)
+	    espconn_disconnect(conns[i].conn);
+	conns[i].conn = NULL;
+    }
+    espconn_delete(&discard_srv);
+    espconn_delete(&chargen_srv);
+    espconn_delete(&udp_sink);
+
+    os_free(chargen_buf);
+    chargen_buf = NULL;
+}
+
+bool ICACHE_FLASH_ATTR perf_test_running(void)
+{
+    return running;
+}
+
+bool ICACHE_FLASH_ATTR perf_test_udp(ip_addr_t *addr, uint16_t port, uint16_t size, uint16_t pps, uint16_t secs)
+{
+    uint8_t *buf;
+
+    if (size < 4 || size > PERF_UDP_MAX_SIZE || pps == 0 || secs == 0 || secs > PERF_UDP_MAX_SECS)
+	return false;
+    buf = (uint8_t *)os_zalloc(size);
+    if (buf == NULL)
+	return false;
+    if (!perf_test_start()) {
+	os_free(buf);
+	return false;
+    }
+
+    if (udp_buf != NULL) {
+	os_timer_disarm(&udp_timer);
+	espconn_delete(&udp_tx);
+	os_free(udp_buf);
+    }
+    udp_buf = buf;
+
+    os_memset(&udp_tx, 0, sizeof(udp_tx));
+    os_memset(&udp_tx_udp, 0, sizeof(udp_tx_udp));
+    udp_tx.type = ESPCONN_UDP;
+    udp_tx.proto.udp = &udp_tx_udp;
+    udp_tx_udp.local_port = espconn_port();
+    udp_tx_udp.remote_port = port;
+    os_memcpy(udp_tx_udp.remote_ip, &addr->addr, 4);
+    espconn_create(&udp_tx);
+
+    udp_leg = perf_leg(udp_tx_udp.remote_ip);
+    udp_size = size;
+    udp_pps = pps;
+    udp_secs = secs;
+    udp_seq = udp_done = 0;
+    udp_start = system_get_time();
+    os_timer_disarm(&udp_timer);
+    os_timer_setfn(&udp_timer, udp_timer_cb, NULL);
+    os_timer_arm(&udp_timer, PERF_UDP_TICK_MS, 1);
+    return true;
+}
+
+bool ICACHE_FLASH_ATTR perf_test_show_line(uint16_t idx)
+{
+    static const char *leg_names[PERF_LEGS] = { "SLIP", "WiFi" };
+    char response[CONSOLE_LINE_MAX];
+    struct perf_leg_stats *ls;
+
+    if (idx == 0) {
+	if (!running) {
+	    console_puts("Test service stopped\r\n");
+	    return false;
+	}
+	os_sprintf(response, "Test service: TCP discard %d chargen %d, UDP %d, CPU load %d%%\r\n",
+	   PERF_DISCARD_PORT, PERF_CHARGEN_PORT, PERF_UDP_PORT, perf_stats.cpu_load);
+    } else if (idx <= PERF_LEGS * 2) {
+	ls = &perf_stats.leg[(idx - 1) / 2];
+	if (idx % 2)
+	    os_sprintf(response, "%s: rx %d B/s %d pkt/s, tx %d B/s %d pkt/s\r\n",
+	       leg_names[(idx - 1) / 2], ls->rx_bps, ls->rx_pps, ls->tx_bps, ls->tx_pps);
+	else
+	    os_sprintf(response, "  total rx %d KiB %d pkts lost %d, tx %d KiB %d pkts dropped %d\r\n",
+	       ls->rx_bytes / 1024, ls->rx_pkts, ls->rx_lost, ls->tx_bytes / 1024, ls->tx_pkts, ls->tx_dropped);
+    } else if (idx == PERF_LEGS * 2 + 1 && udp_buf != NULL) {
+	os_sprintf(response, "UDP to %d.%d.%d.%d:%d, %d bytes at %d pkt/s for %d s\r\n",
+	   udp_tx_udp.remote_ip[0], udp_tx_udp.remote_ip[1], udp_tx_udp.remote_ip[2], udp_tx_udp.remote_ip[3],
+	   udp_tx_udp.remote_port, udp_size, udp_pps, udp_secs);
+    } else {
+	return false;
+    }
+    console_puts(response);
+    return true;
+}
+
+#endif /* ALLOW_PERF_TEST */
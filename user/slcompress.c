@@ -0,0 +1,521 @@
+/*
+ * Routines to compress and uncompress TCP packets (for transmission
+ * over low speed serial lines), see RFC 1144.
+ *
+ * Based on the reference code by Van Jacobson, Lawrence Berkeley Laboratory:
+ * Copyright (c) 1989 Regents of the University of California.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms are permitted
+ * provided that the above copyright notice and this paragraph are
+ * duplicated in all such forms and that any documentation,
+ * advertising materials, and other materials related to such
+ * distribution and use acknowledge that the software was developed
+ * by the University of California, Berkeley.  The name of the
+ * University may not be used to endorse or promote products derived
+ * from this software without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED ``AS IS'' AND WITHOUT ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, WITHOUT LIMITATION, THE IMPLIED
+ * WARRANTIES OF MERCHANTIBILITY AND FITNESS FOR A PARTICULAR PURPOSE.
+ */
+
+#include "c_types.h"
+#include "osapi.h"
+
+#include "slcompress.h"
+
+// Bits in first octet of compressed packet
+#define NEW_C	0x40	// flag bits for what changed in a packet
+#define NEW_I	0x20
+#define NEW_S	0x08
+#define NEW_A	0x04
+#define NEW_W	0x02
+#define NEW_U	0x01
+
+// reserved, special-case values of above
+#define SPECIAL_I	(NEW_S|NEW_W|NEW_U)		// echoed interactive traffic
+#define SPECIAL_D	(NEW_S|NEW_A|NEW_W|NEW_U)	// unidirectional data
+#define SPECIALS_MASK	(NEW_S|NEW_A|NEW_W|NEW_U)
+
+#define TCP_PUSH_BIT	0x10
+
+#define SLF_TOSS	1	// tossing rcvd frames because of input err
+
+#define SLC_IPPROTO_TCP	6
+
+#define TH_FIN	0x01
+#define TH_SYN	0x02
+#define TH_RST	0x04
+#define TH_PUSH	0x08
+#define TH_ACK	0x10
+#define TH_URG	0x20
+
+// Header fields are accessed bytewise, in network byte order
+static inline uint16_t get16(const uint8_t *p)
+{
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static inline uint32_t get32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void put16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void put32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// ENCODE encodes a number that is known to be non-zero. ENCODEZ checks for zero
+#define ENCODE(n) { \
+	if ((uint16_t)(n) >= 256) { \
+		*cp++ = 0; \
+		cp[1] = (n); \
+		cp[0] = (n) >> 8; \
+		cp += 2; \
+	} else { \
+		*cp++ = (n); \
+	} \
+}
+#define ENCODEZ(n) { \
+	if ((uint16_t)(n) >= 256 || (uint16_t)(n) == 0) { \
+		*cp++ = 0; \
+		cp[1] = (n); \
+		cp[0] = (n) >> 8; \
+		cp += 2; \
+	} else { \
+		*cp++ = (n); \
+	} \
+}
+
+#define DECODEL(f) { \
+	if (*cp == 0) { \
+		put32(f, get32(f) + ((cp[1] << 8) | cp[2])); \
+		cp += 3; \
+	} else { \
+		put32(f, get32(f) + (uint32_t)*cp++); \
+	} \
+}
+#define DECODES(f) { \
+	if (*cp == 0) { \
+		put16(f, get16(f) + ((cp[1] << 8) | cp[2])); \
+		cp += 3; \
+	} else { \
+		put16(f, get16(f) + (uint32_t)*cp++); \
+	} \
+}
+#define DECODEU(f) { \
+	if (*cp == 0) { \
+		put16(f, (cp[1] << 8) | cp[2]); \
+		cp += 3; \
+	} else { \
+		put16(f, (uint32_t)*cp++); \
+	} \
+}
+
+void ICACHE_FLASH_ATTR sl_compress_init(struct slcompress *comp)
+{
+    uint16_t i;
+    struct slc_cstate *tstate = comp->tstate;
+
+    os_memset(comp, 0, sizeof(*comp));
+    for (i = SLC_MAX_STATES - 1; i > 0; --i) {
+	tstate[i].id = i;
+	tstate[i].next = &tstate[i - 1];
+    }
+    tstate[0].next = &tstate[SLC_MAX_STATES - 1];
+    tstate[0].id = 0;
+    comp->last_cs = &tstate[0];
+    comp->last_recv = 255;
+    comp->last_xmit = 255;
+    comp->flags = SLF_TOSS;
+}
+
+// Same addresses and ports as the saved header of a cstate?
+static bool ICACHE_FLASH_ATTR slc_same_conn(const uint8_t *ip, const uint8_t *th, const struct slc_cstate *cs)
+{
+    const uint8_t *oth = cs->hdr + ((cs->hdr[0] & 0x0f) << 2);
+
+    return os_memcmp(ip + 12, cs->hdr + 12, 8) == 0 && os_memcmp(th, oth, 4) == 0;
+}
+
+uint8_t ICACHE_FLASH_ATTR sl_compress_tcp(struct slcompress *comp, uint8_t *ip, uint16_t len,
+			uint16_t *hlen, uint16_t *clen)
+{
+    struct slc_cstate *cs = comp->last_cs->next;
+    uint16_t ihl, thl, h, c;
+    uint8_t *th, *oth;
+    uint32_t deltaS, deltaA;
+    uint8_t changes = 0;
+    uint8_t new_seq[16];
+    uint8_t *cp = new_seq;
+
+    /*
+     * Bail if this is an IP fragment or if the TCP packet isn't
+     * `compressible' (i.e., ACK isn't set or some other control bit is
+     * set).
+     */
+    if (len < 40 || ip[9] != SLC_IPPROTO_TCP || (get16(ip + 6) & 0x3fff))
+	return TYPE_IP;
+    ihl = (ip[0] & 0x0f) << 2;
+    if (ihl < 20 || ihl + 20 > len)
+	return TYPE_IP;
+    th = ip + ihl;
+    thl = (th[12] >> 4) << 2;
+    h = ihl + thl;
+    if (thl < 20 || h > len || h > SLC_MAX_HDR)
+	return TYPE_IP;
+    if ((th[13] & (TH_SYN|TH_FIN|TH_RST|TH_ACK)) != TH_ACK)
+	return TYPE_IP;
+    *hlen = h;
+
+    /*
+     * Packet is compressible -- we're going to send either a
+     * COMPRESSED_TCP or UNCOMPRESSED_TCP packet. Either way we need
+     * to locate (or create) the connection state. Special case the
+     * most recently used connection since it's most likely to be used
+     * again & we don't have to do any reordering if it's used.
+     */
+    if (!slc_same_conn(ip, th, cs)) {
+	/*
+	 * Wasn't the first -- search for it.
+	 *
+	 * States are kept in a circularly linked list with last_cs
+	 * pointing to the end of the list. The list is kept in lru
+	 * order by moving a state to the head of the list whenever it
+	 * is referenced. Since the list is short and, empirically,
+	 * the connection we want is almost always near the front, we
+	 * locate states via linear search.
+	 */
+	struct slc_cstate *lcs;
+	struct slc_cstate *lastcs = comp->last_cs;
+
+	do {
+	    lcs = cs;
+	    cs = cs->next;
+	    if (slc_same_conn(ip, th, cs))
+		goto found;
+	} while (cs != lastcs);
+
+	/*
+	 * Didn't find it -- re-use oldest cstate. Send an uncompressed
+	 * packet that tells the other side what connection number
+	 * we're using for this conversation. Note that since the state
+	 * list is circular, the oldest state points to the newest and
+	 * we only need to set last_cs to update the lru linkage.
+	 */
+	comp->last_cs = lcs;
+	goto uncompressed;
+
+found:
+	// Found it -- move to the front on the connection list.
+	if (cs == lastcs) {
+	    comp->last_cs = lcs;
+	} else {
+	    lcs->next = cs->next;
+	    cs->next = lastcs->next;
+	    lastcs->next = cs;
+	}
+    }
+
+    /*
+     * Make sure that only what we expect to change changed. The first
+     * line checks version, hdr len & type of service, the 2nd line
+     * checks fragment offset, the 3rd line checks ttl & protocol, the
+     * 4th line checks the TCP header length, the 5th line checks IP
+     * options, if any, and the 6th line checks TCP options, if any.
+     */
+    oth = cs->hdr + ihl;
+    if (get16(ip) != get16(cs->hdr) ||
+	get16(ip + 6) != get16(cs->hdr + 6) ||
+	get16(ip + 8) != get16(cs->hdr + 8) ||
+	(th[12] >> 4) != (oth[12] >> 4) ||
+	(ihl > 20 && os_memcmp(ip + 20, cs->hdr + 20, ihl - 20)) ||
+	(thl > 20 && os_memcmp(th + 20, oth + 20, thl - 20)))
+	goto uncompressed;
+
+    /*
+     * Figure out which of the changing fields changed. The receiver
+     * expects changes in the order: urgent, window, ack, seq.
+     */
+    if (th[13] & TH_URG) {
+	deltaS = get16(th + 18);
+	ENCODEZ(deltaS);
+	changes |= NEW_U;
+    } else if (get16(th + 18) != get16(oth + 18)) {
+	/*
+	 * argh! URG not set but urp changed -- a sensible
+	 * implementation should never do this but RFC793 doesn't
+	 * prohibit the change so we have to deal with it.
+	 */
+	goto uncompressed;
+    }
+
+    deltaS = (uint16_t)(get16(th + 14) - get16(oth + 14));
+    if (deltaS) {
+	ENCODE(deltaS);
+	changes |= NEW_W;
+    }
+
+    deltaA = get32(th + 8) - get32(oth + 8);
+    if (deltaA) {
+	if (deltaA > 0xffff)
+	    goto uncompressed;
+	ENCODE(deltaA);
+	changes |= NEW_A;
+    }
+
+    deltaS = get32(th + 4) - get32(oth + 4);
+    if (deltaS) {
+	if (deltaS > 0xffff)
+	    goto uncompressed;
+	ENCODE(deltaS);
+	changes |= NEW_S;
+    }
+
+    // Look for the special-case encodings.
+    switch (changes) {
+
+    case 0:
+	/*
+	 * Nothing changed. If this packet contains data and the last
+	 * one didn't, this is probably a data packet following an ack
+	 * (normal on an interactive connection) and we send it
+	 * compressed. Otherwise it's probably a retransmit,
+	 * retransmitted ack or window probe. Send it uncompressed in
+	 * case the other side missed the compressed version.
+	 */
+	if (get16(ip + 2) != get16(cs->hdr + 2) && get16(cs->hdr + 2) == h)
+	    break;
+	// fall through
+
+    case SPECIAL_I:
+    case SPECIAL_D:
+	// actual changes match one of our special case encodings -- send packet uncompressed.
+	goto uncompressed;
+
+    case NEW_S|NEW_A:
+	if (deltaS == deltaA && deltaS == (uint32_t)(get16(cs->hdr + 2) - h)) {
+	    // special case for echoed terminal traffic
+	    changes = SPECIAL_I;
+	    cp = new_seq;
+	}
+	break;
+
+    case NEW_S:
+	if (deltaS == (uint32_t)(get16(cs->hdr + 2) - h)) {
+	    // special case for data xfer
+	    changes = SPECIAL_D;
+	    cp = new_seq;
+	}
+	break;
+    }
+
+    deltaS = (uint16_t)(get16(ip + 4) - get16(cs->hdr + 4));
+    if (deltaS != 1) {
+	ENCODEZ(deltaS);
+	changes |= NEW_I;
+    }
+    if (th[13] & TH_PUSH)
+	changes |= TCP_PUSH_BIT;
+
+    // Grab the cksum before we overwrite it below. Then update our state with this packet's header.
+    deltaA = get16(th + 16);
+    os_memcpy(cs->hdr, ip, h);
+
+    /*
+     * (cp - new_seq) is the number of bytes we need for compressed
+     * sequence numbers. In addition we need one byte for the change
+     * mask, one for the connection id and two for the tcp checksum.
+     * The compressed header is written to the end of the old header.
+     */
+    deltaS = cp - new_seq;
+    if (comp->last_xmit != cs->id) {
+	comp->last_xmit = cs->id;
+	c = deltaS + 4;
+	cp = ip + h - c;
+	*cp++ = changes | NEW_C;
+	*cp++ = cs->id;
+    } else {
+	c = deltaS + 3;
+	cp = ip + h - c;
+	*cp++ = changes;
+    }
+    *cp++ = deltaA >> 8;
+    *cp++ = deltaA;
+    os_memcpy(cp, new_seq, deltaS);
+    ip[h - c] |= TYPE_COMPRESSED_TCP;
+    *clen = c;
+    return TYPE_COMPRESSED_TCP;
+
+uncompressed:
+    /*
+     * Update connection state cs & send uncompressed packet
+     * ('uncompressed' means a regular ip/tcp packet but with the
+     * 'conversation id' we hope to use on future compressed packets
+     * in the protocol field).
+     */
+    os_memcpy(cs->hdr, ip, h);
+    ip[9] = cs->id;
+    ip[0] |= TYPE_UNCOMPRESSED_TCP;
+    comp->last_xmit = cs->id;
+    *clen = h;
+    return TYPE_UNCOMPRESSED_TCP;
+}
+
+static uint16_t ICACHE_FLASH_ATTR slc_ip_chksum(const uint8_t *ip, uint16_t len)
+{
+    uint32_t sum = 0;
+    uint16_t i;
+
+    for (i = 0; i < len; i += 2)
+	sum += get16(ip + i);
+    while (sum >> 16)
+	sum = (sum & 0xffff) + (sum >> 16);
+    return ~sum;
+}
+
+int ICACHE_FLASH_ATTR sl_uncompress_tcp(struct slcompress *comp, uint8_t type, uint8_t *buf,
+		      uint16_t len, uint16_t pkt_len, uint8_t **hdr, uint16_t *hlen)
+{
+    uint8_t *cp;
+    uint8_t *th;
+    uint16_t ihl, thl, h, consumed;
+    uint8_t changes;
+    struct slc_cstate *cs;
+
+    switch (type) {
+
+    case TYPE_UNCOMPRESSED_TCP:
+	/*
+	 * Locate the saved state for this connection. If the state
+	 * index is legal, clear the 'discard' flag.
+	 */
+	if (len < 40 || buf[9] >= SLC_MAX_STATES)
+	    goto bad;
+	ihl = (buf[0] & 0x0f) << 2;
+	if (ihl < 20 || ihl + 20 > len)
+	    goto bad;
+	thl = (buf[ihl + 12] >> 4) << 2;
+	h = ihl + thl;
+	if (thl < 20 || h > len || h > SLC_MAX_HDR)
+	    goto bad;
+
+	cs = &comp->rstate[comp->last_recv = buf[9]];
+	comp->flags &= ~SLF_TOSS;
+
+	// Restore the IP version and protocol field then save a copy of this packet header.
+	buf[0] &= 0x4f;
+	buf[9] = SLC_IPPROTO_TCP;
+	os_memcpy(cs->hdr, buf, h);
+	cs->hlen = h;
+	return 0;
+
+    case TYPE_COMPRESSED_TCP:
+	break;
+
+    default:
+	goto bad;
+    }
+
+    // We've got a compressed packet.
+    if (len < 3)
+	goto bad;
+    cp = buf;
+    changes = *cp++ & 0x7f;
+    if (changes & NEW_C) {
+	/*
+	 * Make sure the state index is in range, then grab the state.
+	 * If we have a good state index, clear the 'discard' flag.
+	 */
+	if (*cp >= SLC_MAX_STATES)
+	    goto bad;
+	comp->flags &= ~SLF_TOSS;
+	comp->last_recv = *cp++;
+    } else {
+	/*
+	 * This packet has an implicit state index. If we've had a
+	 * line error since the last time we got an explicit state
+	 * index, we have to toss the packet.
+	 */
+	if (comp->flags & SLF_TOSS)
+	    return -1;
+    }
+
+    // Find the state then fill in the TCP checksum and PUSH bit.
+    cs = &comp->rstate[comp->last_recv];
+    if (cs->hlen == 0)
+	goto bad;
+    ihl = (cs->hdr[0] & 0x0f) << 2;
+    th = cs->hdr + ihl;
+    put16(th + 16, get16(cp));
+    cp += 2;
+    if (changes & TCP_PUSH_BIT)
+	th[13] |= TH_PUSH;
+    else
+	th[13] &= ~TH_PUSH;
+
+    // Fix up the state's ack, seq, urg and win fields based on the changemask.
+    switch (changes & SPECIALS_MASK) {
+    case SPECIAL_I:
+	{
+	    uint32_t i = get16(cs->hdr + 2) - cs->hlen;
+	    put32(th + 8, get32(th + 8) + i);
+	    put32(th + 4, get32(th + 4) + i);
+	}
+	break;
+
+    case SPECIAL_D:
+	put32(th + 4, get32(th + 4) + get16(cs->hdr + 2) - cs->hlen);
+	break;
+
+    default:
+	if (changes & NEW_U) {
+	    th[13] |= TH_URG;
+	    DECODEU(th + 18);
+	} else {
+	    th[13] &= ~TH_URG;
+	}
+	if (changes & NEW_W)
+	    DECODES(th + 14);
+	if (changes & NEW_A)
+	    DECODEL(th + 8);
+	if (changes & NEW_S)
+	    DECODEL(th + 4);
+	break;
+    }
+
+    // Update the IP ID
+    if (changes & NEW_I)
+	DECODES(cs->hdr + 4)
+    else
+	put16(cs->hdr + 4, get16(cs->hdr + 4) + 1);
+
+    /*
+     * At this point, cp points to the first byte of data in the packet.
+     * Fill in the IP total length and recompute the IP header checksum.
+     */
+    consumed = cp - buf;
+    if (consumed > len || consumed > pkt_len)
+	goto bad;
+    put16(cs->hdr + 2, pkt_len - consumed + cs->hlen);
+    put16(cs->hdr + 10, 0);
+    put16(cs->hdr + 10, slc_ip_chksum(cs->hdr, ihl));
+
+    *hdr = cs->hdr;
+    *hlen = cs->hlen;
+    return consumed;
+
+bad:
+    comp->flags |= SLF_TOSS;
+    return -1;
+}
@@ -0,0 +1,638 @@
+#include "c_types.h"
+#include "osapi.h"
+#include "gpio.h"
+#include "user_interface.h"
+
+#include "lwip/ip_addr.h"
+#include "lwip/pbuf.h"
+#include "driver/uart.h"
+
+#include "console.h"
+#include "slip_txq.h"
+#include "link_stats.h"
+#include "user_config.h"
+
+#if SLIP_TXQ_FLOWS <= MAX_CLIENTS
+#error "SLIP_TXQ_FLOWS must leave a flow for the ESP itself"
+#endif
+
+#define SLIP_END	0xC0
+#define SLIP_ESC	0xDB
+#define SLIP_ESC_END	0xDC
+#define SLIP_ESC_ESC	0xDD
+
+#define IP_PROTO_TCP	6
+#define IP_ECN_CE	0x03
+#define TCP_FLAG_ACK	0x10
+#define TCP_OPT_EOL	0
+#define TCP_OPT_NOP	1
+#define TCP_OPT_TS	8
+#define TCP_OPT_TS_LEN	10
+
+// Frames handed over to the TX interrupt at a time, and slots for them
+// (sent frames keep their slot until they are freed in task context)
+#define SLIP_TXQ_HANDOVER	2
+#define SLIP_TXQ_HANDOVER_SLOTS	4
+
+#define TXQ_NONE	0xff
+
+extern uint64_t Bytes_in;
+
+struct slip_txq_entry {
+    struct pbuf	*p;		// NULL: unused
+    uint32_t	tstamp;		// system_get_time() at enqueue
+    uint8_t	next;		// next packet of the flow
+};
+
+enum txq_list { TXQ_LIST_NONE, TXQ_LIST_NEW, TXQ_LIST_OLD };
+
+struct slip_txq_flow {
+    uint8_t	head, tail;	// first and last packet, valid if pkts > 0
+    uint8_t	pkts;
+    uint16_t	bytes;
+    int16_t	deficit;
+    uint8_t	list;		// enum txq_list
+    uint8_t	next;		// next flow in that list
+    uint32_t	last_active;	// last enqueue, the slot of the longest idle flow is reused
+
+    // CoDel state
+    uint32_t	first_above_time;
+    uint32_t	drop_next;
+    uint32_t	count, lastcount;
+    bool	dropping;
+};
+
+struct txq_flow_list {
+    uint8_t	head, tail;
+};
+
+static struct slip_txq_entry txq[SLIP_TXQ_MAX_PKTS];
+static struct slip_txq_flow flows[SLIP_TXQ_FLOWS];
+static struct txq_flow_list new_flows = { TXQ_NONE, TXQ_NONE };
+static struct txq_flow_list old_flows = { TXQ_NONE, TXQ_NONE };
+
+// Frames handed over to the TX interrupt: tx_head is advanced by the task,
+// tx_sent by the interrupt, tx_freed by the task after pbuf_free()
+static struct pbuf * volatile tx_slots[SLIP_TXQ_HANDOVER_SLOTS];
+static volatile uint8_t tx_head, tx_sent, tx_freed;
+
+// State of the interrupt: current pbuf of the frame being sent, offset in it
+// and the pending second byte of an escape sequence
+static struct pbuf *tx_q;
+static uint16_t tx_off;
+static uint8_t tx_esc;
+
+static volatile bool pump_pending;
+
+// VJ compressor state, NULL in plain SLIP mode
+static struct slcompress *slc;
+
+// While held, only the frames queued before slip_txq_hold() are handed over
+static bool hold;
+static uint8_t hold_flush;
+
+struct slip_txq_stats slip_txq_stats;
+struct slip_txq_client slip_txq_clients[SLIP_TXQ_FLOWS];
+
+static inline int32_t time_diff(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b);
+}
+
+static uint32_t ICACHE_FLASH_ATTR codel_isqrt(uint32_t x)
+{
+    uint32_t r = 0, bit = 1UL << 30;
+
+    while (bit > x)
+	bit >>= 2;
+    while (bit != 0) {
+	if (x >= r + bit) {
+	    x -= r + bit;
+	    r = (r >> 1) + bit;
+	} else {
+	    r >>= 1;
+	}
+	bit >>= 2;
+    }
+    return r;
+}
+
+// interval / sqrt(count), in fixed point
+static uint32_t ICACHE_FLASH_ATTR codel_control_law(struct slip_txq_flow *f, uint32_t t)
+{
+    uint32_t c = f->count > 0xffff ? 0xffff : f->count;
+
+    return t + (uint32_t)(((uint64_t)slip_txq_stats.interval_us << 8) / codel_isqrt(c << 16));
+}
+
+static void ICACHE_FLASH_ATTR flow_list_add(struct txq_flow_list *l, uint8_t i, enum txq_list which)
+{
+    flows[i].list = which;
+    flows[i].next = TXQ_NONE;
+    if (l->head == TXQ_NONE)
+	l->head = i;
+    else
+	flows[l->tail].next = i;
+    l->tail = i;
+}
+
+static uint8_t ICACHE_FLASH_ATTR flow_list_pop(struct txq_flow_list *l)
+{
+    uint8_t i = l->head;
+
+    l->head = flows[i].next;
+    if (l->head == TXQ_NONE)
+	l->tail = TXQ_NONE;
+    flows[i].list = TXQ_LIST_NONE;
+    return i;
+}
+
+// Flow of the source address src: its own, a free one or the one idle for
+// the longest time. If all are busy, src shares one with another source.
+static uint8_t ICACHE_FLASH_ATTR flow_find(uint32_t src)
+{
+    uint8_t i, idle = TXQ_NONE;
+    bool busy;
+
+    for (i = 0; i < SLIP_TXQ_FLOWS; i++) {
+	busy = flows[i].pkts != 0 || flows[i].list != TXQ_LIST_NONE;
+	// address 0 also marks unused flows, those are set up below
+	if (slip_txq_clients[i].addr == src && (src != 0 || busy))
+	    return i;
+	if (busy)
+	    continue;
+	if (idle == TXQ_NONE ||
+	    (slip_txq_clients[idle].addr != 0 &&
+	     (slip_txq_clients[i].addr == 0 || time_diff(flows[i].last_active, flows[idle].last_active) < 0)))
+	    idle = i;
+    }
+    if (idle == TXQ_NONE)
+	return (src ^ (src >> 8) ^ (src >> 16) ^ (src >> 24)) % SLIP_TXQ_FLOWS;
+
+    os_memset(&flows[idle], 0, sizeof(flows[idle]));
+    slip_txq_clients[idle].addr = src;
+    slip_txq_clients[idle].bytes = 0;
+    slip_txq_clients[idle].drops = 0;
+    return idle;
+}
+
+static void ICACHE_FLASH_ATTR flow_push(struct slip_txq_flow *f, struct pbuf *p)
+{
+    uint8_t e;
+
+    // there is a free entry, the total is checked before
+    for (e = 0; txq[e].p != NULL; e++)
+	;
+    txq[e].p = p;
+    txq[e].tstamp = system_get_time();
+    if (f->pkts == 0)
+	f->head = e;
+    else
+	txq[f->tail].next = e;
+    f->tail = e;
+    f->pkts++;
+    f->bytes += p->tot_len;
+    slip_txq_stats.pkts++;
+    slip_txq_stats.bytes += p->tot_len;
+}
+
+static struct pbuf * ICACHE_FLASH_ATTR flow_pop(struct slip_txq_flow *f)
+{
+    struct pbuf *p;
+    uint8_t e;
+
+    if (f->pkts == 0)
+	return NULL;
+    e = f->head;
+    p = txq[e].p;
+    txq[e].p = NULL;
+    f->head = txq[e].next;
+    f->pkts--;
+    f->bytes -= p->tot_len;
+    slip_txq_stats.pkts--;
+    slip_txq_stats.bytes -= p->tot_len;
+    return p;
+}
+
+static struct pbuf * ICACHE_FLASH_ATTR codel_dodequeue(struct slip_txq_flow *f, uint32_t now, bool *ok_to_drop)
+{
+    uint32_t tstamp;
+    struct pbuf *p;
+
+    *ok_to_drop = false;
+    if (f->pkts == 0) {
+	f->first_above_time = 0;
+	return NULL;
+    }
+    tstamp = txq[f->head].tstamp;
+    p = flow_pop(f);
+
+    if (time_diff(now, tstamp) < (int32_t)slip_txq_stats.target_us ||
+	f->bytes <= SLIP_TXQ_MAXPACKET) {
+	// went below - stay below for at least interval
+	f->first_above_time = 0;
+    } else if (f->first_above_time == 0) {
+	// just went above from below. if still above at first_above_time, will say it's ok to drop
+	f->first_above_time = (now + slip_txq_stats.interval_us) | 1;
+    } else if (time_diff(now, f->first_above_time) >= 0) {
+	*ok_to_drop = true;
+    }
+    return p;
+}
+
+static void ICACHE_FLASH_ATTR codel_drop(uint8_t i, struct pbuf *p)
+{
+    slip_txq_stats.codel_drops++;
+    slip_txq_clients[i].drops++;
+    pbuf_free(p);
+}
+
+static struct pbuf * ICACHE_FLASH_ATTR codel_dequeue(uint8_t i, uint32_t now)
+{
+    struct slip_txq_flow *f = &flows[i];
+    uint32_t delta;
+    bool ok_to_drop;
+    struct pbuf *p;
+
+    p = codel_dodequeue(f, now, &ok_to_drop);
+    if (p == NULL) {
+	f->dropping = false;
+	return NULL;
+    }
+
+    if (f->dropping) {
+	if (!ok_to_drop) {
+	    // sojourn time below target - leave dropping state
+	    f->dropping = false;
+	}
+	// drop as long as the control law says so
+	while (f->dropping && time_diff(now, f->drop_next) >= 0) {
+	    codel_drop(i, p);
+	    f->count++;
+	    p = codel_dodequeue(f, now, &ok_to_drop);
+	    if (!ok_to_drop)
+		f->dropping = false;
+	    else
+		f->drop_next = codel_control_law(f, f->drop_next);
+	}
+    } else if (ok_to_drop) {
+	// the queue has been above target for at least interval: enter dropping state
+	codel_drop(i, p);
+	p = codel_dodequeue(f, now, &ok_to_drop);
+	f->dropping = true;
+	// if min went above target close to when it last went below, assume that
+	// the drop rate that controlled the queue on the last cycle is a good starting point
+	delta = f->count - f->lastcount;
+	f->count = 1;
+	if (delta > 1 && time_diff(now, f->drop_next) < 16 * (int32_t)slip_txq_stats.interval_us)
+	    f->count = delta;
+	f->drop_next = codel_control_law(f, now);
+	f->lastcount = f->count;
+    }
+    return p;
+}
+
+// VJ compresses the header of p in place. Only done for a packet that goes
+// out, the peer's decompressor follows every header the compressor has seen.
+static void ICACHE_FLASH_ATTR txq_compress(struct pbuf *p)
+{
+    uint16_t hlen, clen;
+
+    if (slc == NULL)
+	return;
+    if (sl_compress_tcp(slc, (uint8_t *)p->payload, p->len, &hlen, &clen) == TYPE_COMPRESSED_TCP)
+	pbuf_header(p, -(int16_t)(hlen - clen));
+}
+
+// Deficit round robin over the flows, new flows first (RFC 8290)
+static struct pbuf * ICACHE_FLASH_ATTR fq_dequeue(void)
+{
+    uint32_t now = system_get_time();
+    struct txq_flow_list *l;
+    struct slip_txq_flow *f;
+    struct pbuf *p;
+    uint8_t i;
+
+    for (;;) {
+	if (new_flows.head != TXQ_NONE)
+	    l = &new_flows;
+	else if (old_flows.head != TXQ_NONE)
+	    l = &old_flows;
+	else
+	    return NULL;
+
+	i = l->head;
+	f = &flows[i];
+	if (f->deficit <= 0) {
+	    f->deficit += SLIP_TXQ_QUANTUM;
+	    flow_list_pop(l);
+	    flow_list_add(&old_flows, i, TXQ_LIST_OLD);
+	    continue;
+	}
+
+	p = codel_dequeue(i, now);
+	if (p == NULL) {
+	    flow_list_pop(l);
+	    // an emptied new flow takes a turn in the old list, so a flow can't
+	    // stay ahead of the others by sending a packet at a time
+	    if (l == &new_flows && old_flows.head != TXQ_NONE)
+		flow_list_add(&old_flows, i, TXQ_LIST_OLD);
+	    continue;
+	}
+	txq_compress(p);
+	f->deficit -= p->tot_len;
+	slip_txq_clients[i].bytes += p->tot_len;
+	return p;
+    }
+}
+
+// Makes room by dropping the oldest packet of the flow with the largest
+// backlog, false if the queue is empty
+static bool ICACHE_FLASH_ATTR fq_drop_fattest(void)
+{
+    uint8_t i, fat = 0;
+
+    for (i = 1; i < SLIP_TXQ_FLOWS; i++) {
+	if (flows[i].bytes > flows[fat].bytes)
+	    fat = i;
+    }
+    if (flows[fat].pkts == 0)
+	return false;
+    slip_txq_stats.tail_drops++;
+    slip_txq_clients[fat].drops++;
+    pbuf_free(flow_pop(&flows[fat]));
+    return true;
+}
+
+// Called from the UART TX empty interrupt: SLIP encodes the handed over
+// frames straight from the pbuf payloads into the TX FIFO
+LOCAL uint8
+slip_txq_fill(uint8 room)
+{
+    uint8 n = 0, c;
+
+    while (n < room) {
+	if (tx_esc != 0) {
+	    UART0_TX_FIFO_PUT(tx_esc);
+	    tx_esc = 0;
+	    n++;
+	    continue;
+	}
+	if (tx_q == NULL) {
+	    // start the next frame
+	    if (tx_sent == tx_head)
+		break;
+	    tx_q = tx_slots[tx_sent % SLIP_TXQ_HANDOVER_SLOTS];
+	    tx_off = 0;
+	    UART0_TX_FIFO_PUT(SLIP_END);
+	    n++;
+	    continue;
+	}
+	if (tx_off >= tx_q->len) {
+	    tx_q = tx_q->next;
+	    tx_off = 0;
+	    if (tx_q == NULL) {
+		// frame complete, the task can free it and hand over the next one
+		UART0_TX_FIFO_PUT(SLIP_END);
+		n++;
+		tx_sent++;
+		if (!pump_pending) {
+		    pump_pending = true;
+		    system_os_post(0, SIG_SLIP_TX, 0);
+		}
+	    }
+	    continue;
+	}
+
+	c = ((uint8_t *)tx_q->payload)[tx_off++];
+	switch (c) {
+	case SLIP_END:
+	    UART0_TX_FIFO_PUT(SLIP_ESC);
+	    tx_esc = SLIP_ESC_END;
+	    break;
+	case SLIP_ESC:
+	    UART0_TX_FIFO_PUT(SLIP_ESC);
+	    tx_esc = SLIP_ESC_ESC;
+	    break;
+	default:
+	    UART0_TX_FIFO_PUT(c);
+	    break;
+	}
+	n++;
+    }
+    Bytes_in += n;
+    return n;
+}
+
+void ICACHE_FLASH_ATTR slip_txq_init(uint32_t bit_rate)
+{
+    uint32_t mtu_time;
+
+    // A full frame (10 bit times per byte) must not be considered a standing queue
+    mtu_time = (uint32_t)((uint64_t)SLIP_TXQ_MAXPACKET * 10 * 1000000 / bit_rate);
+    slip_txq_stats.target_us = CODEL_TARGET_MS * 1000;
+    if (slip_txq_stats.target_us < mtu_time)
+	slip_txq_stats.target_us = mtu_time;
+    slip_txq_stats.interval_us = CODEL_INTERVAL_MS * 1000;
+    if (slip_txq_stats.interval_us < 4 * slip_txq_stats.target_us)
+	slip_txq_stats.interval_us = 4 * slip_txq_stats.target_us;
+
+    uart0_tx_fill_fn = slip_txq_fill;
+}
+
+static inline uint16_t get16(const uint8_t *p)
+{
+    return ((uint16_t)p[0] << 8) | p[1];
+}
+
+static inline uint32_t get32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// TCP header of p, if it is an IPv4 TCP packet without IP options that is
+// no fragment (frames in the queue are in one pbuf)
+static uint8_t * ICACHE_FLASH_ATTR txq_tcp_hdr(struct pbuf *p)
+{
+    uint8_t *ip = (uint8_t *)p->payload;
+
+    if (p->len < 40 || ip[0] != 0x45 || ip[9] != IP_PROTO_TCP || (get16(ip + 6) & 0x3fff))
+	return NULL;
+    return ip + 20;
+}
+
+// A pure cumulative ACK: only the ACK flag, no data, no CE mark and no
+// options but timestamps
+static bool ICACHE_FLASH_ATTR txq_pure_ack(struct pbuf *p, uint8_t *th)
+{
+    uint8_t *ip = (uint8_t *)p->payload;
+    uint16_t thl = (th[12] >> 4) << 2;
+    uint16_t i;
+
+    if ((ip[1] & IP_ECN_CE) == IP_ECN_CE || th[13] != TCP_FLAG_ACK)
+	return false;
+    if (thl < 20 || get16(ip + 2) != 20 + thl || p->len < 20 + thl)
+	return false;
+
+    for (i = 20; i < thl; ) {
+	switch (th[i]) {
+	case TCP_OPT_EOL:
+	    return true;
+	case TCP_OPT_NOP:
+	    i++;
+	    break;
+	case TCP_OPT_TS:
+	    if (i + TCP_OPT_TS_LEN > thl || th[i + 1] != TCP_OPT_TS_LEN)
+		return false;
+	    i += TCP_OPT_TS_LEN;
+	    break;
+	default:
+	    // SACK and everything unknown must go out as it is
+	    return false;
+	}
+    }
+    return true;
+}
+
+// Replaces the newest queued packet of the TCP connection of p by p, if both
+// are pure ACKs and p acknowledges more without taking back window. All
+// packets of a connection are in the same flow queue f.
+static bool ICACHE_FLASH_ATTR txq_thin_ack(struct slip_txq_flow *f, struct pbuf *p)
+{
+    uint8_t *ip = (uint8_t *)p->payload, *th, *old_ip, *old_th;
+    struct pbuf *old;
+    uint8_t e, n, last = TXQ_NONE;
+
+    th = txq_tcp_hdr(p);
+    if (th == NULL || !txq_pure_ack(p, th))
+	return false;
+
+    for (e = f->head, n = 0; n < f->pkts; e = txq[e].next, n++) {
+	old_ip = (uint8_t *)txq[e].p->payload;
+	old_th = txq_tcp_hdr(txq[e].p);
+	if (old_th != NULL && os_memcmp(old_ip + 12, ip + 12, 8) == 0 &&
+	    os_memcmp(old_th, th, 4) == 0)
+	    last = e;
+    }
+    if (last == TXQ_NONE)
+	return false;
+
+    // the newest packet of the connection decides
+    old = txq[last].p;
+    old_th = txq_tcp_hdr(old);
+    if (!txq_pure_ack(old, old_th) || get32(old_th + 4) != get32(th + 4) ||
+	(int32_t)(get32(th + 8) - get32(old_th + 8)) <= 0 ||
+	get16(th + 14) < get16(old_th + 14))
+	return false;
+
+    txq[last].p = p;
+    f->bytes = f->bytes - old->tot_len + p->tot_len;
+    slip_txq_stats.bytes = slip_txq_stats.bytes - old->tot_len + p->tot_len;
+    slip_txq_stats.acks_thinned++;
+    pbuf_free(old);
+    return true;
+}
+
+err_t ICACHE_FLASH_ATTR slip_txq_enqueue(struct pbuf *p, uint32_t src)
+{
+    uint8_t i = flow_find(src);
+    struct slip_txq_flow *f = &flows[i];
+
+    f->last_active = system_get_time();
+    if (txq_thin_ack(f, p)) {
+	slip_txq_pump();
+	return ERR_OK;
+    }
+
+    while (slip_txq_stats.pkts >= SLIP_TXQ_MAX_PKTS ||
+	   slip_txq_stats.bytes + p->tot_len > SLIP_TXQ_MAX_BYTES) {
+	if (!fq_drop_fattest()) {
+	    slip_txq_stats.tail_drops++;
+	    slip_txq_clients[i].drops++;
+	    pbuf_free(p);
+	    return ERR_MEM;
+	}
+    }
+
+    flow_push(f, p);
+    if (f->list == TXQ_LIST_NONE) {
+	f->deficit = SLIP_TXQ_QUANTUM;
+	flow_list_add(&new_flows, i, TXQ_LIST_NEW);
+    }
+
+    slip_txq_pump();
+    return ERR_OK;
+}
+
+void ICACHE_FLASH_ATTR slip_txq_pump(void)
+{
+    struct pbuf *p;
+    bool started = false;
+
+    pump_pending = false;
+
+    // Free the frames the interrupt is done with
+    while (tx_freed != tx_sent) {
+	p = tx_slots[tx_freed % SLIP_TXQ_HANDOVER_SLOTS];
+	link_stats_out(LINK_IF_SLIP, p->tot_len);
+	pbuf_free(p);
+	tx_freed++;
+    }
+
+    // Hand over only a short backlog, the standing queue stays under CoDel control
+    while ((uint8_t)(tx_head - tx_sent) < SLIP_TXQ_HANDOVER &&
+	   (uint8_t)(tx_head - tx_freed) < SLIP_TXQ_HANDOVER_SLOTS) {
+	if (hold && hold_flush == 0)
+	    break;
+	p = fq_dequeue();
+	if (p == NULL) {
+	    hold_flush = 0;
+	    break;
+	}
+	if (hold)
+	    hold_flush--;
+	tx_slots[tx_head % SLIP_TXQ_HANDOVER_SLOTS] = p;
+	tx_head++;
+	started = true;
+    }
+
+    if (started) {
+	uart0_tx_start();
+#ifdef STATUS_LED
+	// Turn LED on on traffic
+	GPIO_OUTPUT_SET (STATUS_LED, 0);
+#endif
+    }
+}
+
+void ICACHE_FLASH_ATTR slip_txq_set_compress(struct slcompress *comp)
+{
+    slc = comp;
+}
+
+void ICACHE_FLASH_ATTR slip_txq_hold(bool on)
+{
+    hold = on;
+    hold_flush = on ? slip_txq_stats.pkts : 0;
+    slip_txq_pump();
+}
+
+bool ICACHE_FLASH_ATTR slip_txq_idle(void)
+{
+    return tx_sent == tx_head && (!hold || hold_flush == 0);
+}
+
+bool ICACHE_FLASH_ATTR slip_txq_show_line(uint16_t idx)
+{
+    char response[CONSOLE_LINE_MAX];
+    struct slip_txq_client *c = &slip_txq_clients[idx];
+
+    if (idx >= SLIP_TXQ_FLOWS)
+	return false;
+    if (c->addr == 0)
+	return true;
+    os_sprintf(response, "  from " IPSTR ": %d KiB, %d drops, %d pkts queued\r\n",
+       IP2STR((ip_addr_t *)&c->addr), c->bytes / 1024, c->drops, flows[idx].pkts);
+    console_puts(response);
+    return true;
+}
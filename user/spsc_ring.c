@@ -0,0 +1,60 @@
+#include "c_types.h"
+#include "mem.h"
+#include "osapi.h"
+
+#include "spsc_ring.h"
+
+bool ICACHE_FLASH_ATTR spsc_ring_init(struct spsc_ring *r, uint16_t size)
+{
+    r->head = r->tail = 0;
+    r->mask = 0;
+    r->buf = NULL;
+
+    if (size == 0 || size > SPSC_RING_MAX_SIZE || (size & (size - 1)) != 0)
+	return false;
+
+    r->buf = (uint8_t *)os_malloc(size);
+    if (r->buf == NULL)
+	return false;
+    r->mask = size - 1;
+    return true;
+}
+
+void ICACHE_FLASH_ATTR spsc_ring_free(struct spsc_ring *r)
+{
+    if (r->buf != NULL)
+	os_free(r->buf);
+    r->buf = NULL;
+    r->mask = 0;
+    r->head = r->tail = 0;
+}
+
+// Writes as much of data as fits, returns the number of bytes written
+uint16_t ICACHE_FLASH_ATTR spsc_ring_write(struct spsc_ring *r, const void *data, uint16_t len)
+{
+    const uint8_t *src = (const uint8_t *)data;
+    uint16_t n, done = 0;
+    uint8_t *p;
+
+    while (done < len && (n = spsc_ring_reserve(r, &p, len - done)) > 0) {
+	os_memcpy(p, src + done, n);
+	spsc_ring_commit(r, n);
+	done += n;
+    }
+    return done;
+}
+
+// Reads up to len bytes, returns the number of bytes read
+uint16_t ICACHE_FLASH_ATTR spsc_ring_read(struct spsc_ring *r, void *data, uint16_t len)
+{
+    uint8_t *dst = (uint8_t *)data;
+    uint16_t n, done = 0;
+    uint8_t *p;
+
+    while (done < len && (n = spsc_ring_peek(r, &p, len - done)) > 0) {
+	os_memcpy(dst + done, p, n);
+	spsc_ring_consume(r, n);
+	done += n;
+    }
+    return done;
+}
@@ -1,7 +1,7 @@
 #ifndef _USER_CONFIG_
 #define _USER_CONFIG_
 
-typedef enum {SIG_DO_NOTHING=0, SIG_START_SERVER=2, SIG_SEND_DATA, SIG_CONSOLE_RX, SIG_CONSOLE_TX } USER_SIGNALS;
+typedef enum {SIG_DO_NOTHING=0, SIG_START_SERVER=2, SIG_SEND_DATA, SIG_CONSOLE_RX, SIG_CONSOLE_TX, SIG_SLIP_TX, SIG_PERF_IDLE } USER_SIGNALS;
 
 #define	ESP_SLIP_ROUTER_VERSION "V1.1.1"
 
@@ -28,6 +28,15 @@ typedef enum {SIG_DO_NOTHING=0, SIG_START_SERVER=2, SIG_SEND_DATA, SIG_CONSOLE_R
 //
 #define ALLOW_SCANNING      1
 
+//
+// Define this to support the "perf" command: a throughput test service
+// (TCP discard and chargen, UDP sink and blaster) on the ESP itself
+//
+#define ALLOW_PERF_TEST     1
+#define PERF_DISCARD_PORT   9
+#define PERF_CHARGEN_PORT   19
+#define PERF_UDP_PORT       5001
+
 //
 // Define this if you want to have access to the config console via TCP.
 // Ohterwise only local access via serial is possible
@@ -35,6 +44,12 @@ typedef enum {SIG_DO_NOTHING=0, SIG_START_SERVER=2, SIG_SEND_DATA, SIG_CONSOLE_R
 #define REMOTE_CONFIG      1
 #define CONSOLE_SERVER_PORT  7777
 
+//
+// Port the "capture dump" command opens for fetching the packet capture
+// of the SLIP interface as a pcap file
+//
+#define CAPTURE_PORT         7778
+
 //
 // Define this if you want to emulate a Hayes-compatible modem
 // Otherwise it will be a straight ethernet-SLIP ("direct") connection
@@ -12,12 +12,22 @@
 #include "lwip/app/espconn_tcp.h"
 
 #include "lwip/ip.h"
+#include "lwip/pbuf.h"
 #include "lwip/ip_route.h"
 #include "netif/slipif.h"
 #include "driver/uart.h"
 #include "driver/softuart.h"
 
-#include "ringbuf.h"
+#include "console.h"
+#include "slcompress.h"
+#include "slip_txq.h"
+#include "ip_fwd.h"
+#include "perf_test.h"
+#include "capture.h"
+#include "bcast_filter.h"
+#include "acl.h"
+#include "link_stats.h"
+#include "dns_cache.h"
 #include "user_config.h"
 
 #ifdef ENABLE_HAYES
@@ -30,10 +40,6 @@
 #define user_procTaskQueueLen    10
 os_event_t    user_procTaskQueue[user_procTaskQueueLen];
 
-static char INVALID_LOCKED[] = "Invalid command. Config locked\r\n";
-static char INVALID_NUMARGS[] = "Invalid number of arguments\r\n";
-static char INVALID_ARG[] = "Invalid argument\r\n";
-
 Softuart softuart;
 
 struct netif sl_netif;
@@ -41,318 +47,530 @@ struct netif sl_netif;
 // Holds the system wide configuration
 sysconfig_t config;
 
-static ringbuf_t console_rx_buffer, console_tx_buffer;
-
 static ip_addr_t my_ip, dns_ip;
 bool connected;
 
-uint8_t remote_console_disconnect;
-
 uint32_t g_bit_rate;
 
 uint64_t Bytes_in, Bytes_out;
 
 static os_timer_t ptimer;
 
-// Similar to strtok
-int ICACHE_FLASH_ATTR parse_str_into_tokens(char *str, char **tokens, int max_tokens)
+// VJ header compression state, only allocated in CSLIP mode
+static struct slcompress *slc;
+
+// Fast STA reconnect: directed connect with the cached lease
+#define FAST_CONNECT_TIMEOUT_MS	3000
+static os_timer_t sta_fast_timer;
+static bool sta_fast;
+// The DHCP client checks the cached lease of a fast connect
+static bool sta_renew;
+static uint8_t sta_bssid[6], sta_channel;
+static uint32_t sta_connect_start;
+static uint32_t time_to_ip_ms, fast_connects, full_connects;
+
+// Live bitrate switch: the console reply goes out at the old rate, then the
+// UART is reprogrammed and falls back, if no valid frame comes in at the new one
+#define BITRATE_CONFIRM_MS	500
+#define BITRATE_DRAIN_MS	2000
+#define BITRATE_FALLBACK_MS	10000
+#define BITRATE_MIN		300
+#define BITRATE_MAX		4608000
+enum bitrate_state { BITRATE_IDLE, BITRATE_DRAIN, BITRATE_PROBATION, BITRATE_DRAIN_BACK };
+static os_timer_t bitrate_timer;
+static enum bitrate_state bitrate_state;
+static uint32_t bitrate_old, bitrate_new, bitrate_drain_start;
+static uint32_t bitrate_fallbacks;
+
+// RTS flow control: while the heap runs short of room for PBUF_POOL pbufs, or
+// right after an allocation failed, the rx ring isn't unloaded. The ring and
+// then the UART FIFO fill up and the UART deasserts RTS, so the host pauses
+// instead of slipif dropping frames
+#define FLOW_HOLD_HEAP		(PBUF_POOL_SIZE / 2 * PBUF_POOL_BUFSIZE)
+#define FLOW_HOLD_RETRY_MS	5
+static const char *flow_ctrl_names[] = { "none", "rts", "cts", "rtscts" };
+static os_timer_t flow_hold_timer;
+static bool flow_hold;
+static uint32_t flow_alloc_fails, flow_hold_start;
+static uint32_t flow_holds, flow_hold_ms;
+
+// Table sizes taking effect at boot: the portmap table is saved in one blob,
+// the NAPT table is limited by the heap
+#define PORTMAP_SIZE_MAX	(BLOB_MAX_LEN / sizeof(struct portmap_table))
+#define NAT_SIZE_MAX		4096
+
+
+static void ICACHE_FLASH_ATTR slip_set_mode(uint8_t mode)
 {
-    char *p, *q, *end;
-    int token_count = 0;
-    bool in_token = false;
-
-    // preprocessing
-    for (p = q = str; *p != 0; p++)
-    {
-        if (*(p) == '%' && *(p + 1) != 0 && *(p + 2) != 0)
-        {
-            // quoted hex
-            uint8_t a;
-            p++;
-            if (*p <= '9')
-                a = *p - '0';
-            else
-                a = toupper(*p) - 'A' + 10;
-            a <<= 4;
-            p++;
-            if (*p <= '9')
-                a += *p - '0';
-            else
-                a += toupper(*p) - 'A' + 10;
-            *q++ = a;
-        }
-        else if (*p == '\\' && *(p + 1) != 0)
-        {
-            // next char is quoted - just copy it, skip this one
-            *q++ = *++p;
-        }
-        else if (*p == 8)
-        {
-            // backspace - delete previous char
-            if (q != str)
-                q--;
-        }
-        else if (*p <= ' ')
-        {
-            // mark this as whitespace
-            *q++ = 0;
-        }
-        else
-        {
-            *q++ = *p;
-        }
+    if (mode == SLIP_MODE_CSLIP) {
+	if (slc == NULL)
+	    slc = (struct slcompress *)os_malloc(sizeof(struct slcompress));
+	if (slc != NULL)
+	    sl_compress_init(slc);
+	else
+	    mode = SLIP_MODE_SLIP;
+    } else if (slc != NULL) {
+	os_free(slc);
+	slc = NULL;
     }
+    slip_txq_set_compress(slc);
+    config.slip_mode = mode;
+}
 
-    end = q;
-    *q = 0;
-
-    // cut into tokens
-    for (p = str; p != end; p++)
-    {
-        if (*p == 0)
-        {
-            if (in_token)
-            {
-                in_token = false;
-            }
-        }
-        else
-        {
-            if (!in_token)
-            {
-                tokens[token_count++] = p;
-                if (token_count == max_tokens)
-                    return token_count;
-                in_token = true;
-            }
-        }
+// Allocates the NAPT tables with the configured sizes, smaller if the heap is short
+static void ICACHE_FLASH_ATTR napt_init(void)
+{
+    if (config.nat_size < IP_FWD_NAT_MIN || config.portmap_size == 0 ||
+	config.portmap_size > PORTMAP_SIZE_MAX) {
+	config.nat_size = IP_NAPT_MAX;
+	config.portmap_size = IP_PORTMAP_MAX;
     }
-    return token_count;
+    if (ip_fwd_napt_init(config.nat_size, config.portmap_size) < config.nat_size)
+	os_printf("Not enough heap for %d NAPT entries, using %d\r\n", config.nat_size, ip_napt_max);
 }
 
+static void ICACHE_FLASH_ATTR slip_set_flow_ctrl(uint8_t mode)
+{
+    UART_SetFlowCtrl(UART0, mode, UART_RX_FLOW_THRESH);
+    config.flow_ctrl = mode;
+}
+
+static void ICACHE_FLASH_ATTR flow_hold_timer_cb(void *arg)
+{
+    system_os_post(0, UART0_SIGNAL, 0);
+}
 
-void ICACHE_FLASH_ATTR console_send_response(struct espconn *pespconn)
+// Called before the rx ring is unloaded, true: leave the data where it is for now
+static bool ICACHE_FLASH_ATTR slip_rx_hold(void)
 {
-    char payload[MAX_CON_SEND_SIZE+4];
-    uint16_t len = ringbuf_bytes_used(console_tx_buffer);
+    bool low = false;
 
-    ringbuf_memcpy_from(payload, console_tx_buffer, len);
-    os_memcpy(&payload[len], "CMD>", 4);
+    if (config.flow_ctrl & USART_HardwareFlowControl_RTS)
+	low = system_get_free_heap_size() < FLOW_HOLD_HEAP ||
+	      link_stats.pbuf_alloc_fails != flow_alloc_fails;
+    flow_alloc_fails = link_stats.pbuf_alloc_fails;
 
-    if (pespconn != NULL)
-	espconn_sent(pespconn, payload, len+4);
+    if (low != flow_hold) {
+	if (low) {
+	    flow_holds++;
+	    flow_hold_start = system_get_time();
+	} else {
+	    flow_hold_ms += (system_get_time() - flow_hold_start) / 1000;
+	}
+	flow_hold = low;
+    }
+    if (low) {
+	// once the ring is full, no RX interrupt posts UART0_SIGNAL anymore
+	os_timer_disarm(&flow_hold_timer);
+	os_timer_setfn(&flow_hold_timer, flow_hold_timer_cb, NULL);
+	os_timer_arm(&flow_hold_timer, FLOW_HOLD_RETRY_MS, 0);
+    }
+    return low;
 }
 
 
 #ifdef ALLOW_SCANNING
-struct espconn *scanconn;
+// Results of the last scan, streamed to the console
+struct scan_entry {
+    uint8_t	ssid[33];
+    uint8_t	authmode;
+    sint8	rssi;
+    uint8_t	bssid[6];
+    uint8_t	channel;
+};
+static struct scan_entry *scan_result;
+static uint8_t scan_count;
+
+static bool ICACHE_FLASH_ATTR scan_line(uint16_t idx)
+{
+    char response[CONSOLE_LINE_MAX];
+    struct scan_entry *e;
+
+    if (idx >= scan_count)
+	return false;
+
+    e = &scan_result[idx];
+    os_sprintf(response, "\r(%d,\"%s\",%d,\""MACSTR"\",%d)\r\n",
+	       e->authmode, e->ssid, e->rssi, MAC2STR(e->bssid), e->channel);
+    console_puts(response);
+    return true;
+}
+
 void ICACHE_FLASH_ATTR scan_done(void *arg, STATUS status)
 {
-  uint8 ssid[33];
-  char response[128];
+  struct bss_info *bss_link;
+  uint8_t n;
 
   if (status == OK)
   {
-    struct bss_info *bss_link = (struct bss_info *)arg;
-
-    while (bss_link != NULL)
-    {
-      ringbuf_memcpy_into(console_tx_buffer, "\r", 1);
-
-      os_memset(ssid, 0, 33);
-      if (os_strlen(bss_link->ssid) <= 32)
-      {
-        os_memcpy(ssid, bss_link->ssid, os_strlen(bss_link->ssid));
-      }
-      else
-      {
-        os_memcpy(ssid, bss_link->ssid, 32);
-      }
-      os_sprintf(response, "(%d,\"%s\",%d,\""MACSTR"\",%d)\r\n",
-                 bss_link->authmode, ssid, bss_link->rssi,
-                 MAC2STR(bss_link->bssid),bss_link->channel);
-      ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-      bss_link = bss_link->next.stqe_next;
+    for (n = 0, bss_link = (struct bss_info *)arg; bss_link != NULL && n < 255;
+	 bss_link = bss_link->next.stqe_next)
+	n++;
+
+    // The bss list is gone after the callback, keep a copy for streaming
+    if (scan_result != NULL)
+	os_free(scan_result);
+    scan_count = 0;
+    scan_result = (struct scan_entry *)os_zalloc(n * sizeof(struct scan_entry));
+    if (scan_result != NULL) {
+	for (bss_link = (struct bss_info *)arg; bss_link != NULL && scan_count < n;
+	     bss_link = bss_link->next.stqe_next) {
+	    struct scan_entry *e = &scan_result[scan_count++];
+
+	    os_memcpy(e->ssid, bss_link->ssid, os_strlen(bss_link->ssid) <= 32 ? os_strlen(bss_link->ssid) : 32);
+	    e->authmode = bss_link->authmode;
+	    e->rssi = bss_link->rssi;
+	    os_memcpy(e->bssid, bss_link->bssid, 6);
+	    e->channel = bss_link->channel;
+	}
     }
+    console_stream(scan_line);
   }
   else
   {
-     os_sprintf(response, "scan fail !!!\r\n");
-     ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
+     console_puts("scan fail !!!\r\n");
   }
-  system_os_post(0, SIG_CONSOLE_TX, (ETSParam) scanconn);
+  console_async_end();
 }
-#endif
-
 
-void ICACHE_FLASH_ATTR console_handle_command(struct espconn *pespconn)
+static void ICACHE_FLASH_ATTR cmd_scan(char **tokens, int nTokens)
 {
-    char cmd_line[256];
-    char response[256];
-    char *tokens[6];
-
-    int bytes_count, nTokens, i, j;
-
-    bytes_count = ringbuf_bytes_used(console_rx_buffer);
-    ringbuf_memcpy_from(cmd_line, console_rx_buffer, bytes_count);
+    console_async_begin();
+    wifi_station_scan(NULL,scan_done);
+    console_puts("Scanning...\r\n");
+}
+#endif
 
-    for (i=j=0; i<bytes_count; i++) {
-	if (cmd_line[i] != 8) {
-	   cmd_line[j++] = cmd_line[i];
-	} else {
-	   if (j > 0) j--;
+#ifdef ALLOW_PERF_TEST
+static void ICACHE_FLASH_ATTR cmd_perf(char **tokens, int nTokens)
+{
+    ip_addr_t addr;
+    int port, size, pps, secs;
+
+    if (nTokens == 1 || strcmp(tokens[1], "show") == 0) {
+	console_stream(perf_test_show_line);
+    } else if (strcmp(tokens[1], "start") == 0) {
+	if (perf_test_start())
+	    console_stream(perf_test_show_line);
+	else
+	    console_puts("Out of memory\r\n");
+    } else if (strcmp(tokens[1], "stop") == 0) {
+	perf_test_stop();
+	console_puts("Test service stopped\r\n");
+    } else if (strcmp(tokens[1], "udp") == 0) {
+	if (nTokens < 6) {
+	    console_puts(INVALID_NUMARGS);
+	    return;
+	}
+	addr.addr = ipaddr_addr(tokens[2]);
+	port = atoi(tokens[3]);
+	size = atoi(tokens[4]);
+	pps = atoi(tokens[5]);
+	secs = nTokens > 6 ? atoi(tokens[6]) : 10;
+	if (port < 1 || port > 0xffff || size < 4 || size > PERF_UDP_MAX_SIZE ||
+	    pps < 1 || pps > 0xffff || secs < 1 || secs > PERF_UDP_MAX_SECS) {
+	    console_puts(INVALID_ARG);
+	    return;
 	}
+	if (perf_test_udp(&addr, port, size, pps, secs))
+	    console_stream(perf_test_show_line);
+	else
+	    console_puts("Out of memory\r\n");
+    } else {
+	console_puts(INVALID_ARG);
     }
-    cmd_line[j] = 0;
-
-    cmd_line[bytes_count] = 0;
+}
+#endif
 
-    nTokens = parse_str_into_tokens(cmd_line, tokens, 6);
+static void ICACHE_FLASH_ATTR cmd_bcast(char **tokens, int nTokens)
+{
+    static const char *dst_names[] = { "", "bcast", "mcast", "all" };
+    struct bcast_rule *r = config.bcast_rules;
+    uint8_t dst, i;
+    int n;
+
+    if (nTokens == 1) {
+	console_stream(bcast_filter_show_line);
+	return;
+    }
 
-    if (nTokens == 0) {
-	char c = '\n';
-	ringbuf_memcpy_into(console_tx_buffer, &c, 1);
-	goto command_handled;
+    if (strcmp(tokens[1], "add") == 0) {
+	if (nTokens < 4) {
+	    console_puts(INVALID_NUMARGS);
+	    return;
+	}
+	for (dst = BCAST_DST_BCAST; dst <= BCAST_DST_ALL && strcmp(tokens[2], dst_names[dst]) != 0; dst++)
+	    ;
+	n = strcmp(tokens[3], "any") == 0 ? 0 : atoi(tokens[3]);
+	if (dst > BCAST_DST_ALL || n < 0 || n > 65535 ||
+	    (nTokens > 4 && (atoi(tokens[4]) < 1 || atoi(tokens[4]) > 255))) {
+	    console_puts(INVALID_ARG);
+	    return;
+	}
+	for (i = 0; i < BCAST_RULES_MAX && r[i].dst != BCAST_DST_NONE; i++)
+	    ;
+	if (i == BCAST_RULES_MAX) {
+	    console_puts("Filter table full\r\n");
+	    return;
+	}
+	r[i].dst = dst;
+	r[i].port = n;
+	r[i].rate = nTokens > 4 ? atoi(tokens[4]) : 0;
+    } else if (strcmp(tokens[1], "del") == 0) {
+	n = nTokens > 2 ? atoi(tokens[2]) : 0;
+	if (n < 1 || n > BCAST_RULES_MAX || r[n - 1].dst == BCAST_DST_NONE) {
+	    console_puts(INVALID_ARG);
+	    return;
+	}
+	// keep the order, the first match applies
+	os_memmove(&r[n - 1], &r[n], (BCAST_RULES_MAX - n) * sizeof(struct bcast_rule));
+	os_memset(&r[BCAST_RULES_MAX - 1], 0, sizeof(struct bcast_rule));
+    } else if (strcmp(tokens[1], "default") == 0) {
+	bcast_filter_default(r);
+    } else {
+	console_puts(INVALID_ARG);
+	return;
     }
+    bcast_filter_init(r);
+    console_stream(bcast_filter_show_line);
+}
 
-    if (strcmp(tokens[0], "help") == 0)
-    {
-        os_sprintf(response, "show [stats]\r\nset [ssid|password|auto_connect|addr|addr_peer|speed|bitrate] <val>\r\n");
-        ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-        os_sprintf(response, "set [use_ap|ap_ssid|ap_password|ap_channel|ap_open|ssid_hidden|max_clients|dns] <val>\r\n");
-        ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-        os_sprintf(response, "quit|save|reset [factory]|lock|unlock <password>\r\n");
-        ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-        os_sprintf(response, "portmap [add|remove] [TCP|UDP] <ext_port> <int_addr> <int_port>\r\n");
-        ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-#ifdef ALLOW_SCANNING
-        os_sprintf(response, "scan");
-        ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-#endif
-	ringbuf_memcpy_into(console_tx_buffer, "\r\n", 2);
-        goto command_handled;
+static void ICACHE_FLASH_ATTR cmd_capture(char **tokens, int nTokens)
+{
+    int snaplen;
+
+    if (nTokens == 1) {
+	console_stream(capture_show_line);
+    } else if (strcmp(tokens[1], "start") == 0) {
+	snaplen = nTokens > 2 ? atoi(tokens[2]) : CAPTURE_SNAPLEN_DEFAULT;
+	if (snaplen < CAPTURE_SNAPLEN_MIN || snaplen > CAPTURE_SNAPLEN_MAX)
+	    console_puts(INVALID_ARG);
+	else if (capture_start(snaplen))
+	    console_stream(capture_show_line);
+	else
+	    console_puts("Out of memory\r\n");
+    } else if (strcmp(tokens[1], "stop") == 0) {
+	capture_stop();
+	console_puts("Capture stopped\r\n");
+    } else if (strcmp(tokens[1], "dump") == 0) {
+	if (capture_dump())
+	    console_stream(capture_show_line);
+	else
+	    console_puts("Capture not started\r\n");
+    } else {
+	console_puts(INVALID_ARG);
     }
+}
 
-    if (strcmp(tokens[0], "show") == 0)
-    {
-      int16_t i;
-      struct portmap_table *p;
-      ip_addr_t i_ip;
+static bool ICACHE_FLASH_ATTR show_config_line(uint16_t idx)
+{
+    char response[CONSOLE_LINE_MAX];
+    struct portmap_table *p;
+    ip_addr_t i_ip;
 
-      if (nTokens == 1) {
+    switch (idx) {
+    case 0:
 	os_sprintf(response, "ESP SLIP Router %s (build: %s)\r\n", ESP_SLIP_ROUTER_VERSION, __TIMESTAMP__);
-	ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
+	break;
+    case 1:
         os_sprintf(response, "SLIP: IP: " IPSTR " PeerIP: " IPSTR "\r\n", IP2STR(&config.ip_addr), IP2STR(&config.ip_addr_peer));
-        ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
+	break;
+    case 2:
 	if (config.use_ap) {
 	    os_sprintf(response, "DNS server: " IPSTR "\r\n", IP2STR(&config.ap_dns));
-	    ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-            os_sprintf(response, "AP:  SSID:%s %s PW:%s%s\r\n",
+	} else {
+            os_sprintf(response, "STA: SSID: %.32s [AutoConnect:%d]\r\n",
+                   config.ssid,
+                   config.auto_connect);
+	}
+	break;
+    case 3:
+	// SSID and password on lines of their own, together they may not fit
+	if (config.use_ap) {
+            os_sprintf(response, "AP:  SSID:%.32s %s%s\r\n",
                    config.ap_ssid,
 		   config.ssid_hidden?"[hidden]":"",
-                   config.locked?"***":(char*)config.ap_password,
                    config.ap_open?" [open]":"");
 	} else {
-            os_sprintf(response, "STA: SSID: %s PW: %s [AutoConnect:%d] \r\n",
-                   config.ssid,
-                   config.locked?"***":(char*)config.password,
-                   config.auto_connect);
-            ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-	    if (connected) {
-	       os_sprintf(response, "External IP: " IPSTR "\r\nDNS server: " IPSTR "\r\n", IP2STR(&my_ip), IP2STR(&dns_ip));
-	    } else {
-	       os_sprintf(response, "Not connected to AP\r\n");
-	    }
+            os_sprintf(response, "STA: PW: %.64s\r\n",
+                   config.locked?"***":(char*)config.password);
 	}
-	ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-        os_sprintf(response, "Clock speed: %d\r\n", config.clock_speed);
-        ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-	os_sprintf(response, "Serial bit rate: %d\r\n", config.bit_rate);
-	ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-
-	for (i = 0; i<IP_PORTMAP_MAX; i++) {
-	    p = &ip_portmap_table[i];
-	    if(p->valid) {
-		i_ip.addr = p->daddr;
-		os_sprintf(response, "Portmap: %s: " IPSTR ":%d -> "  IPSTR ":%d\r\n",
-		   p->proto==IP_PROTO_TCP?"TCP":p->proto==IP_PROTO_UDP?"UDP":"???",
-		   IP2STR(&my_ip), ntohs(p->mport), IP2STR(&i_ip), ntohs(p->dport));
-		ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-	    }
+	break;
+    case 4:
+	if (config.use_ap) {
+            os_sprintf(response, "AP:  PW:%.64s\r\n",
+                   config.locked?"***":(char*)config.ap_password);
+	} else if (connected) {
+	    os_sprintf(response, "External IP: " IPSTR "\r\nDNS server: " IPSTR "\r\n", IP2STR(&my_ip), IP2STR(&dns_ip));
+	} else {
+	    os_sprintf(response, "Not connected to AP\r\n");
 	}
-
-	goto command_handled;
-      }
-
-      if (nTokens == 2 && strcmp(tokens[1], "stats") == 0) {
-
-	   os_sprintf(response, "%d KiB in\r\n%d KiB out\r\n",
-         (uint32_t)(Bytes_in/1024), (uint32_t)(Bytes_out/1024));
-	   ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-
-	   os_sprintf(response, "Free mem: %d\r\n", system_get_free_heap_size());
-	   ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-
-	   if (config.use_ap) {
-	     os_sprintf(response, "%d Station%s connected to SoftAP\r\n", wifi_softap_get_station_num(),
-		  wifi_softap_get_station_num()==1?"":"s");
-	     ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-	   } else {
-	     if (connected) {
-		struct netif *sta_nf = (struct netif *)eagle_lwip_getif(0);
-		os_sprintf(response, "STA IP: %d.%d.%d.%d GW: %d.%d.%d.%d\r\n", IP2STR(&sta_nf->ip_addr), IP2STR(&sta_nf->gw));
-		ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-		os_sprintf(response, "STA RSSI: %d\r\n", wifi_station_get_rssi());
-		ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-	     } else {
-		os_sprintf(response, "STA not connected\r\n");
-		ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-	     }
-	   }
-	   goto command_handled;
-      }
-    }
-
-    if (strcmp(tokens[0], "save") == 0)
-    {
-        config_save(&config);
-	// also save the portmap table
-	blob_save(0, (uint32_t *)ip_portmap_table, sizeof(struct portmap_table) * IP_PORTMAP_MAX);
-        os_sprintf(response, "Config saved\r\n");
-        ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-        goto command_handled;
-    }
-#ifdef ALLOW_SCANNING
-    if (strcmp(tokens[0], "scan") == 0)
-    {
-        scanconn = pespconn;
-        wifi_station_scan(NULL,scan_done);
-        os_sprintf(response, "Scanning...\r\n");
-        ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-        goto command_handled;
+	break;
+    case 5:
+        os_sprintf(response, "Clock speed: %d\r\n", config.clock_speed);
+	break;
+    case 6:
+	os_sprintf(response, "Serial bit rate: %d", config.bit_rate);
+	if (g_bit_rate != config.bit_rate)
+	    os_sprintf(response + os_strlen(response), " (now %d)", g_bit_rate);
+	if (bitrate_fallbacks > 0)
+	    os_sprintf(response + os_strlen(response), ", live changes fallen back: %d", bitrate_fallbacks);
+	os_sprintf(response + os_strlen(response), "\r\n");
+	break;
+    case 7:
+	os_sprintf(response, "SLIP mode: %s\r\n", config.slip_mode == SLIP_MODE_CSLIP?"cslip":"slip");
+	break;
+    case 8:
+	os_sprintf(response, "SLIP MTU: %d, TCP MSS clamp: %d\r\n", config.slip_mtu, config.mss_clamp);
+	break;
+    case 9:
+	os_sprintf(response, "Serial flow control: %s\r\n", flow_ctrl_names[config.flow_ctrl & 3]);
+	break;
+    case 10:
+	os_sprintf(response, "DNS cache: %d entries\r\n", config.dns_cache);
+	break;
+    case 11:
+	os_sprintf(response, "NAPT table: %d entries, portmap table: %d entries", config.nat_size, config.portmap_size);
+	if (ip_napt_max != config.nat_size || ip_portmap_max != config.portmap_size)
+	    os_sprintf(response + os_strlen(response), " (now %d/%d)", ip_napt_max, ip_portmap_max);
+	os_sprintf(response + os_strlen(response), "\r\n");
+	break;
+    default:
+	// One line per valid portmap entry
+	if (idx - 12 >= ip_portmap_max)
+	    return false;
+	p = &ip_portmap_table[idx - 12];
+	if (!p->valid)
+	    return true;
+	i_ip.addr = p->daddr;
+	os_sprintf(response, "Portmap: %s: " IPSTR ":%d -> "  IPSTR ":%d\r\n",
+	   p->proto==IP_PROTO_TCP?"TCP":p->proto==IP_PROTO_UDP?"UDP":"???",
+	   IP2STR(&my_ip), ntohs(p->mport), IP2STR(&i_ip), ntohs(p->dport));
+	break;
     }
+    console_puts(response);
+    return true;
+}
+
+static bool ICACHE_FLASH_ATTR show_stats_line(uint16_t idx)
+{
+    char response[CONSOLE_LINE_MAX];
+
+    // the per interface counters follow the byte totals
+    if (idx > 0 && idx <= LINK_STATS_LINES)
+	return link_stats_show_line(idx - 1);
+    if (idx > LINK_STATS_LINES)
+	idx -= LINK_STATS_LINES;
+    // the per source counters follow the TX queue totals
+    if (idx >= 2 && idx < 2 + SLIP_TXQ_FLOWS)
+	return slip_txq_show_line(idx - 2);
+    if (idx >= 2 + SLIP_TXQ_FLOWS)
+	idx -= SLIP_TXQ_FLOWS;
+
+    switch (idx) {
+    case 0:
+	os_sprintf(response, "%d KiB in\r\n%d KiB out\r\n",
+	   (uint32_t)(Bytes_in/1024), (uint32_t)(Bytes_out/1024));
+	break;
+    case 1:
+	os_sprintf(response, "SLIP TX queue: %d pkts %d bytes, drops: %d CoDel %d full, %d ACKs thinned\r\n",
+	   slip_txq_stats.pkts, slip_txq_stats.bytes, slip_txq_stats.codel_drops, slip_txq_stats.tail_drops,
+	   slip_txq_stats.acks_thinned);
+	break;
+    case 2:
+	os_sprintf(response, "TCP MSS clamped: %d SYNs\r\n", ip_fwd_stats.mss_clamped);
+	break;
+    case 3:
+	os_sprintf(response, "Too big for the MTU: %d pkts, ICMP frag needed sent %d, rate limited %d\r\n",
+	   ip_fwd_stats.too_big, ip_fwd_stats.frag_needed, ip_fwd_stats.icmp_limited);
+	break;
+    case 4:
+	dns_cache_show_line(0);
+	return true;
+    case 5:
+	if (!(config.flow_ctrl & USART_HardwareFlowControl_RTS) && flow_holds == 0)
+	    return true;
+	os_sprintf(response, "SLIP RX held for RTS: %d times, %d ms%s\r\n",
+	   flow_holds, flow_hold_ms, flow_hold ? " (now)" : "");
+	break;
+    case 6:
+#ifdef DEBUG_SOFTUART
+	os_sprintf(response, "Free mem: %d\r\nDebug output dropped: %d chars\r\n",
+	   system_get_free_heap_size(), softuart.tx.dropped);
+#else
+	os_sprintf(response, "Free mem: %d\r\n", system_get_free_heap_size());
 #endif
-    if (strcmp(tokens[0], "reset") == 0)
-    {
-	if (nTokens == 2 && strcmp(tokens[1], "factory") == 0) {
-           config_load_default(&config);
-           config_save(&config);
-	   // clear saved portmap table
-	   blob_zero(0, sizeof(struct portmap_table) * IP_PORTMAP_MAX);
+	break;
+    case 7:
+	if (config.use_ap) {
+	    os_sprintf(response, "%d Station%s connected to SoftAP\r\n", wifi_softap_get_station_num(),
+		wifi_softap_get_station_num()==1?"":"s");
+	} else if (connected) {
+	    struct netif *sta_nf = (struct netif *)eagle_lwip_getif(0);
+	    os_sprintf(response, "STA IP: %d.%d.%d.%d GW: %d.%d.%d.%d\r\n", IP2STR(&sta_nf->ip_addr), IP2STR(&sta_nf->gw));
+	} else {
+	    os_sprintf(response, "STA not connected\r\n");
 	}
-        os_printf("Restarting ... \r\n");
-	system_restart();
-        while(true);
+	break;
+    case 8:
+	if (config.use_ap || !connected)
+	    return false;
+	os_sprintf(response, "STA RSSI: %d\r\n", wifi_station_get_rssi());
+	break;
+    case 9:
+	if (config.use_ap || !connected)
+	    return false;
+	os_sprintf(response, "Time to IP: %d ms (%s), connects: %d fast %d full\r\n",
+	   time_to_ip_ms, sta_fast?"fast":"full", fast_connects, full_connects);
+	break;
+    default:
+	return false;
     }
+    console_puts(response);
+    return true;
+}
 
-    if (strcmp(tokens[0], "quit") == 0)
-    {
-	remote_console_disconnect = 1;
-        goto command_handled;
+static void ICACHE_FLASH_ATTR cmd_show(char **tokens, int nTokens)
+{
+    if (nTokens == 1)
+	console_stream(show_config_line);
+    else if (nTokens == 2 && strcmp(tokens[1], "stats") == 0)
+	console_stream(show_stats_line);
+    else
+	console_puts(INVALID_ARG);
+}
+
+static void ICACHE_FLASH_ATTR cmd_save(char **tokens, int nTokens)
+{
+    config_save(&config);
+    // also save the portmap table
+    blob_save(0, (uint32_t *)ip_portmap_table, sizeof(struct portmap_table) * ip_portmap_max);
+    // and the ACL
+    blob_save(1, (uint32_t *)acl_rules, sizeof(acl_rules));
+    console_puts("Config saved\r\n");
+}
+
+static void ICACHE_FLASH_ATTR cmd_reset(char **tokens, int nTokens)
+{
+    if (nTokens == 2 && strcmp(tokens[1], "factory") == 0) {
+	config_load_default(&config);
+	config_save(&config);
+	// clear saved portmap table and ACL
+	blob_zero(0, sizeof(struct portmap_table) * PORTMAP_SIZE_MAX);
+	blob_zero(1, sizeof(acl_rules));
     }
+    os_printf("Restarting ... \r\n");
+    system_restart();
+    while(true);
+}
 
-    if (strcmp(tokens[0], "portmap") == 0)
-    {
+static void ICACHE_FLASH_ATTR cmd_quit(char **tokens, int nTokens)
+{
+    console_quit();
+}
+
+static void ICACHE_FLASH_ATTR cmd_portmap(char **tokens, int nTokens)
+{
     uint32_t daddr;
     uint16_t mport;
     uint16_t dport;
@@ -360,309 +578,540 @@ void ICACHE_FLASH_ATTR console_handle_command(struct espconn *pespconn)
     bool add;
     uint8_t retval;
 
-        if (config.locked)
-        {
-            os_sprintf(response, INVALID_LOCKED);
-	    ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-            goto command_handled;
-        }
+    if (strcmp(tokens[1],"add")==0 && nTokens != 6) {
+	console_puts(INVALID_NUMARGS);
+	return;
+    }
 
-        if (nTokens < 4 || (strcmp(tokens[1],"add")==0 && nTokens != 6))
-        {
-            os_sprintf(response, INVALID_NUMARGS);
-	    ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-	    goto command_handled;
-        }
+    add = strcmp(tokens[1],"add")==0;
+    if (!add && strcmp(tokens[1],"remove")!=0) {
+	console_puts(INVALID_ARG);
+	return;
+    }
 
-        add = strcmp(tokens[1],"add")==0;
-	if (!add && strcmp(tokens[1],"remove")!=0) {
-	    os_sprintf(response, INVALID_ARG);
-	    ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-	    goto command_handled;
-	}
+    if (strcmp(tokens[2],"TCP") == 0) proto = IP_PROTO_TCP;
+    else if (strcmp(tokens[2],"UDP") == 0) proto = IP_PROTO_UDP;
+    else {
+	console_puts(INVALID_ARG);
+	return;
+    }
 
-	if (strcmp(tokens[2],"TCP") == 0) proto = IP_PROTO_TCP;
-	else if (strcmp(tokens[2],"UDP") == 0) proto = IP_PROTO_UDP;
-        else {
-	    os_sprintf(response, INVALID_ARG);
-	    ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-	    goto command_handled;
-	}
+    mport = (uint16_t)atoi(tokens[3]);
+    if (add) {
+	daddr = ipaddr_addr(tokens[4]);
+	dport = atoi(tokens[5]);
+	retval = ip_portmap_add(proto, my_ip.addr, mport, daddr, dport);
+    } else {
+	retval = ip_portmap_remove(proto, mport);
+    }
 
-        mport = (uint16_t)atoi(tokens[3]);
-	if (add) {
-	    daddr = ipaddr_addr(tokens[4]);
-            dport = atoi(tokens[5]);
-	    retval = ip_portmap_add(proto, my_ip.addr, mport, daddr, dport);
-	} else {
-            retval = ip_portmap_remove(proto, mport);
-	}
+    if (retval)
+	console_puts(add?"Portmap set\r\n":"Portmap deleted\r\n");
+    else
+	console_puts("Portmap failed\r\n");
+}
 
-	if (retval) {
-	    os_sprintf(response, "Portmap %s\r\n", add?"set":"deleted");
-	} else {
-	    os_sprintf(response, "Portmap failed\r\n");
+// True if s is a plain decimal number, atoi() makes 0 of anything else
+static bool ICACHE_FLASH_ATTR is_number(const char *s)
+{
+    if (*s == '\0')
+	return false;
+    for (; *s != '\0'; s++) {
+	if (*s < '0' || *s > '9')
+	    return false;
+    }
+    return true;
+}
+
+static void ICACHE_FLASH_ATTR cmd_acl(char **tokens, int nTokens)
+{
+    enum acl_action action;
+    uint32_t src;
+    int n, len, lo, hi, proto;
+    char *s;
+
+    if (nTokens == 1 || strcmp(tokens[1], "show") == 0) {
+	console_stream(acl_show_line);
+	return;
+    }
+
+    if (strcmp(tokens[1], "del") == 0) {
+	if (nTokens != 3) {
+	    console_puts(INVALID_NUMARGS);
+	    return;
+	}
+	n = atoi(tokens[2]);
+	if (n < 1 || n > acl_count()) {
+	    console_puts(INVALID_ARG);
+	    return;
 	}
-	ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-        goto command_handled;
+	acl_del(n);
+	console_stream(acl_show_line);
+	return;
     }
 
-    if (strcmp(tokens[0], "lock") == 0)
-    {
-	config.locked = 1;
-	os_sprintf(response, "Config locked\r\n");
-	ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-        goto command_handled;
+    if (strcmp(tokens[1], "add") != 0) {
+	console_puts(INVALID_ARG);
+	return;
+    }
+    if (nTokens < 5 || nTokens > 6) {
+	console_puts(INVALID_NUMARGS);
+	return;
     }
 
-    if (strcmp(tokens[0], "unlock") == 0)
-    {
-        if (nTokens != 2)
-        {
-            os_sprintf(response, INVALID_NUMARGS);
-            ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-        }
-        else if (strcmp(tokens[1],config.password) == 0) {
-	    config.locked = 0;
-	    os_sprintf(response, "Config unlocked\r\n");
-            ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-        } else {
-	    os_sprintf(response, "Unlock failed. Invalid password\r\n");
-	    ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-        }
-        goto command_handled;
+    if (strcmp(tokens[2], "allow") == 0) action = ACL_ALLOW;
+    else if (strcmp(tokens[2], "drop") == 0) action = ACL_DROP;
+    else action = ACL_NONE;
+
+    if (strcmp(tokens[3], "any") == 0) proto = 0;
+    else if (strcmp(tokens[3], "icmp") == 0) proto = IP_PROTO_ICMP;
+    else if (strcmp(tokens[3], "tcp") == 0) proto = IP_PROTO_TCP;
+    else if (strcmp(tokens[3], "udp") == 0) proto = IP_PROTO_UDP;
+    else if (is_number(tokens[3])) proto = atoi(tokens[3]);
+    else proto = -1;
+
+    // <addr>[/<len>]
+    len = 32;
+    s = strchr(tokens[4], '/');
+    if (s != NULL) {
+	*s++ = '\0';
+	len = is_number(s) ? atoi(s) : -1;
+    }
+    src = ipaddr_addr(tokens[4]);
+    // IPADDR_NONE is also the result of a parse error
+    if (src == IPADDR_NONE && strcmp(tokens[4], "255.255.255.255") != 0)
+	len = -1;
+
+    // [<port>[-<port>]]
+    lo = 0;
+    hi = 0xffff;
+    if (nTokens == 6) {
+	s = strchr(tokens[5], '-');
+	if (s != NULL)
+	    *s++ = '\0';
+	else
+	    s = tokens[5];
+	lo = is_number(tokens[5]) ? atoi(tokens[5]) : -1;
+	hi = is_number(s) ? atoi(s) : -1;
     }
 
+    if (proto < 0 || proto > 255 || len < 0 || len > 32 || lo < 0 || lo > hi || hi > 0xffff ||
+	(nTokens == 6 && proto != IP_PROTO_TCP && proto != IP_PROTO_UDP) ||
+	!acl_add(action, proto, src, len, lo, hi)) {
+	console_puts(INVALID_ARG);
+	return;
+    }
+    console_stream(acl_show_line);
+}
 
-    if (strcmp(tokens[0], "set") == 0)
-    {
-        if (config.locked)
-        {
-            os_sprintf(response, INVALID_LOCKED);
-            ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-            goto command_handled;
-        }
+static void ICACHE_FLASH_ATTR cmd_lock(char **tokens, int nTokens)
+{
+    config.locked = 1;
+    console_puts("Config locked\r\n");
+}
 
-        /*
-         * For set commands atleast 2 tokens "set" "parameter" "value" is needed
-         * hence the check
-         */
-        if (nTokens < 3)
-        {
-            os_sprintf(response, INVALID_NUMARGS);
-            ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-            goto command_handled;
-        }
-        else
-        {
-            // atleast 3 tokens, proceed
-            if (strcmp(tokens[1],"ssid") == 0)
-            {
-                os_sprintf(config.ssid, "%s", tokens[2]);
-                os_sprintf(response, "SSID set\r\n");
-                ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-                goto command_handled;
-            }
-
-            if (strcmp(tokens[1],"password") == 0)
-            {
-                os_sprintf(config.password, "%s", tokens[2]);
-                os_sprintf(response, "Password set\r\n");
-                ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-                goto command_handled;
-            }
-
-            if (strcmp(tokens[1],"auto_connect") == 0)
-            {
-                config.auto_connect = atoi(tokens[2]);
-                os_sprintf(response, "Auto Connect set\r\n");
-                ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-                goto command_handled;
-            }
-
-            if (strcmp(tokens[1],"ap_ssid") == 0)
-            {
-                os_sprintf(config.ap_ssid, "%s", tokens[2]);
-                os_sprintf(response, "AP SSID set\r\n");
-		ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-                goto command_handled;
-            }
-
-            if (strcmp(tokens[1],"ap_password") == 0)
-            {
-		if (os_strlen(tokens[2])<8) {
-		    os_sprintf(response, "Password too short (min. 8)\r\n");
-		} else {
-                    os_sprintf(config.ap_password, "%s", tokens[2]);
-		    config.ap_open = 0;
-                    os_sprintf(response, "AP Password set\r\n");
-		}
-		ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-                goto command_handled;
-            }
-
-            if (strcmp(tokens[1],"ap_open") == 0)
-            {
-                config.ap_open = atoi(tokens[2]);
-                os_sprintf(response, "Open Auth set\r\n");
-		ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-                goto command_handled;
-            }
-
-            if (strcmp(tokens[1],"use_ap") == 0)
-            {
-                config.use_ap = atoi(tokens[2]);
-		if (config.use_ap)
-                    os_sprintf(response, "Using AP interface\r\n");
-		else
-                    os_sprintf(response, "Using STA interface\r\n");
-		ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-                goto command_handled;
-            }
-
-            if (strcmp(tokens[1],"ap_channel") == 0)
-            {
-		uint8_t chan = atoi(tokens[2]);
-		if (chan >= 1 && chan <= 13) {
-		    config.ap_channel = chan;
-            	    os_sprintf(response, "AP channel set to %d\r\n", config.ap_channel);
-		} else {
-		    os_sprintf(response, "Invalid channel (1-13)\r\n");
-		}
-		ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-                goto command_handled;
-            }
-
-            if (strcmp(tokens[1],"ssid_hidden") == 0)
-            {
-                config.ssid_hidden = atoi(tokens[2]);
-                os_sprintf(response, "Hidden SSID set\r\n");
-		ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-                goto command_handled;
-            }
-
-            if (strcmp(tokens[1],"max_clients") == 0)
-            {
-		if (atoi(tokens[2]) <= MAX_CLIENTS) {
-		    config.max_clients = atoi(tokens[2]);
-		    os_sprintf(response, "Max clients set\r\n");
-		} else {
-		    os_sprintf(response, "Invalid val (<= 8)\r\n");
-		}
-		ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-                goto command_handled;
-            }
-
-            if (strcmp(tokens[1],"dns") == 0)
-            {
-                config.ap_dns.addr = ipaddr_addr(tokens[2]);
-                os_sprintf(response, "DNS address set to %d.%d.%d.%d/24\r\n",
-			IP2STR(&config.ap_dns));
-                ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-                goto command_handled;
-            }
-
-	    if (strcmp(tokens[1], "speed") == 0)
-	    {
-		uint16_t speed = atoi(tokens[2]);
-		bool succ = system_update_cpu_freq(speed);
-		if (succ)
-		    config.clock_speed = speed;
-		os_sprintf(response, "Clock speed update %s\r\n",
-		  succ?"successful":"failed");
-		ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-        	goto command_handled;
-	    }
+static void ICACHE_FLASH_ATTR cmd_unlock(char **tokens, int nTokens)
+{
+    if (nTokens != 2) {
+	console_puts(INVALID_NUMARGS);
+    } else if (strcmp(tokens[1],config.password) == 0) {
+	config.locked = 0;
+	console_puts("Config unlocked\r\n");
+    } else {
+	console_puts("Unlock failed. Invalid password\r\n");
+    }
+}
 
-            if (strcmp(tokens[1],"addr") == 0)
-            {
-                config.ip_addr.addr = ipaddr_addr(tokens[2]);
-                os_sprintf(response, "IP address set to %d.%d.%d.%d/24\r\n",
-			IP2STR(&config.ip_addr));
-                ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-                goto command_handled;
-            }
-
-            if (strcmp(tokens[1],"addr_peer") == 0)
-            {
-                config.ip_addr_peer.addr = ipaddr_addr(tokens[2]);
-                os_sprintf(response, "IP peer address set to %d.%d.%d.%d/24\r\n",
-			IP2STR(&config.ip_addr_peer));
-                ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-                goto command_handled;
-            }
-
-
-            if (strcmp(tokens[1],"bitrate") == 0)
-            {
-                config.bit_rate = atoi(tokens[2]);
-                os_sprintf(response, "Bitrate will be %d after save & reset.\r\n", config.bit_rate);
-                ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
-                goto command_handled;
-            }
-        }
+static bool ICACHE_FLASH_ATTR console_locked(void)
+{
+    return config.locked;
+}
+
+/*
+ * "set <param> <val>" handlers, tokens[2] is the value
+ */
+static void ICACHE_FLASH_ATTR set_ssid(char **tokens, int nTokens)
+{
+    os_sprintf(config.ssid, "%s", tokens[2]);
+    os_memset(&config.sta_cache, 0, sizeof(sta_cache_t));
+    console_puts("SSID set\r\n");
+}
+
+static void ICACHE_FLASH_ATTR set_password(char **tokens, int nTokens)
+{
+    os_sprintf(config.password, "%s", tokens[2]);
+    os_memset(&config.sta_cache, 0, sizeof(sta_cache_t));
+    console_puts("Password set\r\n");
+}
+
+static void ICACHE_FLASH_ATTR set_auto_connect(char **tokens, int nTokens)
+{
+    config.auto_connect = atoi(tokens[2]);
+    console_puts("Auto Connect set\r\n");
+}
+
+static void ICACHE_FLASH_ATTR set_ap_ssid(char **tokens, int nTokens)
+{
+    os_sprintf(config.ap_ssid, "%s", tokens[2]);
+    console_puts("AP SSID set\r\n");
+}
+
+static void ICACHE_FLASH_ATTR set_ap_password(char **tokens, int nTokens)
+{
+    if (os_strlen(tokens[2])<8) {
+	console_puts("Password too short (min. 8)\r\n");
+    } else {
+	os_sprintf(config.ap_password, "%s", tokens[2]);
+	config.ap_open = 0;
+	console_puts("AP Password set\r\n");
     }
+}
 
-    /* Control comes here only if the tokens[0] command is not handled */
-    os_sprintf(response, "\r\nInvalid Command\r\n");
-    ringbuf_memcpy_into(console_tx_buffer, response, os_strlen(response));
+static void ICACHE_FLASH_ATTR set_ap_open(char **tokens, int nTokens)
+{
+    config.ap_open = atoi(tokens[2]);
+    console_puts("Open Auth set\r\n");
+}
 
-command_handled:
-    system_os_post(0, SIG_CONSOLE_TX, (ETSParam) pespconn);
-    return;
+static void ICACHE_FLASH_ATTR set_use_ap(char **tokens, int nTokens)
+{
+    config.use_ap = atoi(tokens[2]);
+    if (config.use_ap)
+	console_puts("Using AP interface\r\n");
+    else
+	console_puts("Using STA interface\r\n");
 }
 
-#ifdef REMOTE_CONFIG
-static void ICACHE_FLASH_ATTR tcp_client_recv_cb(void *arg,
-                                                 char *data,
-                                                 unsigned short length)
+static void ICACHE_FLASH_ATTR set_ap_channel(char **tokens, int nTokens)
 {
-    struct espconn *pespconn = (struct espconn *)arg;
-    int            index;
-    uint8_t         ch;
+    char response[40];
+    uint8_t chan = atoi(tokens[2]);
 
-    for (index=0; index <length; index++)
-    {
-        ch = *(data+index);
-	ringbuf_memcpy_into(console_rx_buffer, &ch, 1);
+    if (chan >= 1 && chan <= 13) {
+	config.ap_channel = chan;
+	os_sprintf(response, "AP channel set to %d\r\n", config.ap_channel);
+	console_puts(response);
+    } else {
+	console_puts("Invalid channel (1-13)\r\n");
+    }
+}
+
+static void ICACHE_FLASH_ATTR set_ssid_hidden(char **tokens, int nTokens)
+{
+    config.ssid_hidden = atoi(tokens[2]);
+    console_puts("Hidden SSID set\r\n");
+}
 
-        // If a complete commandline is received, then signal the main
-        // task that command is available for processing
-        if (ch == '\n')
-            system_os_post(0, SIG_CONSOLE_RX, (ETSParam) arg);
+static void ICACHE_FLASH_ATTR set_max_clients(char **tokens, int nTokens)
+{
+    if (atoi(tokens[2]) <= MAX_CLIENTS) {
+	config.max_clients = atoi(tokens[2]);
+	console_puts("Max clients set\r\n");
+    } else {
+	console_puts("Invalid val (<= 8)\r\n");
     }
+}
+
+// DNS server the DHCP server of the SoftAP hands out: with the DNS proxy the
+// stations ask the ESP itself, it forwards to ap_dns
+static void ICACHE_FLASH_ATTR ap_set_dhcps_dns(bool proxy)
+{
+    struct ip_info ap_info;
 
-    *(data+length) = 0;
+    dns_cache_set_server(&config.ap_dns);
+    if (proxy) {
+	wifi_get_ip_info(SOFTAP_IF, &ap_info);
+	dhcps_set_DNS(&ap_info.ip);
+    } else {
+	dhcps_set_DNS(&config.ap_dns);
+    }
 }
 
+static void ICACHE_FLASH_ATTR set_dns(char **tokens, int nTokens)
+{
+    char response[48];
+
+    config.ap_dns.addr = ipaddr_addr(tokens[2]);
+    if (config.use_ap)
+	ap_set_dhcps_dns(config.dns_cache > 0);
+    os_sprintf(response, "DNS address set to %d.%d.%d.%d/24\r\n", IP2STR(&config.ap_dns));
+    console_puts(response);
+}
 
-static void ICACHE_FLASH_ATTR tcp_client_discon_cb(void *arg)
+static void ICACHE_FLASH_ATTR set_speed(char **tokens, int nTokens)
 {
-    os_printf("tcp_client_discon_cb(): client disconnected\n");
-    struct espconn *pespconn = (struct espconn *)arg;
+    uint16_t speed = atoi(tokens[2]);
+    bool succ = system_update_cpu_freq(speed);
+
+    if (succ)
+	config.clock_speed = speed;
+    console_puts(succ?"Clock speed update successful\r\n":"Clock speed update failed\r\n");
 }
 
+static void ICACHE_FLASH_ATTR set_addr(char **tokens, int nTokens)
+{
+    char response[48];
+
+    config.ip_addr.addr = ipaddr_addr(tokens[2]);
+    os_sprintf(response, "IP address set to %d.%d.%d.%d/24\r\n", IP2STR(&config.ip_addr));
+    console_puts(response);
+}
+
+static void ICACHE_FLASH_ATTR set_addr_peer(char **tokens, int nTokens)
+{
+    char response[48];
+
+    config.ip_addr_peer.addr = ipaddr_addr(tokens[2]);
+    os_sprintf(response, "IP peer address set to %d.%d.%d.%d/24\r\n", IP2STR(&config.ip_addr_peer));
+    console_puts(response);
+}
+
+static void ICACHE_FLASH_ATTR bitrate_timer_cb(void *arg)
+{
+    uint32_t rate = bitrate_state == BITRATE_DRAIN ? bitrate_new : bitrate_old;
+
+    switch (bitrate_state) {
+    case BITRATE_DRAIN:
+    case BITRATE_DRAIN_BACK:
+	// everything queued so far goes out at the current rate, newer frames wait
+	if (bitrate_drain_start == 0) {
+	    bitrate_drain_start = system_get_time() | 1;
+	    slip_txq_hold(true);
+	}
+	if ((!slip_txq_idle() || !UART_CheckOutputFinished(UART0, 0)) &&
+	    system_get_time() - bitrate_drain_start < BITRATE_DRAIN_MS * 1000) {
+	    os_timer_arm(&bitrate_timer, 10, 0);
+	    return;
+	}
+	bitrate_drain_start = 0;
+
+	UART_SetBaudrate(UART0, rate);
+	g_bit_rate = rate;
+	slip_txq_init(rate);
+	slip_txq_hold(false);
+	os_printf("Bitrate now %d\r\n", rate);
+
+	if (bitrate_state == BITRATE_DRAIN) {
+	    bitrate_state = BITRATE_PROBATION;
+	    os_timer_arm(&bitrate_timer, BITRATE_FALLBACK_MS, 0);
+	} else {
+	    bitrate_state = BITRATE_IDLE;
+	}
+	break;
+
+    case BITRATE_PROBATION:
+	// no valid frame at the new rate, the peer didn't follow
+	bitrate_fallbacks++;
+	bitrate_state = BITRATE_DRAIN_BACK;
+	bitrate_timer_cb(NULL);
+	break;
+
+    default:
+	break;
+    }
+}
+
+// Called for every valid frame from the SLIP link
+static void ICACHE_FLASH_ATTR bitrate_frame_ok(void)
+{
+    if (bitrate_state != BITRATE_PROBATION)
+	return;
+    os_timer_disarm(&bitrate_timer);
+    bitrate_state = BITRATE_IDLE;
+    config.bit_rate = bitrate_new;
+}
+
+static void ICACHE_FLASH_ATTR set_bitrate(char **tokens, int nTokens)
+{
+    char response[96];
+    uint32_t rate = atoi(tokens[2]);
+
+    if (rate < BITRATE_MIN || rate > BITRATE_MAX) {
+	console_puts(INVALID_ARG);
+	return;
+    }
+
+    if (nTokens < 4 || strcmp(tokens[3], "now") != 0) {
+	config.bit_rate = rate;
+	os_sprintf(response, "Bitrate will be %d after save & reset.\r\n", config.bit_rate);
+	console_puts(response);
+	return;
+    }
+
+    if (bitrate_state != BITRATE_IDLE) {
+	console_puts("Bitrate change in progress\r\n");
+	return;
+    }
+    bitrate_old = g_bit_rate;
+    bitrate_new = rate;
+    bitrate_state = BITRATE_DRAIN;
+    bitrate_drain_start = 0;
+    os_timer_disarm(&bitrate_timer);
+    os_timer_setfn(&bitrate_timer, bitrate_timer_cb, NULL);
+    os_timer_arm(&bitrate_timer, BITRATE_CONFIRM_MS, 0);
+
+    os_sprintf(response, "Switching to %d, back to %d if no frame is received within %d s\r\n",
+       bitrate_new, bitrate_old, BITRATE_FALLBACK_MS / 1000);
+    console_puts(response);
+}
+
+static void ICACHE_FLASH_ATTR set_slip_mode(char **tokens, int nTokens)
+{
+    if (strcmp(tokens[2],"cslip") == 0) {
+	slip_set_mode(SLIP_MODE_CSLIP);
+    } else if (strcmp(tokens[2],"slip") == 0) {
+	slip_set_mode(SLIP_MODE_SLIP);
+    } else {
+	console_puts(INVALID_ARG);
+	return;
+    }
+    console_puts(config.slip_mode == SLIP_MODE_CSLIP?"SLIP mode set to cslip\r\n":"SLIP mode set to slip\r\n");
+}
+
+static void ICACHE_FLASH_ATTR set_mss_clamp(char **tokens, int nTokens)
+{
+    char response[40];
+    int mss = atoi(tokens[2]);
+
+    // 0: off, else from the MSS of a 128 byte MTU up to that of Ethernet
+    if (mss != 0 && (mss < 88 || mss > 1460)) {
+	console_puts(INVALID_ARG);
+	return;
+    }
+    config.mss_clamp = mss;
+    os_sprintf(response, "TCP MSS clamp set to %d\r\n", config.mss_clamp);
+    console_puts(response);
+}
+
+static void ICACHE_FLASH_ATTR set_slip_mtu(char **tokens, int nTokens)
+{
+    char response[40];
+    int mtu = atoi(tokens[2]);
+
+    if (mtu < 68 || mtu > 1500) {
+	console_puts(INVALID_ARG);
+	return;
+    }
+    config.slip_mtu = sl_netif.mtu = mtu;
+    os_sprintf(response, "SLIP MTU set to %d\r\n", config.slip_mtu);
+    console_puts(response);
+}
+
+static void ICACHE_FLASH_ATTR set_nat_size(char **tokens, int nTokens)
+{
+    char response[64];
+    int size = atoi(tokens[2]);
+
+    if (size < IP_FWD_NAT_MIN || size > NAT_SIZE_MAX) {
+	console_puts(INVALID_ARG);
+	return;
+    }
+    config.nat_size = size;
+    os_sprintf(response, "NAPT table will have %d entries after save & reset\r\n", config.nat_size);
+    console_puts(response);
+}
 
-/* Called when a client connects to the console server */
-static void ICACHE_FLASH_ATTR tcp_client_connected_cb(void *arg)
+static void ICACHE_FLASH_ATTR set_portmap_size(char **tokens, int nTokens)
 {
-    char payload[128];
-    struct espconn *pespconn = (struct espconn *)arg;
+    char response[64];
+    int size = atoi(tokens[2]);
+
+    if (size < 1 || size > (int)PORTMAP_SIZE_MAX) {
+	console_puts(INVALID_ARG);
+	return;
+    }
+    config.portmap_size = size;
+    os_sprintf(response, "Portmap table will have %d entries after save & reset\r\n", config.portmap_size);
+    console_puts(response);
+}
 
-    os_printf("tcp_client_connected_cb(): Client connected\r\n");
+static void ICACHE_FLASH_ATTR set_flow_ctrl(char **tokens, int nTokens)
+{
+    char response[40];
+    uint8_t mode;
 
-    //espconn_regist_sentcb(pespconn,     tcp_client_sent_cb);
-    espconn_regist_disconcb(pespconn,   tcp_client_discon_cb);
-    espconn_regist_recvcb(pespconn,     tcp_client_recv_cb);
-    espconn_regist_time(pespconn,  300, 1);  // Specific to console only
+    for (mode = 0; mode < 4; mode++) {
+	if (strcmp(tokens[2], flow_ctrl_names[mode]) == 0)
+	    break;
+    }
+    if (mode == 4) {
+	console_puts(INVALID_ARG);
+	return;
+    }
+    slip_set_flow_ctrl(mode);
+    os_sprintf(response, "Flow control set to %s\r\n", flow_ctrl_names[mode]);
+    console_puts(response);
+}
 
-    ringbuf_reset(console_rx_buffer);
-    ringbuf_reset(console_tx_buffer);
+static void ICACHE_FLASH_ATTR set_dns_cache(char **tokens, int nTokens)
+{
+    char response[48];
+    int entries = atoi(tokens[2]);
+    bool ok;
 
-    os_sprintf(payload, "CMD>");
-    espconn_sent(pespconn, payload, os_strlen(payload));
+    if (entries < 0 || entries > DNS_CACHE_MAX) {
+	console_puts(INVALID_ARG);
+	return;
+    }
+    config.dns_cache = entries;
+    ok = dns_cache_start(config.dns_cache, config.use_ap ? NULL : &sl_netif);
+    // the stations get the new server with their next lease
+    if (config.use_ap)
+	ap_set_dhcps_dns(ok && config.dns_cache > 0);
+    if (!ok) {
+	console_puts("Out of memory\r\n");
+	return;
+    }
+    os_sprintf(response, "DNS cache set to %d entries\r\n", config.dns_cache);
+    console_puts(response);
 }
+
+static const struct console_cmd set_cmds[] = {
+    { "ssid",		set_ssid,		3 },
+    { "password",	set_password,		3 },
+    { "auto_connect",	set_auto_connect,	3 },
+    { "addr",		set_addr,		3 },
+    { "addr_peer",	set_addr_peer,		3 },
+    { "speed",		set_speed,		3 },
+    { "bitrate",	set_bitrate,		3 },
+    { "use_ap",		set_use_ap,		3 },
+    { "ap_ssid",	set_ap_ssid,		3 },
+    { "ap_password",	set_ap_password,	3 },
+    { "ap_channel",	set_ap_channel,		3 },
+    { "ap_open",	set_ap_open,		3 },
+    { "ssid_hidden",	set_ssid_hidden,	3 },
+    { "max_clients",	set_max_clients,	3 },
+    { "dns",		set_dns,		3 },
+    { "slip_mode",	set_slip_mode,		3 },
+    { "mss_clamp",	set_mss_clamp,		3 },
+    { "slip_mtu",	set_slip_mtu,		3 },
+    { "nat_size",	set_nat_size,		3 },
+    { "portmap_size",	set_portmap_size,	3 },
+    { "flow_ctrl",	set_flow_ctrl,		3 },
+    { "dns_cache",	set_dns_cache,		3 },
+};
+
+static const struct console_cmd console_cmds[] = {
+    { "help",		console_cmd_help,	1, 0,			"" },
+    { "show",		cmd_show,		1, 0,			"[stats]" },
+    { "set",		NULL,			3, CONSOLE_CMD_LOCKED,	"<val>",
+      set_cmds, CONSOLE_CMD_COUNT(set_cmds) },
+    { "portmap",	cmd_portmap,		4, CONSOLE_CMD_LOCKED,	"[add|remove] [TCP|UDP] <ext_port> <int_addr> <int_port>" },
+    { "save",		cmd_save,		1, 0,			"" },
+    { "reset",		cmd_reset,		1, 0,			"[factory]" },
+    { "lock",		cmd_lock,		1, 0,			"" },
+    { "unlock",		cmd_unlock,		1, 0,			"<password>" },
+    { "quit",		cmd_quit,		1, 0,			"" },
+#ifdef ALLOW_SCANNING
+    { "scan",		cmd_scan,		1, 0,			"" },
+#endif
+#ifdef ALLOW_PERF_TEST
+    { "perf",		cmd_perf,		1, CONSOLE_CMD_LOCKED,	"[start|stop|show] | udp <addr> <port> <size> <pkts/s> [<secs>]" },
 #endif
+    { "acl",		cmd_acl,		1, CONSOLE_CMD_LOCKED,	"[show] | add allow|drop any|tcp|udp|icmp|<proto> <src_addr>[/<len>] [<port>[-<port>]] | del <n>" },
+    { "bcast",		cmd_bcast,		1, CONSOLE_CMD_LOCKED,	"[add bcast|mcast|all <udp_port>|any [<pkts/s>] | del <n> | default]" },
+    { "capture",	cmd_capture,		1, CONSOLE_CMD_LOCKED,	"[start [<snaplen>]|stop|dump]" },
+};
 
 #ifdef STATUS_LED
 // Timer cb function
@@ -675,6 +1124,8 @@ void ICACHE_FLASH_ATTR timer_func(void *arg)
 
 //-------------------------------------------------------------------------------------------------
 
+LOCAL void write_to_pbuf_bulk(uint8_t *buf, uint16_t len);
+
 static void ICACHE_FLASH_ATTR user_procTask(os_event_t *events)
 {
     switch(events->sig)
@@ -684,22 +1135,30 @@ static void ICACHE_FLASH_ATTR user_procTask(os_event_t *events)
 	break;
 
     case UART0_SIGNAL:
-	// We get this every time the UART0 receive buffer has been tranfered to the lwip stack
-	// Check, whether it is a complete IP packet
+	// We get this every time the UART0 RX interrupt has put data into the rx ring,
+	// and from the flow hold timer while the ring is held back
+	// Decode it in place into the lwip pbufs and check for complete IP packets
+	if (!slip_rx_hold())
+	    uart0_rx_unload(write_to_pbuf_bulk);
 	slipif_process_rxqueue(&sl_netif);
 
 	break;
 
-    case SIG_CONSOLE_TX:
-        {
-            struct espconn *pespconn = (struct espconn *) events->par;
-            console_send_response(pespconn);
+    case SIG_SLIP_TX:
+	// The UART TX buffer runs low, feed it from the packet queue
+	slip_txq_pump();
+	break;
 
-	    if (pespconn != 0 && remote_console_disconnect) espconn_disconnect(pespconn);
-	    remote_console_disconnect = 0;
-        }
+    case SIG_CONSOLE_TX:
+	console_send();
         break;
 
+#ifdef ALLOW_PERF_TEST
+    case SIG_PERF_IDLE:
+	perf_test_idle();
+	break;
+#endif
+
     case SIG_CONSOLE_RX:
         {
             struct espconn *pespconn = (struct espconn *) events->par;
@@ -715,6 +1174,93 @@ static void ICACHE_FLASH_ATTR user_procTask(os_event_t *events)
 }
 
 /* Callback called when the connection state of the module with an Access Point changes */
+static bool ICACHE_FLASH_ATTR sta_cache_valid(void)
+{
+    return config.sta_cache.channel != 0 && config.sta_cache.ip.addr != 0;
+}
+
+// Sets the STA config for a directed connect to the cached AP with the cached
+// lease as static address (fast) or for a scan and DHCP (full)
+static void ICACHE_FLASH_ATTR sta_configure(bool fast)
+{
+    struct station_config stationConf;
+    struct ip_info info;
+
+    os_memset(&stationConf, 0, sizeof(stationConf));
+    os_sprintf(stationConf.ssid, "%s", config.ssid);
+    os_sprintf(stationConf.password, "%s", config.password);
+    if (fast) {
+	stationConf.bssid_set = 1;
+	os_memcpy(stationConf.bssid, config.sta_cache.bssid, 6);
+	wifi_set_channel(config.sta_cache.channel);
+
+	wifi_station_dhcpc_stop();
+	info.ip = config.sta_cache.ip;
+	info.netmask = config.sta_cache.netmask;
+	info.gw = config.sta_cache.gw;
+	wifi_set_ip_info(STATION_IF, &info);
+	dns_setserver(0, &config.sta_cache.dns);
+    } else {
+	wifi_station_dhcpc_start();
+    }
+    wifi_station_set_config_current(&stationConf);
+    sta_fast = fast;
+    sta_renew = false;
+}
+
+static void ICACHE_FLASH_ATTR sta_fast_timeout(void *arg)
+{
+    if (connected || !sta_fast)
+	return;
+
+    os_printf("Fast connect failed, falling back to scan and DHCP\r\n");
+    config.sta_cache.channel = 0;
+    sta_configure(false);
+    wifi_station_disconnect();
+    wifi_station_connect();
+}
+
+// Starts the time-to-IP measurement and the fallback timer of a fast connect
+static void ICACHE_FLASH_ATTR sta_connect_begin(void)
+{
+    sta_connect_start = system_get_time();
+    os_timer_disarm(&sta_fast_timer);
+    if (sta_fast) {
+	os_timer_setfn(&sta_fast_timer, sta_fast_timeout, NULL);
+	os_timer_arm(&sta_fast_timer, FAST_CONNECT_TIMEOUT_MS, 0);
+    }
+}
+
+// Caches AP and lease of a full connect or of the DHCP renew after a fast
+// one. Only these fields are written to the config in flash, other unsaved
+// changes are left alone.
+static void ICACHE_FLASH_ATTR sta_cache_update(Event_StaMode_Got_IP_t *got_ip)
+{
+    sta_cache_t cache;
+    sysconfig_t *saved;
+
+    // the padding takes part in the comparison below
+    os_memset(&cache, 0, sizeof(cache));
+    os_memcpy(cache.bssid, sta_bssid, 6);
+    cache.channel = sta_channel;
+    cache.ip = got_ip->ip;
+    cache.netmask = got_ip->mask;
+    cache.gw = got_ip->gw;
+    cache.dns = dns_getserver(0);
+    if (os_memcmp(&cache, &config.sta_cache, sizeof(sta_cache_t)) == 0)
+	return;
+    config.sta_cache = cache;
+
+    saved = (sysconfig_t *)os_malloc(sizeof(sysconfig_t));
+    if (saved == NULL)
+	return;
+    if (config_load(saved) == 0) {
+	saved->sta_cache = cache;
+	config_save(saved);
+    }
+    os_free(saved);
+}
+
 void ICACHE_FLASH_ATTR wifi_handle_event_cb(System_Event_t *evt)
 {
 int i;
@@ -724,10 +1270,21 @@ int i;
     {
     case EVENT_STAMODE_CONNECTED:
         os_printf("connect to ssid %s, channel %d\n", evt->event_info.connected.ssid, evt->event_info.connected.channel);
+	    os_memcpy(sta_bssid, evt->event_info.connected.bssid, 6);
+	    sta_channel = evt->event_info.connected.channel;
         break;
 
     case EVENT_STAMODE_DISCONNECTED:
         os_printf("disconnect from ssid %s, reason %d\n", evt->event_info.disconnected.ssid, evt->event_info.disconnected.reason);
+	    if (connected) {
+		// the SDK reconnects, try the fast way first (again: the DHCP
+		// client may run since the last fast connect)
+		if (sta_cache_valid()) {
+		    sta_configure(true);
+		    wifi_station_connect();
+		}
+		sta_connect_begin();
+	    }
 	    connected = false;
 #ifdef STATUS_LED
         // Stop LED-off timer
@@ -743,6 +1300,7 @@ int i;
 
     case EVENT_STAMODE_GOT_IP:
 	    dns_ip = dns_getserver(0);
+	    dns_cache_set_server(&dns_ip);
 
         os_printf("ip:" IPSTR ",mask:" IPSTR ",gw:" IPSTR ",dns:" IPSTR "\n", IP2STR(&evt->event_info.got_ip.ip), IP2STR(&evt->event_info.got_ip.mask), IP2STR(&evt->event_info.got_ip.gw), IP2STR(&dns_ip));
  #ifdef STATUS_LED
@@ -753,10 +1311,30 @@ int i;
         os_timer_arm(&ptimer, 100, 1);
 #endif
 	    my_ip = evt->event_info.got_ip.ip;
+	    ip_fwd_set_napt(&sl_netif, my_ip.addr);
 	    connected = true;
 
+	    os_timer_disarm(&sta_fast_timer);
+	    if (sta_renew) {
+		// the DHCP client confirmed or replaced the cached lease
+		sta_renew = false;
+		sta_cache_update(&evt->event_info.got_ip);
+	    } else {
+		time_to_ip_ms = (system_get_time() - sta_connect_start) / 1000;
+		if (sta_fast) {
+		    fast_connects++;
+		    // The cached lease may have expired and been given to another
+		    // station meanwhile, DHCP renews it or gets a new one
+		    sta_renew = true;
+		    wifi_station_dhcpc_start();
+		} else {
+		    full_connects++;
+		    sta_cache_update(&evt->event_info.got_ip);
+		}
+	    }
+
 	    // Update any predefined portmaps to the new IP addr
-        for (i = 0; i<IP_PORTMAP_MAX; i++) {
+        for (i = 0; i<ip_portmap_max; i++) {
 	        if(ip_portmap_table[i].valid) {
 	            ip_portmap_table[i].maddr = my_ip.addr;
 	        }
@@ -783,8 +1361,13 @@ void ICACHE_FLASH_ATTR user_set_station_config(void)
     os_sprintf(stationConf.password, "%s", config.password);
     wifi_station_set_config(&stationConf);
 
+    // Try the last good AP and lease first, the SDK keeps the plain config
+    if (sta_cache_valid())
+	sta_configure(true);
+
     wifi_set_event_handler_cb(wifi_handle_event_cb);
 
+    sta_connect_begin();
     wifi_station_set_auto_connect(config.auto_connect != 0);
 }
 
@@ -827,7 +1410,7 @@ softuart_write_char(char c)
 LOCAL void ICACHE_FLASH_ATTR
 void_write_char(char c) {}
 
-LOCAL void
+LOCAL void ICACHE_FLASH_ATTR
 write_to_pbuf(char c)
 {
 #ifdef ENABLE_HAYES
@@ -841,6 +1424,139 @@ write_to_pbuf(char c)
 #endif
 }
 
+LOCAL void ICACHE_FLASH_ATTR
+write_to_pbuf_bulk(uint8_t *buf, uint16_t len)
+{
+    uint16_t i;
+
+#ifdef ENABLE_HAYES
+    // The Hayes handler has to see every byte
+    for (i = 0; i < len; i++)
+	write_to_pbuf(buf[i]);
+#else
+    // slipif takes at most 255 bytes per call
+    for (i = 0; i < len; i += 255)
+	slipif_received_bytes(&sl_netif, buf + i, len - i > 255 ? 255 : len - i);
+    Bytes_out += len;
+#ifdef STATUS_LED
+    // Turn LED on on traffic
+    GPIO_OUTPUT_SET (STATUS_LED, 0);
+#endif
+#endif
+}
+
+// Clamps the MSS of SYNs crossing the SLIP link to what fits into its MTU
+static void ICACHE_FLASH_ATTR slip_mss_clamp(struct pbuf *p)
+{
+    uint16_t mss = sl_netif.mtu - 40;
+
+    if (config.mss_clamp == 0)
+	return;
+    if (config.mss_clamp < mss)
+	mss = config.mss_clamp;
+    ip_fwd_mss_clamp(p, mss);
+}
+
+// A line error in the middle of a frame shows up as a broken IP header
+static bool ICACHE_FLASH_ATTR slip_frame_valid(struct pbuf *p)
+{
+    uint8_t *ip = (uint8_t *)p->payload;
+
+    return p->len >= 20 && (ip[0] >> 4) == 4 && (ip[0] & 0x0f) >= 5 &&
+	   ((ip[2] << 8) | ip[3]) <= p->tot_len;
+}
+
+// Input hook of the SLIP interface: restores VJ compressed headers
+static err_t ICACHE_FLASH_ATTR my_slip_input(struct pbuf *p, struct netif *inp)
+{
+    uint8_t hdr[SLC_MAX_HDR];
+    uint8_t type, *chdr;
+    uint16_t len, hlen;
+    int consumed;
+    struct pbuf *q;
+
+    link_stats_in(LINK_IF_SLIP, p->tot_len);
+
+    if (slc == NULL || p->len < 1)
+	goto forward;
+
+    type = *(uint8_t *)p->payload & 0xf0;
+    if (type & TYPE_COMPRESSED_TCP) {
+	os_memset(hdr, 0, SLC_MAX_CHDR);
+	len = pbuf_copy_partial(p, hdr, SLC_MAX_CHDR, 0);
+	consumed = sl_uncompress_tcp(slc, TYPE_COMPRESSED_TCP, hdr, len, p->tot_len, &chdr, &hlen);
+	if (consumed < 0)
+	    goto bad;
+
+	q = pbuf_alloc(PBUF_LINK, hlen + p->tot_len - consumed, PBUF_RAM);
+	if (q == NULL)
+	    goto drop;
+	os_memcpy(q->payload, chdr, hlen);
+	pbuf_copy_partial(p, (uint8_t *)q->payload + hlen, p->tot_len - consumed, consumed);
+	pbuf_free(p);
+	bitrate_frame_ok();
+	capture_packet(q, CAPTURE_IN);
+	return ip_input(q, inp);
+    }
+
+    if (type >= TYPE_UNCOMPRESSED_TCP) {
+	len = pbuf_copy_partial(p, hdr, SLC_MAX_HDR, 0);
+	if (sl_uncompress_tcp(slc, TYPE_UNCOMPRESSED_TCP, hdr, len, p->tot_len, NULL, NULL) < 0)
+	    goto bad;
+	pbuf_take(p, hdr, len);
+    }
+
+forward:
+    if (!slip_frame_valid(p))
+	goto bad;
+    bitrate_frame_ok();
+    link_stats_check_napt();
+    // SYNs are never VJ compressed
+    slip_mss_clamp(p);
+    capture_packet(p, CAPTURE_IN);
+    return ip_input(p, inp);
+
+bad:
+    link_stats.slip_bad_frames++;
+    capture_packet(p, CAPTURE_IN);
+drop:
+    pbuf_free(p);
+    return ERR_OK;
+}
+
+// Output function of the SLIP interface: hands the packet to the TX queue,
+// which does the VJ compression in CSLIP mode and the SLIP framing
+static err_t ICACHE_FLASH_ATTR my_slip_output(struct netif *netif, struct pbuf *p, ip_addr_t *ipaddr)
+{
+    uint32_t src = 0;
+    struct pbuf *q;
+
+    // Broadcast and multicast chatter from the WiFi side
+    if (bcast_filter_drop(p, netif))
+	return ERR_OK;
+    if (acl_drop(p))
+	return ERR_OK;
+
+    // IP_FRAG is 0, what doesn't fit into the link can't go out
+    if (p->tot_len > netif->mtu) {
+	ip_fwd_too_big(p, netif->mtu);
+	return ERR_OK;
+    }
+    capture_packet(p, CAPTURE_OUT);
+    // the TX queue is fair among the sources
+    pbuf_copy_partial(p, &src, sizeof(src), 12);
+
+    // The queue gets its own copy: p might be a TCP segment kept for
+    // retransmission or a buffer of the WiFi driver that must be returned soon
+    q = pbuf_alloc(PBUF_RAW, p->tot_len, PBUF_RAM);
+    if (q == NULL)
+	return ERR_MEM;
+
+    pbuf_copy(q, p);
+    slip_mss_clamp(q);
+    return slip_txq_enqueue(q, src);
+}
+
 static void ICACHE_FLASH_ATTR set_netif(ip_addr_t netif_ip)
 {
 struct netif *nif;
@@ -866,8 +1582,7 @@ void ICACHE_FLASH_ATTR  user_init()
     char int_no = 2;
 
     connected = false;
-    console_rx_buffer = ringbuf_new(80);
-    console_tx_buffer = ringbuf_new(MAX_CON_SEND_SIZE);
+    console_init(console_cmds, CONSOLE_CMD_COUNT(console_cmds), console_locked);
 
 #ifdef DEBUG_SOFTUART
     // Initialize software uart
@@ -887,18 +1602,24 @@ void ICACHE_FLASH_ATTR  user_init()
 
     // Load config
     if (config_load(&config)== 0) {
-	// valid config in FLASH, can read portmap table
-	blob_load(0, (uint32_t *)ip_portmap_table, sizeof(struct portmap_table) * IP_PORTMAP_MAX);
+	// valid config in FLASH, can read portmap table and ACL
+	napt_init();
+	blob_load(0, (uint32_t *)ip_portmap_table, sizeof(struct portmap_table) * ip_portmap_max);
+	blob_load(1, (uint32_t *)acl_rules, sizeof(acl_rules));
     } else {
 
-	// clear portmap table
-	blob_zero(0, sizeof(struct portmap_table) * IP_PORTMAP_MAX);
+	// clear portmap table and ACL
+	napt_init();
+	blob_zero(0, sizeof(struct portmap_table) * PORTMAP_SIZE_MAX);
+	blob_zero(1, sizeof(acl_rules));
     }
+    acl_init();
 
     g_bit_rate = config.bit_rate;
-    remote_console_disconnect = 0;
+    bcast_filter_init(config.bcast_rules);
 
     Bytes_in = Bytes_out = 0;
+    link_stats_init();
 
 #ifdef STATUS_LED
     // Config pin as GPIO12
@@ -921,7 +1642,7 @@ void ICACHE_FLASH_ATTR  user_init()
         os_timer_arm(&ptimer, 100, 1);
 #endif
 
-	    dhcps_set_DNS(&config.ap_dns);
+	    ap_set_dhcps_dns(config.dns_cache > 0);
     } else {
         // Start the STA-Mode
         wifi_set_opmode(STATION_MODE);
@@ -930,14 +1651,12 @@ void ICACHE_FLASH_ATTR  user_init()
 
     system_update_cpu_freq(config.clock_speed);
 
-    // The callback fn that unloads one char from the receive buffer of UART0
-    // We write it directly into the lwip pbufs
-    uart0_unload_fn = write_to_pbuf;
-
     // Configure the SLIP interface
+    slip_set_mode(config.slip_mode);
+    slip_txq_init(g_bit_rate);
     if (config.use_ap) {
 	IP4_ADDR(&netmask, 255, 255, 255, 0);
-	netif_add (&sl_netif, &config.ip_addr, &netmask, &config.ip_addr_peer, &int_no, slipif_init, ip_input);
+	netif_add (&sl_netif, &config.ip_addr, &netmask, &config.ip_addr_peer, &int_no, slipif_init, my_slip_input);
 	netif_set_up(&sl_netif);
 
 	// enable NAT on the AP interface
@@ -947,13 +1666,23 @@ void ICACHE_FLASH_ATTR  user_init()
     } else {
 	IP4_ADDR(&netmask, 255, 255, 255, 0);
 	IP4_ADDR(&gw, 127, 0, 0, 1);
-	netif_add (&sl_netif, &config.ip_addr, &netmask, &gw, &int_no, slipif_init, ip_input);
+	netif_add (&sl_netif, &config.ip_addr, &netmask, &gw, &int_no, slipif_init, my_slip_input);
 	netif_set_up(&sl_netif);
 
 	// enable NAT on the SLIP interface for outgoing traffic via WiFi
 	ip_napt_enable(config.ip_addr.addr, 1);
     }
 
+    // slipif_init() has set the default MTU and set up the UART
+    sl_netif.mtu = config.slip_mtu;
+    slip_set_flow_ctrl(config.flow_ctrl);
+
+    // DNS proxy: in STA mode for the SLIP host only
+    dns_cache_start(config.dns_cache, config.use_ap ? NULL : &sl_netif);
+
+    // Replace the output function of the SLIP interface, all packets go through the TX queue
+    sl_netif.output = my_slip_output;
+
     // Start the telnet server (TCP)
     os_printf("Starting Console TCP Server on %d port\r\n", CONSOLE_SERVER_PORT);
     struct espconn *pCon = (struct espconn *)os_zalloc(sizeof(struct espconn));
@@ -970,7 +1699,7 @@ void ICACHE_FLASH_ATTR  user_init()
     pCon->proto.tcp->local_port = CONSOLE_SERVER_PORT;
 
     // Register callback when clients connect to the server
-    espconn_regist_connectcb(pCon, tcp_client_connected_cb);
+    espconn_regist_connectcb(pCon, console_connected_cb);
 
     // Put the connection in accept mode
     espconn_accept(pCon);